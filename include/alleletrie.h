@@ -0,0 +1,58 @@
+#ifndef HAM_ALLELETRIE_H
+#define HAM_ALLELETRIE_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <stdint.h>
+
+#include "model.h"
+#include "compiledmodel.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Trie of germline hmms that share identical runs of states starting from the first one (alleles of a gene mostly only differ by a few snps).
+// Each node is a range of states [state_begin, state_end) that is the same (same from-lists, transition, init, end, and emission probs) in
+// every hmm below it, and whose from-lists only point at states before state_end. Since the dp values in a run of states only depend on the
+// states before it, a node's dp values are the same for all of its hmms, and TrieTrellis only needs to calculate them once.
+// Each hmm's states are the concatenation of the nodes on the path from its root to its leaf (a node can be a leaf for several identical hmms).
+class AlleleTrie {
+public:
+  struct Node {
+    size_t parent;  // kNoParent for roots
+    size_t state_begin, state_end;
+    Model *hmm;  // one of the hmms below this node, for looking up this node's probabilities
+  };
+  static const size_t kNoParent = SIZE_MAX;
+
+  AlleleTrie() {}
+  AlleleTrie(vector<string> &genes, vector<Model*> &hmms);  // NOTE rebuild it if the hmms' probabilities change (e.g. by rescaling their mute freqs)
+  size_t n_genes() { return genes_.size(); }
+  string &gene(size_t igene) { return genes_[igene]; }
+  Model *hmm(size_t igene) { return hmms_[igene]; }
+  bool has(string gene) { return indices_.count(gene) > 0; }
+  size_t index(string gene) { return indices_.at(gene); }
+  size_t n_nodes() { return nodes_.size(); }
+  Node &node(size_t inode) { return nodes_[inode]; }  // NOTE parents always come before their children
+  vector<size_t> &path(size_t igene) { return paths_[igene]; }  // nodes from <igene>'s root to its leaf
+  size_t n_node_states();  // total number of states in all the nodes (vs the total over all the hmms without sharing)
+  size_t n_states();
+
+private:
+  void AddNodes(vector<size_t> igenes, size_t state_begin, size_t parent);
+  bool SameState(size_t igene, size_t jgene, size_t ist);
+  size_t ClosedEnd(size_t igene, size_t state_begin, size_t state_end);
+
+  vector<string> genes_;
+  vector<Model*> hmms_;
+  map<string, size_t> indices_;
+  vector<vector<double> > init_log_probs_;  // [gene x state] (-INFINITY for states that init can't reach)
+  vector<vector<size_t> > max_from_;  // [gene x state] largest from-state index of any state up to and including this one
+  vector<Node> nodes_;
+  vector<vector<size_t> > paths_;
+};
+
+}
+#endif
@@ -0,0 +1,93 @@
+#ifndef HAM_ARENA_H
+#define HAM_ARENA_H
+
+#include <vector>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <cassert>
+#include <algorithm>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Bump allocator for the dp scratch buffers (trellis columns, traceback tables, etc.), so we're not hammering malloc/free for every trellis in every Run().
+// Memory is only handed back when *everything* allocated from the arena has been deallocated (e.g. in DPHandler::Clear()), at which point we rewind to
+// the start of the first block and keep the blocks around for next time. So in steady state the dp code doesn't touch the heap at all.
+// There's one arena per thread (thread_arena()), and code only allocates from it inside an ArenaScope (otherwise ArenaAllocator falls back to the heap).
+class Arena {
+public:
+  Arena(size_t block_size = 4 << 20, bool hugepages = false);
+  ~Arena();
+  static Arena *thread_arena();  // this thread's arena
+  static Arena *current();  // arena to which new ArenaAllocators in this thread should point (nullptr if we're not inside an ArenaScope)
+  static void set_current(Arena *arena);
+
+  void *Allocate(size_t bytes);
+  void Deallocate(void *ptr, size_t bytes);
+  void set_hugepages(bool hugepages) { hugepages_ = hugepages; }  // only affects blocks that haven't been allocated yet
+  size_t n_live() { return n_live_; }
+  size_t bytes_reserved();
+
+private:
+  struct Block {
+    char *begin;
+    size_t size;
+  };
+  void Rewind();
+  Block NewBlock(size_t min_size);
+
+  size_t block_size_;
+  bool hugepages_;
+  vector<Block> blocks_;
+  size_t iblock_;  // block from which we're currently allocating
+  char *top_;  // next free byte in blocks_[iblock_]
+  size_t n_live_;  // number of allocations that haven't been deallocated
+  mutex mutex_;  // NOTE trellises are occasionally freed from a thread other than the one that allocated them, so we lock (it's never contended, though)
+};
+
+// ----------------------------------------------------------------------------------------
+// sets <arena> as the current arena for this thread until we go out of scope
+class ArenaScope {
+public:
+  ArenaScope(Arena *arena) : previous_(Arena::current()) { Arena::set_current(arena); }
+  ~ArenaScope() { Arena::set_current(previous_); }
+private:
+  Arena *previous_;
+};
+
+// ----------------------------------------------------------------------------------------
+// stl allocator that draws from the thread's current arena when it's constructed (or from the heap if there isn't one)
+template <class T> class ArenaAllocator {
+public:
+  typedef T value_type;
+  ArenaAllocator() : arena_(Arena::current()) {}
+  template <class U> ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena()) {}
+
+  T *allocate(size_t n) {
+    if(arena_)
+      return static_cast<T*>(arena_->Allocate(n * sizeof(T)));
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+  void deallocate(T *ptr, size_t n) {
+    if(arena_)
+      arena_->Deallocate(ptr, n * sizeof(T));
+    else
+      ::operator delete(ptr);
+  }
+  Arena *arena() const { return arena_; }
+
+private:
+  Arena *arena_;
+};
+
+template <class T, class U> bool operator==(const ArenaAllocator<T> &lhs, const ArenaAllocator<U> &rhs) { return lhs.arena() == rhs.arena(); }
+template <class T, class U> bool operator!=(const ArenaAllocator<T> &lhs, const ArenaAllocator<U> &rhs) { return lhs.arena() != rhs.arena(); }
+
+template <class T> using ArenaVector = vector<T, ArenaAllocator<T> >;
+
+}
+#endif
@@ -23,6 +23,7 @@ public:
 
   string hmmdir() { return hmmdir_arg_.getValue(); }
   string datadir() { return datadir_arg_.getValue(); }
+  string hmm_bundle() { return hmm_bundle_arg_.getValue(); }
   string infile() { return infile_arg_.getValue(); }
   string outfile() { return outfile_arg_.getValue(); }
   string annotationfile() { return annotationfile_arg_.getValue(); }
@@ -36,11 +37,17 @@ public:
   string algorithm() { return algorithm_arg_.getValue(); }
   string ambig_base() { return ambig_base_arg_.getValue(); }
   string seed_unique_id() { return seed_unique_id_arg_.getValue(); }
+  string simd() { return simd_arg_.getValue(); }
   int debug() { return debug_arg_.getValue(); }
   int naive_hamming_cluster() { return naive_hamming_cluster_arg_.getValue(); }
   int biggest_naive_seq_cluster_to_calculate() { return biggest_naive_seq_cluster_to_calculate_arg_.getValue(); }
   int biggest_logprob_cluster_to_calculate() { return biggest_logprob_cluster_to_calculate_arg_.getValue(); }
   int n_partitions_to_write() { return n_partitions_to_write_arg_.getValue(); }
+  int checkpoint_interval() { return checkpoint_interval_arg_.getValue(); }
+  int viterbi_filter_n_best() { return viterbi_filter_n_best_arg_.getValue(); }
+  int n_gene_threads() { return n_gene_threads_arg_.getValue(); }
+  int batch_queries() { return batch_queries_arg_.getValue(); }
+  int n_threads() { return n_threads_arg_.getValue(); }
   unsigned n_final_clusters() { return n_final_clusters_arg_.getValue(); }
   unsigned random_seed() { return random_seed_arg_.getValue(); }
   bool no_chunk_cache() { return no_chunk_cache_arg_.getValue(); }
@@ -50,17 +57,26 @@ public:
   bool cache_naive_hfracs() { return cache_naive_hfracs_arg_.getValue(); }
   bool only_cache_new_vals() { return only_cache_new_vals_arg_.getValue(); }
   bool write_logprob_for_each_partition() { return write_logprob_for_each_partition_arg_.getValue(); }
+  bool hugepage_arena() { return hugepage_arena_arg_.getValue(); }
+  bool fast_log_sum_exp() { return fast_log_sum_exp_arg_.getValue(); }
+  bool scaled_forward() { return scaled_forward_arg_.getValue(); }
+  bool float_dp() { return float_dp_arg_.getValue(); }
+  bool validate_float_dp() { return validate_float_dp_arg_.getValue(); }
+  bool lockstep_genes() { return lockstep_genes_arg_.getValue(); }
+  bool allele_trie() { return allele_trie_arg_.getValue(); }
+  bool j_suffix_trellis() { return j_suffix_trellis_arg_.getValue(); }
+  bool factorized_forward() { return factorized_forward_arg_.getValue(); }
  
   // command line arguments
   vector<string> algo_strings_;
   vector<int> debug_ints_;
   ValuesConstraint<string> algo_vals_;
   ValuesConstraint<int> debug_vals_;
-  ValueArg<string> hmmdir_arg_, datadir_arg_, infile_arg_, outfile_arg_, annotationfile_arg_, input_cachefname_arg_, output_cachefname_arg_, locus_arg_, algorithm_arg_, ambig_base_arg_, seed_unique_id_arg_;
+  ValueArg<string> hmmdir_arg_, datadir_arg_, infile_arg_, outfile_arg_, annotationfile_arg_, input_cachefname_arg_, output_cachefname_arg_, locus_arg_, algorithm_arg_, ambig_base_arg_, seed_unique_id_arg_, simd_arg_, hmm_bundle_arg_;
   ValueArg<float> hamming_fraction_bound_lo_arg_, hamming_fraction_bound_hi_arg_, logprob_ratio_threshold_arg_, max_logprob_drop_arg_;
-  ValueArg<int> debug_arg_, naive_hamming_cluster_arg_, biggest_naive_seq_cluster_to_calculate_arg_, biggest_logprob_cluster_to_calculate_arg_, n_partitions_to_write_arg_;
+  ValueArg<int> debug_arg_, naive_hamming_cluster_arg_, biggest_naive_seq_cluster_to_calculate_arg_, biggest_logprob_cluster_to_calculate_arg_, n_partitions_to_write_arg_, checkpoint_interval_arg_, viterbi_filter_n_best_arg_, n_gene_threads_arg_, n_threads_arg_, batch_queries_arg_;
   ValueArg<unsigned> n_final_clusters_arg_, random_seed_arg_;
-  SwitchArg no_chunk_cache_arg_, partition_arg_, dont_rescale_emissions_arg_, cache_naive_seqs_arg_, cache_naive_hfracs_arg_, only_cache_new_vals_arg_, write_logprob_for_each_partition_arg_;
+  SwitchArg no_chunk_cache_arg_, partition_arg_, dont_rescale_emissions_arg_, cache_naive_seqs_arg_, cache_naive_hfracs_arg_, only_cache_new_vals_arg_, write_logprob_for_each_partition_arg_, hugepage_arena_arg_, fast_log_sum_exp_arg_, scaled_forward_arg_, float_dp_arg_, lockstep_genes_arg_, allele_trie_arg_, j_suffix_trellis_arg_, factorized_forward_arg_, validate_float_dp_arg_;
 
   // arguments read from csv input file
   map<string, vector<string> > strings_;
@@ -0,0 +1,75 @@
+#ifndef HAM_BATCHTRELLIS_H
+#define HAM_BATCHTRELLIS_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "sequences.h"
+#include "model.h"
+#include "tracebackpath.h"
+#include "tracebacktable.h"
+#include "arena.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Viterbi for a batch of (model, sequences) pairs of equal length, run in lockstep: the dp columns are laid out [state x lane] with one
+// lane per pair, so every update in the inner loops is over the contiguous lanes, which the compiler vectorizes. The lanes can be different
+// queries against the same model, or the same query against models with the same topology (CompiledModel::SameTopology(), e.g. alleles
+// of a gene), which only differ in their probabilities.
+// We fill in every state in every column (no frontiers), and visit edges and add things up in the same order as Trellis, so each lane's
+// log probs and path are exactly the same as running it on its own (and Trellis::AdoptViterbi() can turn a lane into a chunk cache).
+class BatchTrellis {
+public:
+  BatchTrellis(Model *hmm, vector<Sequence> &seqs);  // each sequence against <hmm>
+  BatchTrellis(Model *hmm, vector<SequencesView> &seqs);  // same, but looking at sequences that somebody else owns (they have to outlive us)
+  BatchTrellis(vector<Model*> &hmms, SequencesView seqs);  // <seqs> against each of <hmms>
+  BatchTrellis(const BatchTrellis&) = delete;  // since <seqs_> can point into <owned_seqs_>
+  void Viterbi();
+  void Traceback(size_t ilane, TracebackPath &path);
+
+  size_t n_lanes() { return n_lanes_; }
+  size_t n_positions() { return n_positions_; }
+  double ending_viterbi_log_prob(size_t ilane) { return ending_viterbi_log_probs_[ilane]; }
+  int32_t ending_viterbi_pointer(size_t ilane) { return ending_viterbi_pointers_[ilane]; }
+  // same as the corresponding Trellis accessors for lane <ilane>, i.e. log prob (including the end transition) and state of the best path ending at <position>
+  double viterbi_log_prob(size_t ilane, size_t position) { return viterbi_log_probs_[position * n_lanes_ + ilane]; }
+  int viterbi_index(size_t ilane, size_t position) { return viterbi_indices_[position * n_lanes_ + ilane]; }
+  TracebackTable &traceback_table(size_t ilane) { return traceback_tables_[ilane]; }
+
+private:
+  void Init(vector<Model*> &hmms, vector<SequencesView> &seqs);
+  void FillEmissions(size_t position);  // set <emissions_> to the emission log probs at <position> for each state and lane
+  void MiddleViterbiVals(size_t position);
+  void ChainViterbiVals();
+  void ImproveLanes(const double *vals, double *current, uint16_t *pointers, size_t ifrom_offset);
+  void CacheViterbiVals(size_t position);
+
+  vector<Model*> hmms_;  // one for each lane
+  vector<Sequences> owned_seqs_;  // if we were given Sequence objects, we keep the Sequences that <seqs_> look at here
+  vector<SequencesView> seqs_;  // one for each lane
+  CompiledModel *compiled_;  // the first lane's compiled model, for the topology (which is the same for all of them)
+  size_t n_lanes_;
+  size_t n_positions_;
+  size_t n_states_;
+  ArenaVector<uint8_t> columns_;  // [position x lane] emission table column for lanes with one sequence
+  ArenaVector<double> from_log_probs_;  // [from-list entry x lane]
+  ArenaVector<double> init_log_probs_;  // [init state x lane]
+  ArenaVector<double> chain_log_probs_;  // [state x lane] (only for chain models)
+  ArenaVector<uint16_t> chain_pointers_;  // [state x lane] traceback cell for the chain edge, i.e. one plus its from-list offset (zero if there isn't one)
+  ArenaVector<double> end_log_probs_;  // [state x lane]
+  ArenaVector<double> scoring_previous_, scoring_current_;  // [state x lane]
+  ArenaVector<double> emissions_;  // [state x lane]
+  ArenaVector<double> edge_vals_;  // [lane] dp values coming in along one edge
+  ArenaVector<double> chain_vals_;  // [state x lane] dp values coming in along the chain edges
+  ArenaVector<uint16_t> pointers_;  // [state x lane] traceback cells for the current position, which we copy into the tables once it's done
+  vector<TracebackTable> traceback_tables_;  // one for each lane
+  ArenaVector<double> viterbi_log_probs_;  // [position x lane]
+  ArenaVector<int> viterbi_indices_;  // [position x lane]
+  ArenaVector<double> ending_viterbi_log_probs_;
+  ArenaVector<int32_t> ending_viterbi_pointers_;
+};
+
+}
+#endif
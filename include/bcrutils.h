@@ -7,11 +7,16 @@
 #include <cassert>
 #include <sstream>
 #include <vector>
+#include <list>
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <mutex>
 
 #include "model.h"
+#include "bundle.h"
+#include "alleletrie.h"
+#include "threadpool.h"
 #include "text.h"
 
 using namespace std;
@@ -25,7 +30,10 @@ namespace ham {
 class SupportPair {
 public:
   SupportPair(string gene, double logprob) : pr_(gene, logprob) {}
-  bool operator < (const SupportPair &rhs) const { return logprob() < rhs.logprob(); }  // return true if rhs is more likely than self
+  // return true if rhs is more likely than self. We compare log probs only to the precision we write them with (see PerGeneSupportString()),
+  // and break ties by gene name, so genes whose log probs differ only by rounding error (e.g. from adding things up in a different order)
+  // always come out in the same order (reverse alphabetical, once Result::Finalize() has reversed the sorted list).
+  bool operator < (const SupportPair &rhs) const;
   string gene() const { return pr_.first; }
   double logprob() const { return pr_.second; }
   pair<string, double> pr_;
@@ -64,6 +72,8 @@ public:
 class GermLines {
 public:
   GermLines(string gldir, string locus);
+  GermLines(HMMBundle &bundle, string locus);  // read from <bundle> instead of the germline dir (throws if it's for a different locus)
+  void Write(BundleWriter &out);  // write our bundle record (see bundle.h)
   string SanitizeName(string gene_name);
   string GetRegion(string gene);
 
@@ -130,23 +140,44 @@ public:
   size_t vmin, dmin, vmax, dmax;
 };
 // ----------------------------------------------------------------------------------------
+// Most snapshots we keep around at once. Each one is just the emission tables, but there's one for each gene at each mute freq, so in a long
+// partition run they'd otherwise add up. Snapshots whose mute freq is pinned (see HMMHolder::PinMuteFreq()) don't count toward this.
+const size_t kMaxSnapshots(4096);
+// ----------------------------------------------------------------------------------------
+// The hmms as read from disk, which we never modify, plus an immutable snapshot for each (gene, mute freq) with the emission
+// probabilities rescaled to reflect that mute freq instead of the one recorded in the hmm file (see Model(Model&, double)). The hmms from the
+// file are never deleted until we are. Snapshots are only handed out for pinned mute freqs, and are only deleted (least recently used first,
+// once we have more than kMaxSnapshots) when nobody has their mute freq pinned, so pointers from Get() stay valid until the caller unpins.
+// Everything is safe to call from several threads at once.
+// If we're given a bundle, we read the hmms from it instead of from the yaml files in <hmm_dir>.
 class HMMHolder {
 public:
-  HMMHolder(string hmm_dir, GermLines &gl, Track *track): hmm_dir_(hmm_dir), gl_(gl), track_(track) {}
+  HMMHolder(string hmm_dir, GermLines &gl, Track *track, HMMBundle *bundle=nullptr): hmm_dir_(hmm_dir), gl_(gl), track_(track), bundle_(bundle) {}
   ~HMMHolder();
-  Model *Get(string gene);
+  Model *Get(string gene, double overall_mute_freq=-INFINITY);  // if <overall_mute_freq> is -INFINITY, the hmm as it was in the file, otherwise the snapshot for it (which has to be pinned)
+  void PinMuteFreq(double overall_mute_freq);  // keep the snapshots for <overall_mute_freq> until a matching UnpinMuteFreq() (does nothing for -INFINITY)
+  void UnpinMuteFreq(double overall_mute_freq);
   Track *track() { return track_; }
-  // Rescale, within each hmm, the emission probabilities to reflect <overall_mute_freq> instead of the mute freq which was recorded in the hmm file.
-  // If <overall_mute_freq> is -INFINITY, we re-rescale them to what they were originally
-  void RescaleOverallMuteFreqs(map<string, set<string> > &only_genes, double overall_mute_freq);  // WOE BETIDE THEE WHO FORGETETH TO RE-RESET THESE
-  void UnRescaleOverallMuteFreqs(map<string, set<string> > &only_genes);
-  void CacheAll();  // read all available hmms into memory
+  void CacheAll(size_t n_threads=1);  // read all available hmms into memory, on <n_threads> threads
+  void Prefetch(vector<vector<string> > &gene_lists, size_t n_threads=1);  // read in, on <n_threads> threads, every available hmm in the union of <gene_lists> (e.g. each query's only_genes), so Get() doesn't have to during the dp
+  AlleleTrie BuildAlleleTrie(set<string> &genes, double overall_mute_freq=-INFINITY);  // trie of the hmms (see Get()) for those of <genes> that are chain models
   string NameString(map<string, set<string> > *only_genes=nullptr, int max_to_print=-1);  // if more than <max_to_print> for any region, only print the number of genes for each region
 private:
+  Model *GetFromFile(string gene);  // from <hmms_>, or if it isn't there read it and add it. NOTE doesn't lock <mutex_>
+  Model *Read(string gene);  // read a new model from the yaml file, or the bundle if we have one (doesn't touch <hmms_>, so no need to lock)
+  bool Available(string gene);  // true if we have, or can read, an hmm for <gene>
+  void Load(set<string> &genes, size_t n_threads);  // read in any of <genes> that we don't already have and are available, in parallel
+  void EvictSnapshots();  // delete the least recently used unpinned snapshots until we're down to kMaxSnapshots (if we can). NOTE doesn't lock <mutex_>
+
   string hmm_dir_;
   GermLines &gl_;
+  mutex mutex_;  // protects <hmms_>, <snapshots_>, <snapshot_lru_>, and <pins_>
   map<string, Model*> hmms_; // map of gene name to hmm pointer
+  map<pair<string, double>, pair<Model*, list<pair<string, double> >::iterator> > snapshots_;  // rescaled snapshot for each gene and (exact) mute freq, and its entry in <snapshot_lru_>
+  list<pair<string, double> > snapshot_lru_;  // keys of <snapshots_>, most recently used first
+  map<double, int> pins_;  // number of pins on each mute freq
   Track *track_;  // each of the models has a track... but they should all be the same, so just toss one here for easy access
+  HMMBundle *bundle_;  // NOTE not ours
 };
 
 // ----------------------------------------------------------------------------------------
@@ -0,0 +1,89 @@
+#ifndef HAM_BUNDLE_H
+#define HAM_BUNDLE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+#include <stdint.h>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Binary hmm bundles (written by ham-compile): the germline info for one locus plus every hmm in an hmm directory, already parsed, so
+// bcrham can start up without reading hundreds of yaml files. The layout is
+//   header: kBundleMagic, uint32 kBundleVersion, uint32 kBundleByteOrder, uint64 offset of the index
+//   germline record (see GermLines::Write())
+//   one record for each hmm (see Model::Write())
+//   index: uint64 number of hmms, then for each one its gene name, and the uint64 offset and size of its record
+// Numbers are written in the byte order of the machine that wrote the bundle, and we refuse to read it on one with the other order.
+// Bump kBundleVersion whenever anything in the records changes.
+const char kBundleMagic[8] = {'h', 'a', 'm', 'b', 'n', 'd', 'l', '\0'};
+const uint32_t kBundleVersion(1);
+const uint32_t kBundleByteOrder(0x01020304);
+
+// ----------------------------------------------------------------------------------------
+// Appends values to a byte buffer, which we then write to disk.
+class BundleWriter {
+public:
+  void U32(uint32_t val) { Bytes(&val, sizeof(val)); }
+  void U64(uint64_t val) { Bytes(&val, sizeof(val)); }
+  void Int(int val) { Bytes(&val, sizeof(val)); }
+  void Double(double val) { Bytes(&val, sizeof(val)); }
+  void String(const string &str);
+  void Doubles(const vector<double> &vals);
+  void Bytes(const void *data, size_t size);
+  void SetU64(size_t offset, uint64_t val);  // overwrite the value at <offset> (e.g. to fill in an offset once we know it)
+  size_t size() { return buffer_.size(); }
+  void Write(string fname);
+private:
+  string buffer_;
+};
+
+// ----------------------------------------------------------------------------------------
+// Reads values, in the same order BundleWriter wrote them, from <size> bytes at <data> (which we don't own). Throws if we'd read past the end.
+class BundleReader {
+public:
+  BundleReader(const char *data, size_t size) : data_(data), size_(size), pos_(0) {}
+  uint32_t U32() { uint32_t val; Bytes(&val, sizeof(val)); return val; }
+  uint64_t U64() { uint64_t val; Bytes(&val, sizeof(val)); return val; }
+  int Int() { int val; Bytes(&val, sizeof(val)); return val; }
+  double Double() { double val; Bytes(&val, sizeof(val)); return val; }
+  string String();
+  vector<double> Doubles();
+  void Bytes(void *dest, size_t size);
+  size_t pos() { return pos_; }
+private:
+  const char *data_;
+  size_t size_;
+  size_t pos_;
+};
+
+// ----------------------------------------------------------------------------------------
+// A bundle file mapped read-only into memory, so the pages are shared by every process on the machine that's reading the same bundle,
+// and only the records for the hmms we actually use are ever read in from disk. The models themselves are built from their records
+// the first time someone asks for them (see HMMHolder::Get()).
+class HMMBundle {
+public:
+  HMMBundle(string fname);
+  ~HMMBundle();
+  HMMBundle(const HMMBundle&) = delete;
+  HMMBundle &operator=(const HMMBundle&) = delete;
+
+  string fname() { return fname_; }
+  BundleReader germline_reader() { return BundleReader(data_ + germline_offset_, index_offset_ - germline_offset_); }
+  bool has_model(string gene) { return index_.count(gene) > 0; }
+  BundleReader model_reader(string gene);  // throws if we don't have it
+  vector<string> genes();  // in alphabetical order
+
+private:
+  string fname_;
+  const char *data_;
+  size_t size_;
+  size_t germline_offset_, index_offset_;
+  map<string, pair<uint64_t, uint64_t> > index_;  // offset and size of the record for each gene
+};
+
+}
+#endif
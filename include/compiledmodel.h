@@ -0,0 +1,164 @@
+#ifndef HAM_COMPILEDMODEL_H
+#define HAM_COMPILEDMODEL_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <stdint.h>
+#include <math.h>
+#include <stdexcept>
+
+#include "track.h"
+
+using namespace std;
+namespace ham {
+class State;
+
+// ----------------------------------------------------------------------------------------
+// For the int16 log probs in CompiledModel::transition_scores<int16_t>() and emission_scores<int16_t>() (see ViterbiFilter): log prob x becomes round(kQuantizedScale * x), and anything
+// below about -1000 (including -INFINITY) saturates at kQuantizedMinusInfinity.
+const double kQuantizedScale(32.);
+const int16_t kQuantizedMinusInfinity(INT16_MIN);
+inline int16_t QuantizeLogProb(double log_prob) {
+  if(log_prob <= kQuantizedMinusInfinity / kQuantizedScale)
+    return kQuantizedMinusInfinity;
+  return (int16_t)lround(kQuantizedScale * log_prob);
+}
+
+// ----------------------------------------------------------------------------------------
+// The (log) probabilities the dp kernels read, in score type <T>. CompiledModel keeps one of each of these in double and one in float, so the
+// trellis can run in either precision (see BasicTrellis), plus a quantized int16 one (log probs only) for ViterbiFilter. Indexed the same
+// way as the corresponding CompiledModel accessors. Only the double log probs are filled in up front: the rest are built the first time
+// somebody asks for them (see CompiledModel::transition_scores()), since most runs only need a few of them. The transitions are split out from the emissions because rescaled snapshots of a
+// model (see Model(Model&, double)) only have different emissions.
+template <class T> struct TransitionScores {
+  vector<T> from_log_probs;
+  vector<T> chain_log_probs;
+  vector<T> init_log_probs;
+  vector<T> end_log_probs;
+  // and the same things as plain probabilities (for Trellis::ScaledForward())
+  vector<T> from_probs;
+  vector<T> chain_probs;
+  vector<T> init_probs;
+  vector<T> end_probs;
+};
+template <class T> struct EmissionScores {
+  vector<T> emissions;  // dense [state x column] table of emission log probs (see Track::column())
+  vector<T> emissions_by_column;  // transpose of <emissions>, i.e. [column x state]
+  vector<T> emission_probs_by_column;  // and as plain probabilities
+};
+
+// ----------------------------------------------------------------------------------------
+// Flat, structure-of-arrays copy of everything the dp kernels need to know about a model, built once in Model::Finalize().
+// The State/Transition objects are convenient for parsing and printing, but following State::transitions_ (a vector of mostly-null
+// pointers of length n_states) for every (state, from-state) pair in every column wastes a lot of cache, so Trellis only looks in here.
+class CompiledModel {
+public:
+  CompiledModel();
+  CompiledModel(const CompiledModel&) = delete;
+  CompiledModel &operator=(const CompiledModel&) = delete;
+  void Compile(vector<State*> &states, State *initial, Track *track);
+  void ShareTopology(CompiledModel &base);  // use <base>'s (already compiled) topology and transitions, e.g. for a snapshot with rescaled emissions (call SetEmissions() next)
+  void SetEmissions(vector<State*> &states, vector<vector<double> > *log_probs=nullptr);  // NOTE call only once, before anybody looks at them. Fill the emission tables from the states' emission probs, or if it's set, from <log_probs> ([state][symbol], e.g. rescaled to a different mute freq)
+  bool SameTopology(CompiledModel &other);  // true if <other> has the same states, from-lists, init states, and chain edges as us (so only the probabilities differ)
+  // Specialized for double, float, and int16_t. Everything but the double log probs is built (once, and thread-safely) the first time it's
+  // asked for, and the plain (non-log) probs only if <with_probs> is set (there aren't any for int16_t).
+  template <class T> inline const TransitionScores<T> &transition_scores(bool with_probs=false);
+  template <class T> inline const EmissionScores<T> &emission_scores(bool with_probs=false);
+
+  inline size_t n_states() { return topology_->n_states; }
+  inline size_t n_columns() { return topology_->n_columns; }  // number of columns in the emission table, i.e. alphabet size plus one for the ambiguous symbol
+
+  // csr from-state lists: the states from which we can reach <ist> are from_indices()[from_begin(ist)] through from_indices()[from_end(ist) - 1], in increasing order
+  inline size_t from_begin(size_t ist) { return topology_->from_offsets[ist]; }
+  inline size_t from_end(size_t ist) { return topology_->from_offsets[ist + 1]; }
+  inline const uint16_t *from_indices() { return topology_->from_indices.data(); }
+  inline const double *from_log_probs() { return topology_->scores.from_log_probs.data(); }  // log prob of the transition from from_indices()[i] to the state to whose list entry i belongs
+  inline size_t max_n_from() { return topology_->max_n_from; }  // length of the longest from-state list
+
+  // Germline hmms are nearly left-to-right chains: most states are reached from the previous state, plus a few from init and insert states.
+  // If that's the case (see DetectChain()), the kernels handle the (<ist> - 1 --> <ist>) edges for all states at once as shifted vectors, and
+  // only loop over the rest of each from-list (the "residual" edges, which are the from-list minus its last entry for states with a chain edge).
+  inline bool is_chain() { return topology_->is_chain; }
+  inline const double *chain_log_probs() { return topology_->scores.chain_log_probs.data(); }  // log prob of the transition from <ist> - 1 to <ist> (-INFINITY if there isn't one)
+  inline size_t residual_end(size_t ist) { return topology_->scores.chain_log_probs[ist] == -INFINITY ? from_end(ist) : from_end(ist) - 1; }
+  inline const vector<uint16_t> &residual_states() { return topology_->residual_states; }  // states with at least one residual edge, in increasing order
+
+  // states to which init can transition, in increasing order, and the corresponding log probs
+  inline const vector<uint16_t> &init_indices() { return topology_->init_indices; }
+  inline const vector<double> &init_log_probs() { return topology_->scores.init_log_probs; }
+
+  inline double end_log_prob(size_t ist) { return topology_->scores.end_log_probs[ist]; }  // -INFINITY if <ist> has no transition to end
+  inline const double *end_log_probs() { return topology_->scores.end_log_probs.data(); }
+  inline double emission_log_prob(size_t ist, uint8_t column) { return emission_scores_.emissions[ist * n_columns() + column]; }
+  inline const double *emission_column(uint8_t column) { return &emission_scores_.emissions_by_column[column * n_states()]; }  // emission log probs of <column> for all the states
+  inline double emission_log_prob(size_t ist, const uint32_t *counts);  // total log prob of emitting a column with <counts[icol]> sequences in each column <icol>
+
+  // csr to-state lists, likewise: the states we can reach from <ist> are to_indices()[to_begin(ist)] through to_indices()[to_end(ist) - 1]
+  inline size_t to_begin(size_t ist) { return topology_->to_offsets[ist]; }
+  inline size_t to_end(size_t ist) { return topology_->to_offsets[ist + 1]; }
+  inline const uint16_t *to_indices() { return topology_->to_indices.data(); }
+
+private:
+  // Everything but the emissions, which is never modified once Compile() is done, so rescaled snapshots can share it with their base model.
+  struct Topology {
+    size_t n_states;
+    size_t n_columns;
+    size_t max_n_from;
+    bool is_chain;
+    Track *track;  // NOTE owned by the model
+    vector<size_t> from_offsets;  // length n_states + 1
+    vector<uint16_t> from_indices;
+    vector<uint16_t> init_indices;
+    vector<uint16_t> residual_states;
+    vector<size_t> to_offsets;  // length n_states + 1
+    vector<uint16_t> to_indices;
+    // NOTE the lazily-built tables (everything but the double log probs) are mutable, since they're filled in after we're shared (see BuildTransitionTables())
+    mutable TransitionScores<double> scores;
+    mutable TransitionScores<float> float_scores;  // copy of <scores> in single precision
+    mutable TransitionScores<int16_t> quantized_scores;  // quantized copy of <scores>'s log probs (the plain probs are left empty)
+    mutable once_flag probs_built, float_built, float_probs_built, quantized_built;
+  };
+  void DetectChain(Topology &topology);
+  // build the lazy tables of score type <T> (plus the plain probs if <with_probs> is set), unless they're already there
+  template <class T> void BuildTransitionTables(bool with_probs);
+  template <class T> void BuildEmissionTables(bool with_probs);
+
+  shared_ptr<const Topology> topology_;
+  EmissionScores<double> emission_scores_;
+  EmissionScores<float> float_emission_scores_;  // copy of <emission_scores_> in single precision
+  EmissionScores<int16_t> quantized_emission_scores_;  // quantized copy of <emission_scores_>'s log probs
+  once_flag emission_probs_built_, float_emissions_built_, float_emission_probs_built_, quantized_emissions_built_;
+};
+
+// ----------------------------------------------------------------------------------------
+template <> void CompiledModel::BuildTransitionTables<double>(bool with_probs);
+template <> void CompiledModel::BuildTransitionTables<float>(bool with_probs);
+template <> void CompiledModel::BuildTransitionTables<int16_t>(bool with_probs);
+template <> void CompiledModel::BuildEmissionTables<double>(bool with_probs);
+template <> void CompiledModel::BuildEmissionTables<float>(bool with_probs);
+template <> void CompiledModel::BuildEmissionTables<int16_t>(bool with_probs);
+
+// ----------------------------------------------------------------------------------------
+template <> inline const TransitionScores<double> &CompiledModel::transition_scores<double>(bool with_probs) { BuildTransitionTables<double>(with_probs); return topology_->scores; }
+template <> inline const TransitionScores<float> &CompiledModel::transition_scores<float>(bool with_probs) { BuildTransitionTables<float>(with_probs); return topology_->float_scores; }
+template <> inline const TransitionScores<int16_t> &CompiledModel::transition_scores<int16_t>(bool with_probs) { assert(!with_probs); BuildTransitionTables<int16_t>(false); return topology_->quantized_scores; }
+template <> inline const EmissionScores<double> &CompiledModel::emission_scores<double>(bool with_probs) { BuildEmissionTables<double>(with_probs); return emission_scores_; }
+template <> inline const EmissionScores<float> &CompiledModel::emission_scores<float>(bool with_probs) { BuildEmissionTables<float>(with_probs); return float_emission_scores_; }
+template <> inline const EmissionScores<int16_t> &CompiledModel::emission_scores<int16_t>(bool with_probs) { assert(!with_probs); BuildEmissionTables<int16_t>(false); return quantized_emission_scores_; }
+
+// ----------------------------------------------------------------------------------------
+inline double CompiledModel::emission_log_prob(size_t ist, const uint32_t *counts) {
+  size_t n_cols(n_columns());
+  const double *row(&emission_scores_.emissions[ist * n_cols]);
+  double logprob(0.);
+  for(size_t icol = 0; icol < n_cols; ++icol) {
+    if(counts[icol] > 0)  // skip the zeros, since 0 * -INFINITY is nan
+      logprob += counts[icol] * row[icol];
+  }
+  return logprob;
+}
+
+}
+#endif
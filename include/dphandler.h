@@ -2,6 +2,10 @@
 #define HAM_DPHANDLER_H
 
 #include <map>
+#include <list>
+#include <tuple>
+#include <unordered_map>
+#include <memory>
 #include <string>
 #include <sstream>
 #include <math.h>
@@ -10,6 +14,10 @@
 #include <stdexcept>
 
 #include "trellis.h"
+#include "trelliscache.h"
+#include "suffixtrellis.h"
+#include "viterbifilter.h"
+#include "threadpool.h"
 #include "mathutils.h"
 #include "bcrutils.h"
 #include "args.h"
@@ -26,6 +34,9 @@ public:
   Result Run(vector<Sequence*> pseqvector, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);  // run all over the kspace specified by bounds in kmin and kmax
   Result Run(vector<Sequence> seqvector, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);
   Result Run(Sequence seq, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);
+  // Run each of <seqvector> as a single-sequence query (they all have to be the same length, and their mute freqs have to round to the same one),
+  // filling each trellis that a query would otherwise have to calculate from scratch in one batch trellis for it and all the queries after it.
+  vector<Result> RunBatch(vector<Sequence> &seqvector, KBounds kbounds, vector<string> only_gene_list, vector<double> overall_mute_freqs);
   void HandleFishyAnnotations(Result &multi_seq_result, vector<Sequence*> pqry_seqs, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq);
   void HandleFishyAnnotations(Result &multi_seq_result, vector<Sequence> qry_seqs, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq);
   // void StreamOutput(double test);  // print csv event info to stderr
@@ -33,16 +44,37 @@ public:
   void PrintCachedTrellisSize();
 
 private:
+  Sequences &NewSequences(bool clear_cache);
+  Result Run(Sequences &seqs, KBounds kbounds, vector<string> &only_gene_list, double overall_mute_freq);  // NOTE the trellises in the caches look at <seqs>, so it has to come from NewSequences()
   void RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes);
-  KSet FindPartialCacheMatch(string region, string gene, KSet kset);
+  void FilterGenes(Sequences &seqs, KBounds kbounds, map<string, set<string> > &only_genes);
+  struct RegionResult {  // score (including the gene choice prob) and viterbi path for one gene on one region's subsequence
+    double score;
+    shared_ptr<TracebackPath> path;  // shared by all the ksets that give the same subsequence (null for forward)
+  };
+  uint64_t RegionKey(string region, KSet kset, size_t length);  // (start, length) of <region>'s subsequence for <kset>, where <length> is the subsequence's length
+  RegionResult *FindRegionResult(string region, string gene, KSet kset, size_t length);  // nullptr if we haven't calculated it yet
+  RegionResult &AddRegionResult(string region, string gene, KSet kset, size_t length);
   void InitCache(string gene);
-  void FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin);
+  void FillRegionResults(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, vector<string> &genes, vector<RegionResult*> &results, vector<string> &origins);
+  RegionResult &FillTrellis(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, string gene, string &origin);
+  void FillSuffixTrellises(Sequences &seqs, KBounds kbounds, set<string> &j_genes);
+  void FillFactorizedScores(Sequences &seqs, KBounds kbounds, map<string, set<string> > &genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores);
+  void RegionForwardLogProbs(SequencesView query_seqs, set<string> &genes, vector<double> &total_log_probs, vector<double> &best_log_probs);
+  RegionResult &FillFromSuffixTrellis(KSet kset, string gene, string &origin);
+  void FillTrieTrellises(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, set<string> &genes);
+  void FillLockstepTrellises(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, set<string> &genes);
+  void FillBatchTrellises(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, set<string> &genes);
+  void ClearCaches();  // everything that Clear() clears except the sequences, and what RunBatch() keeps for the whole batch
+  template <class TrellisT> double FillTrellis(SequencesView &query_seqs, vector<string> &query_strs, string gene, string &origin, map<string, TrellisCache<TrellisT> > &cachefo, TracebackPath *path);
+  template <class TrellisT> double RunTrellis(TrellisT *trell, string gene, TracebackPath *path);  // run <algorithm_> on <trell>, returning the uncorrected score (and filling <path> for viterbi)
+  void ValidateFloatDP(SequencesView &query_seqs, string gene, double uncorrected_score, TracebackPath *path);
   RecoEvent FillRecoEvent(Sequences &seqs, KSet kset, map<string, string> &best_genes, double score);
   vector<string> GetQueryStrs(Sequences &seqs, KSet kset, string region);
 
   void PrintPath(KSet kset, vector<string> query_strs, string gene, double score, string extra_str = "");
-  Sequences GetSubSeqs(Sequences &seqs, KSet kset, string region);
-  map<string, Sequences> GetSubSeqs(Sequences &seqs, KSet kset);  // get the subsequences for the v, d, and j regions given a k_v and k_d
+  SequencesView GetSubSeqs(Sequences &seqs, KSet kset, string region);
+  map<string, SequencesView> GetSubSeqs(Sequences &seqs, KSet kset);  // get the subsequences for the v, d, and j regions given a k_v and k_d
   void SetInsertions(string region, vector<string> path_names, RecoEvent *event);
   size_t GetInsertStart(string side, size_t path_length, size_t insert_length);
   string GetInsertion(string side, vector<string> names);
@@ -52,14 +84,28 @@ private:
   Args *args_;
   GermLines &gl_;
   HMMHolder &hmms_;
+  ThreadPool *thread_pool_;  // for --n-gene-threads (nullptr if we're not using threads). NOTE not ours, since it's shared by all the DPHandlers
+  double overall_mute_freq_;  // mute freq for the current Run(), i.e. which of <hmms_>'s snapshots we use (-INFINITY for the unrescaled hmms)
+  vector<double> pinned_mute_freqs_;  // mute freqs we've pinned in <hmms_>, since our cached trellises point at their snapshots (we unpin them in Clear())
 
   // NOTE BEWARE DRAGONS AND ALL THAT SHIT!
   // if you add something new here you *must* clear it in Clear(), because we reuse the dphandler for different sequences UPDATE kind of don't do that any more
   // NOTE also that the vector<string> key can take up a ton of memory for multi-hmms with large k UPDATE dammit, no, I don't think that's where the memory was going
-  map<string, map<vector<string>, Trellis> > scratch_cachefo_;  // collection of the trellises that  we've calculated from scratch, so we can reuse them. eg: scratch_cachefo_["IGHV1-18*01"]["ACGGGTCG"] for single hmms, or scratch_cachefo_["IGHV1-18*01"][("ACGGGTCG","ATGGTTAG")] for pair hmms
-  map<string, map<KSet, TracebackPath> > paths_;
-  map<string, map<KSet, double> > scores_;
+  map<string, TrellisCache<Trellis> > scratch_cachefo_;  // collection of the trellises that  we've calculated from scratch, so we can reuse them. eg: scratch_cachefo_["IGHV1-18*01"] has the one for {"ACGGGTCG"} for single hmms, or for {"ACGGGTCG","ATGGTTAG"} for pair hmms
+  map<string, TrellisCache<FloatTrellis> > float_scratch_cachefo_;  // same thing, but for --float-dp
+  map<string, unordered_map<uint64_t, RegionResult> > region_results_;  // for each gene, the results we've calculated keyed by RegionKey(), so every kset that gives a region the same subsequence finds them with one lookup
   map<string, double> per_gene_support_;  // log prob of the best (full) annotation for each gene
+  map<string, SuffixTrellis> suffix_trellises_;  // for --j-suffix-trellis, table for each j gene on the query from <suffix_start_> to the end
+  size_t suffix_start_;
+  map<string, AlleleTrie> allele_tries_;  // for --allele-trie, trie of each region's hmms (rebuilt in each Run(), since the probabilities depend on the mute freq)
+  list<Sequences> run_seqs_;  // query sequences for each Run() since the last Clear(), which the trellises in the caches look at (a list, so they never move)
+  vector<Sequences*> batch_seqs_;  // for RunBatch(), each query's sequences (in <run_seqs_>)
+  size_t ibatch_;  // and the one we're running
+  map<tuple<string, size_t, size_t>, pair<unique_ptr<BatchTrellis>, size_t> > batch_trellises_;  // lockstep trellis for each gene and start and length of the query subsequence, and the query in its first lane
+
+  // for --validate-float-dp (reset at the start of each Run())
+  int n_float_validations_, n_float_path_mismatches_;
+  double max_float_deviation_;
 };
 }
 #endif
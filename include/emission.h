@@ -18,8 +18,7 @@ class Emission {
 public:
   Emission();
   void Parse(YAML::Node config, Track *track);
-  void ReplaceLogProbs(vector<double> new_log_probs) { scores_.ReplaceLogProbs(new_log_probs); }
-  void UnReplaceLogProbs() { scores_.UnReplaceLogProbs(); }
+  void Init(Track *track, vector<double> log_probs);  // set the log probs directly (e.g. from a bundle) rather than parsing them
   ~Emission();
 
   double score(Sequence *seq, size_t pos) { return scores_.LogProb(seq, pos); }
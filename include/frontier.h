@@ -0,0 +1,61 @@
+#ifndef HAM_FRONTIER_H
+#define HAM_FRONTIER_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <cassert>
+
+#include "arena.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Set of states that are live in one column of the dp table: a list of the active state indices (so we only iterate over those), plus dense
+// flags so adding a state that's already there is cheap. Sized from the model, so there's no compile-time limit on the number of states.
+class Frontier {
+public:
+  Frontier(size_t n_states = 0) : flags_(n_states, 0) {}
+  void Init(size_t n_states) { flags_.assign(n_states, 0); active_.clear(); }
+
+  inline size_t size() const { return active_.size(); }
+  inline bool contains(size_t ist) const { return flags_[ist]; }
+  inline ArenaVector<uint16_t>::const_iterator begin() const { return active_.begin(); }
+  inline ArenaVector<uint16_t>::const_iterator end() const { return active_.end(); }
+
+  inline void Add(size_t ist);
+  inline void Add(const uint16_t *ibegin, const uint16_t *iend);  // add each state in [ibegin, iend)
+  inline void Clear();  // only touches the active states, not all n_states flags
+  void Fill() { Clear(); for(size_t ist = 0; ist < flags_.size(); ++ist) Add(ist); }  // add all the states
+  void Sort() { sort(active_.begin(), active_.end()); }  // iterate in state order, so we add things up in the same order as if we'd looped over all the states
+  void swap(Frontier &other) { flags_.swap(other.flags_); active_.swap(other.active_); }
+
+private:
+  ArenaVector<uint8_t> flags_;
+  ArenaVector<uint16_t> active_;
+};
+
+// ----------------------------------------------------------------------------------------
+inline void Frontier::Add(size_t ist) {
+  assert(ist < flags_.size());
+  if(flags_[ist])
+    return;
+  flags_[ist] = 1;
+  active_.push_back(ist);
+}
+
+// ----------------------------------------------------------------------------------------
+inline void Frontier::Add(const uint16_t *ibegin, const uint16_t *iend) {
+  for(const uint16_t *ist = ibegin; ist != iend; ++ist)
+    Add(*ist);
+}
+
+// ----------------------------------------------------------------------------------------
+inline void Frontier::Clear() {
+  for(auto &ist : active_)
+    flags_[ist] = 0;
+  active_.clear();
+}
+
+}
+#endif
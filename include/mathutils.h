@@ -89,6 +89,39 @@ const uint32_t POWER[32][128] = {
 };
 #endif
 
+// ----------------------------------------------------------------------------------------
+// log(1 + exp(-d)) for d >= 0, i.e. the correction term when adding two log probs that differ by <d>.
+// In exact mode (the default) this just calls log() and exp(). In fast mode it instead interpolates in a table of cubic hermite
+// splines with knots every 1/64 out to d = 40 (beyond which it returns zero), so the absolute error is below kFastLog1pExpMaxError
+// (the interpolation error is at most h^4 max|fourth derivative| / 384 = (1/64)^4 (1/8) / 384 = 1.9e-11, plus rounding, and exp(-40) = 4e-18).
+enum LogSumExpMode { kExactLogSumExp, kFastLogSumExp };
+const double kFastLog1pExpMaxError(2.5e-11);
+extern LogSumExpMode log_sum_exp_mode_;  // NOTE only set this with SetLogSumExpMode()
+void SetLogSumExpMode(LogSumExpMode mode);
+inline LogSumExpMode log_sum_exp_mode() { return log_sum_exp_mode_; }
+double FastLog1pExp(double d);  // always uses the table
+// uses the current mode: inline, so the exact path (which is what AddInLogSpace() almost always ends up doing) costs only a predictable branch on top of log() and exp()
+inline double Log1pExp(double d) {
+  if(log_sum_exp_mode_ == kFastLogSumExp)
+    return FastLog1pExp(d);
+  return log1p(exp(-d));
+}
+
+// log(sum_i exp(vals[i])) for a whole column of values at once: we subtract the max, so we need only one log() rather than one for
+// every pair of values. Entries that are -INFINITY are fine (they contribute nothing), and if they all are, so is the result.
+template<typename T>
+T LogSumExp(const T *vals, size_t n) {
+  T max_val(-INFINITY);
+  for(size_t i = 0; i < n; ++i)
+    max_val = max(vals[i], max_val);
+  if(max_val == -INFINITY)
+    return -INFINITY;
+  T total(0.);
+  for(size_t i = 0; i < n; ++i)
+    total += exp(vals[i] - max_val);  // -INFINITY entries give exp(-INFINITY) = 0
+  return max_val + log(total);
+}
+
 //! Takes two logd values and adds them together, i.e. takes (log a, log b) --> log a+b
 //! i.e. a *or* b
 //! \param first  log'd Double value
@@ -101,9 +134,9 @@ T AddInLogSpace(T first, T second) {
   } else if(second == -INFINITY) {
     return first;
   } else if(first > second) {
-    return first + log(1 + exp(second - first));
+    return first + Log1pExp(first - second);
   } else {
-    return second + log(1 + exp(first - second));
+    return second + Log1pExp(second - first);
   }
 }
 
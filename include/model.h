@@ -3,6 +3,7 @@
 
 #include <fstream>
 #include "state.h"
+#include "compiledmodel.h"
 #include "yaml-cpp/yaml.h"
 
 using namespace std;
@@ -11,11 +12,18 @@ namespace ham {
 class Model {
 public:
   Model();
+  // Snapshot of <base> with its emissions rescaled to reflect <overall_mute_freq>. We share <base>'s states and track (so it has to outlive us),
+  // and its compiled topology and transitions, and only our compiled emission tables are different, i.e. that's the only place the dp kernels
+  // should look for emission probs. <base> isn't modified.
+  Model(Model &base, double overall_mute_freq);
+  Model(const Model&) = delete;
+  Model &operator=(const Model&) = delete;
   ~Model();
   void Parse(string);
+  void Parse(YAML::Node config, string infname);  // same, but from yaml we've already loaded (<infname> is only for error messages)
+  void Write(BundleWriter &out);  // write our bundle record (see bundle.h)
+  void Read(BundleReader &in);  // instead of Parse(), from a bundle record
   void AddState(State*);
-  void RescaleOverallMuteFreq(double overall_mute_freq);  // Rescale emissions to reflect <overall_mute_freq>, unless <overall_mute_freq> is -INFINITY, in which case we *re*-rescale them to what they were originally
-  void UnRescaleOverallMuteFreq();  // Undo the above
   void Finalize();
   void AddMaybeFasterFromStateStuff();
 
@@ -24,10 +32,12 @@ public:
   size_t n_states() { return states_.size(); }
   State *state(string name) { assert(states_by_name_.count(name)); return states_by_name_[name]; }
   State *state(size_t ist) { assert(ist < states_.size()); return states_[ist]; }
-  bitset<STATE_MAX> *initial_to_states() { return initial_->to_states(); }  // get vector of states to which the initial state may transition
+  vector<bool> *initial_to_states() { return initial_->to_states(); }  // get vector of states to which the initial state may transition
   State *init_state() { return initial_; }
+  CompiledModel *compiled() { return &compiled_; }  // flat representation for the dp kernels
   double overall_prob() { return overall_prob_; }
   double original_overall_mute_freq() { return original_overall_mute_freq_; }
+  double overall_mute_freq() { return overall_mute_freq_; }
 
 private:
   void FinalizeState(State *st);
@@ -39,13 +49,15 @@ private:
   double original_overall_mute_freq_;  // mean mutation frequency, over v, d and j (not insertions), for the sequences in the data set
                                        // from which this hmm was derived. Reiterating: mean over all genes and all regions, *not* just this gene.
                                        // Note, this is the *original* one, i.e. we don't reset it when we reset the mute freqs
-  double rescale_ratio_;  // ratio by which we have rescaled the emission probabilities (-INFINITY if we haven't rescaled them, i.e. if they correspond to <original_overall_mute_freq_>)
+  double overall_mute_freq_;  // mute freq to which our emission probabilities are rescaled (-INFINITY if we haven't rescaled them, i.e. if they correspond to <original_overall_mute_freq_>)
+  Model *base_;  // if we're a rescaled snapshot, the model whose states and track we share (otherwise nullptr, and they're ours)
   string ambiguous_char_;
   Track *track_;
   vector<State*> states_; //!  All the states contained in the model
   map<string, State*> states_by_name_; //Ptr to state stored by State name;
   State *initial_;
   State *ending_;
+  CompiledModel compiled_;
   bool finalized_;
 };
 
@@ -25,7 +25,8 @@ public:
   inline size_t size() const { return seqq_.size(); }
   inline Track* track() const { return track_; }
   inline vector<uint8_t> *seqq() { return &seqq_; }
-  inline string undigitized() const { return undigitized_; }
+  inline const uint8_t *digits() const { return seqq_.data(); }
+  inline const string &undigitized() const { return undigitized_; }
   Sequence GetSubSequence(size_t pos, size_t len);
 
   void Print(string separator = " "); // if separator is specified, print it between each element in the sequence
@@ -42,11 +43,11 @@ private:
 // ----------------------------------------------------------------------------------------
 class Sequences {
 public:
-  Sequences() : sequence_length_(0) {}
+  Sequences() : sequence_length_(0), n_profile_columns_(0) {}
   // Sequences(const Sequences &rhs);
   Sequences(Sequences &rhs, size_t pos, size_t len);  // copy <seqs> from <pos> to <pos> + <len>
   // Sequences(vector<Sequence> &seqs);
-  void AddSeq(Sequence sq);
+  void AddSeq(const Sequence &sq);
 
   short value(size_t iseq, size_t ipos) { return seqs_.at(iseq).value(ipos); }  // return digitized value of <iseq>th sequence at position <ipos>
   Sequence &operator[](size_t index) { return seqs_.at(index); }
@@ -54,6 +55,10 @@ public:
   Sequence *get_ptr(size_t index) { return &seqs_.at(index); }
   size_t n_seqs() const { return seqs_.size(); }
   size_t GetSequenceLength() { return sequence_length_;}
+  // position-major column-count profile, i.e. profile()[ipos * n_profile_columns() + icol] is the number of sequences with emission table column <icol> (see Track::column()) at <ipos>.
+  // Computed the first time it's asked for (and sliced, rather than recounted, by the subsequence constructor).
+  inline vector<uint32_t> &profile() { if(profile_.size() == 0) SetProfile(); return profile_; }
+  inline size_t n_profile_columns() { return n_profile_columns_; }
   Sequences Union(Sequences &otherseqs);  // return union set of self and <otherseqs>
   // Sequences GetSubSequences(size_t pos, size_t len);
 
@@ -75,8 +80,40 @@ public:
     return seq_str;
   }
 private:
+  void SetProfile();
   vector<Sequence> seqs_;
   size_t sequence_length_; // length of the sequences (required to be the same for all)
+  vector<uint32_t> profile_;
+  size_t n_profile_columns_;
+};
+
+// ----------------------------------------------------------------------------------------
+// Non-owning window onto positions [pos, pos + len) of a Sequences, so taking the subsequences for each kset and region doesn't copy
+// anything. The dp classes take these rather than Sequences (a Sequences converts to a view of the whole thing).
+// NOTE the Sequences has to outlive the view, and mustn't have any more sequences added to it, since we point into it
+class SequencesView {
+public:
+  SequencesView() : seqs_(nullptr), pos_(0), len_(0) {}
+  SequencesView(Sequences &seqs) : seqs_(&seqs), pos_(0), len_(seqs.GetSequenceLength()) {}
+  SequencesView(Sequences &seqs, size_t pos, size_t len);
+  SequencesView(const SequencesView &view, size_t pos, size_t len);  // <pos> is relative to the start of <view>
+
+  size_t n_seqs() const { return seqs_ == nullptr ? 0 : seqs_->n_seqs(); }
+  size_t GetSequenceLength() const { return len_; }
+  size_t pos() const { return pos_; }
+  inline uint8_t value(size_t iseq, size_t ipos) const { return (*seqs_)[iseq].value(pos_ + ipos); }  // digitized value of <iseq>th sequence at position <ipos> (relative to the start of the view)
+  inline const uint8_t *digits(size_t iseq) const { return (*seqs_)[iseq].digits() + pos_; }
+  inline Track *track() const { return (*seqs_)[0].track(); }
+  // our chunk of the parent's profile (see Sequences::profile()), i.e. profile()[ipos * n_profile_columns() + icol]
+  inline const uint32_t *profile() const { return &seqs_->profile()[pos_ * seqs_->n_profile_columns()]; }
+  inline size_t n_profile_columns() const { seqs_->profile(); return seqs_->n_profile_columns(); }
+  string undigitized(size_t iseq) const { return (*seqs_)[iseq].undigitized().substr(pos_, len_); }
+  string name_str(string delimiter = " ") const { return seqs_->name_str(delimiter); }
+
+private:
+  Sequences *seqs_;
+  size_t pos_;
+  size_t len_;
 };
 
 }
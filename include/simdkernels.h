@@ -0,0 +1,43 @@
+#ifndef HAM_SIMDKERNELS_H
+#define HAM_SIMDKERNELS_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdexcept>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Vectorized versions of the column updates in the chain kernels (see Trellis::ChainViterbiVals()), operating on the flat arrays in CompiledModel.
+// We compile a copy of each kernel for each instruction set, and pick the best one the cpu supports at run time, so the same binary works on any x86 box.
+// kScalar means don't use these at all, i.e. stick with the original per-state loops in Trellis.
+// The viterbi kernels give bit-for-bit the same answers as the scalar code. The forward ones use their own exp() and log(), and add things up in a different
+// order, so they agree with the scalar code to within a small number of ulps (see hample's CheckKernels()).
+enum SimdLevel { kScalar = 0, kSSE4 = 1, kAVX2 = 2, kAVX512 = 3 };
+
+struct SimdKernels {
+  // out[0] = -INFINITY, out[i] = (emissions[i] + chain_log_probs[i]) + previous[i - 1]
+  void (*chain_vals)(const double *emissions, const double *chain_log_probs, const double *previous, double *out, size_t n);
+  // current[i] = max(current[i], chain_vals[i]), setting improved[i] to 1 if chain_vals[i] was strictly larger (and 0 otherwise)
+  void (*viterbi_merge)(const double *chain_vals, double *current, uint8_t *improved, size_t n);
+  // index of the first state with the largest current[i] + end_log_probs[i] (which we put in <best>), or SIZE_MAX if they're all -INFINITY
+  size_t (*viterbi_best_ending)(const double *current, const double *end_log_probs, size_t n, double *best);
+  // current[i] = log(exp(current[i]) + exp(chain_vals[i]))
+  void (*forward_merge)(const double *chain_vals, double *current, size_t n);
+  // log(sum_i exp(current[i] + end_log_probs[i]))
+  double (*forward_ending_sum)(const double *current, const double *end_log_probs, size_t n);
+};
+
+SimdLevel DetectSimdLevel();  // best level the cpu supports
+SimdLevel simd_level();  // level we're currently using (defaults to DetectSimdLevel())
+void SetSimdLevel(SimdLevel level);  // throws if the cpu doesn't support <level>
+void SetSimdLevel(string name);  // "auto", "scalar", "sse4", "avx2", or "avx512"
+string SimdLevelName(SimdLevel level);
+const SimdKernels *simd_kernels();  // kernels for the current level (nullptr for kScalar)
+const SimdKernels *simd_kernels(SimdLevel level);
+
+}
+#endif
@@ -4,13 +4,14 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <algorithm>
 #include <stdint.h>
 #include <stdlib.h>
-#include <bitset>
 
 #include "text.h"
 #include "emission.h"
 #include "transitions.h"
+#include "bundle.h"
 #include "yaml-cpp/yaml.h"
 
 using namespace std;
@@ -20,29 +21,32 @@ class Transition;
 class State {
 public:
   State();
-  void Parse(YAML::Node node, vector<string> state_names, Track *track);
-  void RescaleOverallMuteFreq(double factor);  // Rescale emissions by the ratio <factor>
-  void UnRescaleOverallMuteFreq();  // undo the above
+  void Parse(YAML::Node node, const set<string> &state_names, Track *track);  // <state_names> are all the states in the model, so we can check our transitions
+  void Write(BundleWriter &out);  // everything Parse() reads (see Model::Write())
+  void Read(BundleReader &in, Track *track);  // instead of Parse(), from what Write() wrote
+  vector<double> RescaledEmissionLogProbs(double factor);  // our emission log probs with the mute freq rescaled by the ratio <factor> (we don't change our own)
   ~State();
 
   inline string name() { return name_; }
   inline string abbreviation() { return name_.substr(0, 1); }
   inline size_t index() { return index_; }  // index of this state in the HMM model
+  inline string ambiguous_char() { return ambiguous_char_; }
   inline vector<Transition*> *transitions() { return transitions_; }
-  inline bitset<STATE_MAX> *to_states() { return &to_states_; }
-  inline bitset<STATE_MAX> *from_states() { return &from_states_; }
+  inline vector<bool> *to_states() { return &to_states_; }
+  inline vector<bool> *from_states() { return &from_states_; }
+  inline bool can_transition_to(size_t ist) { return ist < to_states_.size() && to_states_[ist]; }
   inline vector<size_t> *from_state_indices() { return &from_state_indices_; }
   inline Transition *transition(size_t iter) { return (*transitions_)[iter]; }
   inline Transition *trans_to_end() { return trans_to_end_; }
 
   double EmissionLogprob(uint8_t ch);
-  double EmissionLogprob(Sequences *seqs, size_t pos);
-  inline double transition_logprob(size_t to_state) { return (*transitions_)[to_state]->log_prob(); }
+  double EmissionLogprob(SequencesView &seqs, size_t pos);
+  double transition_logprob(size_t to_state);  // NOTE there has to be a transition to <to_state>
   double end_transition_logprob();
 
   // property-setters for use in model::finalize()
-  inline void AddToState(State *st) { to_states_[st->index()] = 1; }  // set bit in <to_states_> corresponding to <st>
-  inline void AddFromState(State *st) { from_states_[st->index()] = 1; }  // set bit in <from_states_> corresponding to <st>
+  inline void AddToState(State *st) { SetFlag(to_states_, st->index()); }  // set bit in <to_states_> corresponding to <st>
+  inline void AddFromState(State *st) { SetFlag(from_states_, st->index()); }  // set bit in <from_states_> corresponding to <st>
   inline void SetIndex(size_t val) { index_ = val; }
   void ReorderTransitions(map<string, State*>& state_indices);
 
@@ -50,6 +54,8 @@ public:
 
   void Print();
 private:
+  inline void SetFlag(vector<bool> &flags, size_t index) { if(index >= flags.size()) flags.resize(index + 1, false); flags[index] = true; }  // the flag vectors only grow as far as the highest index we've set, so we don't need to know the number of states ahead of time
+
   string name_, germline_nuc_;
   double ambiguous_emission_logprob_;
   string ambiguous_char_;
@@ -59,8 +65,8 @@ private:
 
   // hmm model-level information (assigned in model::finalize)
   size_t index_;  // position of this state in the vector model::states_ (set in model::finalize)
-  bitset<STATE_MAX> to_states_;
-  bitset<STATE_MAX> from_states_;
+  vector<bool> to_states_;
+  vector<bool> from_states_;
   vector<size_t> from_state_indices_;  // same information as <from_states_>, but hopefully faster to iterate over
 };
 
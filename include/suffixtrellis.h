@@ -0,0 +1,52 @@
+#ifndef HAM_SUFFIXTRELLIS_H
+#define HAM_SUFFIXTRELLIS_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "sequences.h"
+#include "model.h"
+#include "mathutils.h"
+#include "tracebackpath.h"
+#include "arena.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Dp table filled in backwards from the end of the sequences, so that one table gives the viterbi (or forward) log prob and path for every
+// suffix of the sequences, i.e. for a model run from any start position to the end. This is what we want for j, whose query sequence
+// always ends at the end of the query but starts wherever k_v + k_d puts it, so Trellis's chunk caching (which shares prefixes) can't help.
+// The log probs are the same as Trellis's up to rounding (since we add things up in the opposite order), and if two paths are tied we may
+// pick a different one.
+class SuffixTrellis {
+public:
+  SuffixTrellis(Model *hmm, SequencesView seqs);
+  void Viterbi();
+  void Forward();
+  double viterbi_log_prob(size_t start);  // log prob of the best path for the suffix starting at <start> (-INFINITY if there isn't one)
+  double forward_log_prob(size_t start);  // total log prob of the suffix starting at <start>
+  void Traceback(size_t start, TracebackPath &path);  // same as Trellis::Traceback() on the suffix starting at <start>
+
+  Model *model() { return hmm_; }
+  size_t n_positions() { return n_positions_; }
+
+private:
+  const double *EmissionColumn(size_t position);
+  double StartVal(size_t start, bool viterbi, int32_t *start_state);  // combine the init transitions with the first emission and the table at <start>
+
+  Model *hmm_;
+  CompiledModel *compiled_;
+  SequencesView seqs_;
+  size_t n_positions_;
+  size_t n_states_;
+  vector<double> to_log_probs_;  // log prob of the transition for each entry in the compiled model's to-lists
+  ArenaVector<uint8_t> columns_;  // if we only have one sequence, its emission table column at each position
+  ArenaVector<double> emission_column_;
+  ArenaVector<double> viterbi_vals_;  // [position x state] best log prob of emitting everything after <position> and then ending, given that we're in the state at <position>
+  ArenaVector<int32_t> next_states_;  // [position x state] and the state at the next position on that path
+  ArenaVector<double> forward_vals_;  // [position x state] same as <viterbi_vals_>, but summed over all the paths
+};
+
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef HAM_THREADPOOL_H
+#define HAM_THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Fixed set of worker threads for running the iterations of a loop in parallel (e.g. the genes for each region in DPHandler::RunKSet()).
+// The calling thread works on the loop too, and ParallelFor() doesn't return until every iteration has finished. Iterations are handed out
+// in order but can finish in any order, so callers should have each one write to its own slot, and then combine them in order afterwards.
+// Only one loop runs on the pool at a time: if another thread is already using it, ParallelFor() just runs the loop itself.
+class ThreadPool {
+public:
+  ThreadPool(size_t n_threads);  // <n_threads> includes the calling thread, i.e. we start <n_threads> - 1 workers
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool &operator=(const ThreadPool&) = delete;
+  static ThreadPool *shared(size_t n_threads);  // pool for the whole process, started the first time it's asked for (later values of <n_threads> are ignored)
+
+  void ParallelFor(size_t n_iterations, const function<void(size_t)> &body);  // run body(i) for i in [0, n_iterations), and rethrow the first exception that any of them threw
+  size_t n_threads() { return workers_.size() + 1; }
+
+private:
+  void WorkerLoop();
+  void Work();  // run iterations of the current loop until they've all been handed out
+
+  vector<thread> workers_;
+  mutex loop_mutex_;  // held by whichever thread is running a loop on the pool
+  mutex mutex_;  // protects everything below
+  condition_variable start_cv_, done_cv_;
+  const function<void(size_t)> *body_;
+  size_t n_iterations_, next_iteration_, n_done_;
+  size_t generation_;  // incremented for each loop, so the workers can tell there's a new one
+  bool stopping_;
+  exception_ptr exception_;
+};
+
+}
+#endif
@@ -14,8 +14,8 @@ namespace ham {
 
 class TracebackPath {
 public:
-  TracebackPath(Model* model) : hmm_(model), abbreviate_(false) {}
-  TracebackPath() : hmm_(nullptr) {}
+  TracebackPath(Model* model) : hmm_(model), score_(-INFINITY), abbreviate_(false) {}
+  TracebackPath() : hmm_(nullptr), score_(-INFINITY), abbreviate_(false) {}
   void push_back(int state) { path_.push_back(state); }
   void clear() { path_.clear(); }
 
@@ -0,0 +1,83 @@
+#ifndef HAM_TRACEBACKTABLE_H
+#define HAM_TRACEBACKTABLE_H
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <cassert>
+
+#include "compiledmodel.h"
+#include "arena.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Viterbi traceback pointers for [position x state], stored as one contiguous, bit-packed buffer.
+// Since the best previous state is always one of the state's from-states, instead of the previous state's index we store one plus its offset
+// in the state's from-list in the compiled model (zero means no pointer). With the usual handful of from-states this fits in a few bits, so
+// we pick the smallest of 1, 2, 4, 8, or 16 bits per cell that can hold the largest in-degree (cells never straddle words).
+class TracebackTable {
+public:
+  TracebackTable();
+  void Init(size_t n_positions, CompiledModel *compiled);  // (re)allocate for <n_positions> positions, with all pointers unset
+
+  inline size_t n_positions() const { return n_positions_; }
+  inline size_t bits_per_cell() const { return bits_per_cell_; }
+  size_t bytes() const { return sizeof(uint64_t) * words_.size(); }
+
+  inline void set(size_t position, size_t i_st, size_t ifrom);  // previous state is the <ifrom>th entry (counting from zero) in <i_st>'s from-list
+  inline int32_t get(size_t position, size_t i_st) const;  // index of the previous state, or -1 if there isn't one
+  inline void clear_row(size_t position);
+  inline void set_row(size_t position, const uint16_t *cells, size_t stride);  // set every state's pointer at <position> from <cells>[i_st * <stride>], which is one plus the from-list offset (zero for none)
+
+private:
+  CompiledModel *compiled_;
+  size_t n_positions_;
+  size_t n_states_;
+  size_t bits_per_cell_;
+  size_t cells_per_word_;
+  size_t words_per_row_;  // pad each row to a whole number of words, so rows can be reset independently
+  uint64_t cell_mask_;
+  ArenaVector<uint64_t> words_;
+};
+
+// ----------------------------------------------------------------------------------------
+inline void TracebackTable::set(size_t position, size_t i_st, size_t ifrom) {
+  assert(position < n_positions_ && i_st < n_states_);
+  uint64_t &word(words_[position * words_per_row_ + i_st / cells_per_word_]);
+  size_t shift((i_st % cells_per_word_) * bits_per_cell_);
+  word = (word & ~(cell_mask_ << shift)) | ((uint64_t)(ifrom + 1) << shift);
+}
+
+// ----------------------------------------------------------------------------------------
+inline int32_t TracebackTable::get(size_t position, size_t i_st) const {
+  assert(position < n_positions_ && i_st < n_states_);
+  uint64_t word(words_[position * words_per_row_ + i_st / cells_per_word_]);
+  size_t cell((word >> ((i_st % cells_per_word_) * bits_per_cell_)) & cell_mask_);
+  if(cell == 0)
+    return -1;
+  return compiled_->from_indices()[compiled_->from_begin(i_st) + cell - 1];
+}
+
+// ----------------------------------------------------------------------------------------
+inline void TracebackTable::clear_row(size_t position) {
+  assert(position < n_positions_);
+  fill(words_.begin() + position * words_per_row_, words_.begin() + (position + 1) * words_per_row_, 0);
+}
+
+// ----------------------------------------------------------------------------------------
+inline void TracebackTable::set_row(size_t position, const uint16_t *cells, size_t stride) {
+  assert(position < n_positions_);
+  uint64_t *row(&words_[position * words_per_row_]);
+  for(size_t iword = 0; iword < words_per_row_; ++iword) {
+    uint64_t word(0);
+    size_t ifirst(iword * cells_per_word_), ilast(min(n_states_, ifirst + cells_per_word_));
+    for(size_t i_st = ifirst; i_st < ilast; ++i_st)
+      word |= (uint64_t)cells[i_st * stride] << ((i_st - ifirst) * bits_per_cell_);
+    row[iword] = word;
+  }
+}
+
+}
+#endif
@@ -25,6 +25,8 @@ public:
 
   string name() { return name_; }
   size_t alphabet_size() { return alphabet_.size(); }
+  size_t n_columns() { return alphabet_.size() + 1; }  // number of columns in a dense emission table, i.e. one for each symbol plus one for the ambiguous symbol
+  uint8_t column(uint8_t index) { return index == ambiguous_index_ ? alphabet_.size() : index; }  // column in a dense emission table corresponding to digitized symbol <index>
   string symbol(size_t iter) { return alphabet_.at(iter); }  // return <iter>th element of <alphabet_> (which is probably a letter, but could be several letters or something else). NOTE throws std:out_of_range exception if <iter> is invalide
   uint8_t symbol_index(const string &symbol);
   string Stringify();
@@ -17,6 +17,7 @@ public:
   Transition(string to_state, double prob);
 
   void set_to_state(State* st) { to_state_ = st; }
+  void set_log_prob(double log_prob) { log_prob_ = log_prob; }  // e.g. when reading from a bundle, where we've only got the log prob
   string &to_state_name() { return to_state_name_; }
   State *to_state() { return to_state_; }
   double log_prob() { return log_prob_; }
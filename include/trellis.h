@@ -8,23 +8,30 @@
 #include "sequences.h"
 #include "model.h"
 #include "tracebackpath.h"
+#include "tracebacktable.h"
+#include "arena.h"
+#include "frontier.h"
+#include "simdkernels.h"
+#include "batchtrellis.h"
+#include "trietrellis.h"
 
 using namespace std;
 namespace ham {
 
-typedef vector<vector<int16_t> > int_2D;
-
 // ----------------------------------------------------------------------------------------
-class Trellis {
+// Dp tables for running viterbi and forward on one model and one set of sequences. Templated on the type <T> of the dp scores: Trellis (double)
+// is what everything uses by default, while FloatTrellis takes half the memory (and twice as many states per vector register in the
+// compiler-vectorized loops) for when single precision is good enough, e.g. for naive sequence inference (see Args::float_dp()).
+// NOTE the simd kernels in simdkernels.h are double-only, so FloatTrellis always uses the scalar chain kernels.
+template <class T> class BasicTrellis {
 public:
-  Trellis(Model *hmm, Sequence seq, Trellis *cached_trellis = nullptr);
-  Trellis(Model *hmm, Sequences seqs, Trellis *cached_trellis = nullptr);
+  BasicTrellis(Model *hmm, SequencesView seqs, BasicTrellis *cached_trellis = nullptr);  // NOTE the sequences that <seqs> looks at have to outlive any dp we run
   void Init();
-  Trellis();
-  ~Trellis();
+  BasicTrellis();
+  ~BasicTrellis();
 
   Model *model() { return hmm_; }
-  Sequences seqs() { return seqs_; }
+  SequencesView &seqs() { return seqs_; }
   double ending_viterbi_log_prob() { return ending_viterbi_log_prob_; }  // for full sequence length
   double ending_forward_log_prob() { return ending_forward_log_prob_; }  // for full sequence length
   // NOTE (and beware) this is confusing to subtract one from the length. BUT it is totally on purpose: I want the calling code to be able to just worry about how long its sequence is.
@@ -34,47 +41,108 @@ public:
   double ending_forward_log_prob(size_t length) { return forward_log_probs_pointer_->at(length - 1); } // NOTE do *not* use <forward_log_probs_>
   size_t viterbi_pointer(size_t length) { return viterbi_indices_pointer_->at(length - 1); } // i.e. the zeroth entry of viterbi_indices_ corresponds to stopping with sequence of length 1 NOTE do *not* use <viterbi_indices_>  
 
-  int_2D *traceback_table_pointer() const { return traceback_table_pointer_; }
-  vector<double> *viterbi_log_probs_pointer() { return viterbi_log_probs_pointer_; }
-  vector<double> *forward_log_probs_pointer() { return forward_log_probs_pointer_; }
-  vector<int> *viterbi_indices_pointer() { return viterbi_indices_pointer_; }
+  TracebackTable *traceback_table_pointer() const { return traceback_table_pointer_; }
+  ArenaVector<T> *viterbi_log_probs_pointer() { return viterbi_log_probs_pointer_; }
+  ArenaVector<T> *forward_log_probs_pointer() { return forward_log_probs_pointer_; }
+  ArenaVector<int> *viterbi_indices_pointer() { return viterbi_indices_pointer_; }
 
-  void SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states);
-  void MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position);
-  void MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position);
-  void CacheViterbiVals(size_t position, double dpval, size_t i_st_current);
-  void CacheForwardVals(size_t position, double dpval, size_t i_st_current);
+  // NOTE <previous_states> are the states that were live in the column *before* <scoring_previous>, i.e. the entries we need to reset in <scoring_previous> before reusing it
+  void SwapColumns(ArenaVector<T> *&scoring_previous, ArenaVector<T> *&scoring_current, Frontier &previous_states, Frontier &current_states, Frontier &next_states);
+  void MiddleViterbiVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, Frontier &current_states, Frontier &next_states, size_t position, TracebackTable *traceback_table, size_t traceback_row);  // <traceback_table> may be nullptr, in which case we don't record pointers
+  void MiddleForwardVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, Frontier &current_states, Frontier &next_states, size_t position);
+  // versions of the above for chain models (see CompiledModel::is_chain()), which fill in the whole column and don't need the frontiers
+  void ChainViterbiVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position, TracebackTable *traceback_table, size_t traceback_row);
+  void ChainForwardVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position);
+  // and versions of those that use the vectorized kernels in <simd_kernels_>
+  void SimdChainViterbiVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position, TracebackTable *traceback_table, size_t traceback_row);
+  void SimdChainForwardVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position);
+  void CacheViterbiVals(size_t position, T dpval, size_t i_st_current);
+  void CacheForwardVals(size_t position, T dpval, size_t i_st_current);
+  void FlushForwardVals(size_t position);  // in fast log-sum-exp mode, add up the values that CacheForwardVals() collected for <position>
+  // If <interval> is nonzero, Viterbi() only keeps every <interval>th column of the dp table instead of the whole traceback table, and Traceback()
+  // recomputes the pointers one segment at a time (if it's negative, we use roughly the square root of the sequence length). Gives the same paths, in much less memory.
+  void SetCheckpointInterval(int interval);
+  size_t checkpoint_interval() { return checkpoint_interval_; }
+  // If set, Forward() works with plain probabilities instead of log probs, rescaling each column so it sums to one (and keeping track of the
+  // log of the scale factors), so the inner loops are just multiplies and adds. Agrees with the log space version to within rounding error.
+  void SetScaledForward(bool scaled) { scaled_forward_ = scaled; }
+  void UseGenericKernels() { chain_kernels_ = false; simd_kernels_ = nullptr; }  // run chain models through the generic kernels anyway (for checking that the chain kernels give exactly the same answer)
   void Viterbi();
+  void AdoptViterbi(BatchTrellis &batch, size_t ilane);  // take lane <ilane> of <batch> (which has to be our model and sequences) as our viterbi results, as if we'd run Viterbi()
+  void AdoptViterbi(TrieTrellis &trie_trell, size_t igene);  // same, for gene <igene> in <trie_trell>
   void Forward();
   void Traceback(TracebackPath &path);
+  void CheckpointedTraceback(size_t length, int32_t pointer, TracebackPath &path);
 
   string SizeString();
   double ApproxBytesUsed();
 
   void Dump();
 private:
+  inline T EmissionLogprob(size_t i_st, size_t position);  // emission log prob for all of <seqs_> at <position>
+  const T *EmissionColumn(size_t position);  // emission log probs at <position> for all the states
+  void FillChainVals(ArenaVector<T> *scoring_previous, const T *emissions);
+  void InitFrontiers(Frontier &previous_states, Frontier &current_states, Frontier &next_states);
+  template <class BatchT> void AdoptBatchViterbi(BatchT &batch, size_t ilane);
+  void RebuildFrontiers(ArenaVector<T> &scoring_column, Frontier &previous_states, Frontier &current_states, Frontier &next_states);  // set up the frontiers for continuing on from checkpoint column <scoring_column>
+  void RecomputeTracebackSegment(size_t start, size_t end, TracebackTable &segment_table);
+  void ScaledForward();
+  void ScaledForwardVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position, double *log_scale);
+  bool RescaleColumn(ArenaVector<T> *scoring_current, size_t position, double *log_scale);  // returns false if every state in the column has zero probability
+  const T *EmissionProbColumn(size_t position, double *log_scale);  // emission probs (not logged) at <position> for all the states, divided by a factor whose log we add to <log_scale>
+
   Model *hmm_;
-  Sequences seqs_;
-  int_2D *traceback_table_pointer_;  // if we have a cached trellis, this points to the cached trellis's table
-  int_2D traceback_table_;  // if we have a cached trellis, this isn't initialized
+  CompiledModel *compiled_;  // flat version of <hmm_> that the dp kernels actually use
+  const TransitionScores<T> *transition_scores_;  // <compiled_>'s probabilities in our score type
+  const EmissionScores<T> *emission_scores_;
+  bool chain_kernels_;  // use the chain kernels (true for chain models unless UseGenericKernels() was called)
+  const SimdKernels *simd_kernels_;  // vectorized column updates for chain models, for the simd level that was set when we were initialized (nullptr to use the scalar ones)
+  SequencesView seqs_;
+  ArenaVector<uint8_t> columns_;  // if we only have one sequence, its emission table column at each position (otherwise we use the column-count profile in <seqs_>)
+  TracebackTable *traceback_table_pointer_;  // if we have a cached trellis, this points to the cached trellis's table
+  TracebackTable traceback_table_;  // if we have a cached trellis, this isn't initialized
 
-  Trellis *cached_trellis_;  // pointer to another trellis that already has its dp table(s) filled in, the idea being this trellis only needs a subset of that table, so we don't need to calculate anything new for this one
+  BasicTrellis *cached_trellis_;  // pointer to another trellis that already has its dp table(s) filled in, the idea being this trellis only needs a subset of that table, so we don't need to calculate anything new for this one
 
-  int16_t ending_viterbi_pointer_;
+  size_t checkpoint_interval_;  // zero if we're keeping the whole traceback table
+  ArenaVector<ArenaVector<T> > checkpoint_columns_;  // dp table column at every <checkpoint_interval_>th position (we rebuild the frontiers from these, rather than storing them too)
+  bool scaled_forward_;
+
+  int32_t ending_viterbi_pointer_;
   double  ending_viterbi_log_prob_;
   double  ending_forward_log_prob_;
 
   // chunk caching stuff
-  vector<double> *viterbi_log_probs_pointer_;  // see notes for traceback_table_
-  vector<double> *forward_log_probs_pointer_;  // see notes for traceback_table_
-  vector<int> *viterbi_indices_pointer_;  // see notes for traceback_table_
-  vector<double> viterbi_log_probs_;  // log prob of best path up to and including each position NOTE includes log prob of transition to end
-  vector<double> forward_log_probs_;  // total log prob of all paths up to and including each position NOTE includes log prob of transition to end
-  vector<int> viterbi_indices_;  // pointer to the state at which the best log prob occurred
-
-  vector<double> *swap_ptr_;
-  vector<double> scoring_current_, scoring_previous_;
+  ArenaVector<T> *viterbi_log_probs_pointer_;  // see notes for traceback_table_
+  ArenaVector<T> *forward_log_probs_pointer_;  // see notes for traceback_table_
+  ArenaVector<int> *viterbi_indices_pointer_;  // see notes for traceback_table_
+  ArenaVector<T> viterbi_log_probs_;  // log prob of best path up to and including each position NOTE includes log prob of transition to end
+  ArenaVector<T> forward_log_probs_;  // total log prob of all paths up to and including each position NOTE includes log prob of transition to end
+  ArenaVector<int> viterbi_indices_;  // pointer to the state at which the best log prob occurred
+
+  ArenaVector<T> *swap_ptr_;
+  ArenaVector<T> scoring_current_, scoring_previous_;
+  ArenaVector<T> chain_vals_;  // for chain models, the dp value for each state coming from the previous state, in the current column
+  ArenaVector<T> emission_column_;  // for chain models with more than one sequence, emission log probs of the current column
+  ArenaVector<T> forward_ending_vals_;  // in fast log-sum-exp mode, log probs of each path ending at the current position, which we add up all at once in FlushForwardVals()
+  ArenaVector<T> emission_prob_column_;  // for ScaledForward() with more than one sequence, emission probs of the current column
+  ArenaVector<uint8_t> chain_improved_;  // for the simd chain kernels, which states' best values came via their chain edge in the current column
 };
 
+// ----------------------------------------------------------------------------------------
+template <class T> inline T BasicTrellis<T>::EmissionLogprob(size_t i_st, size_t position) {
+  if(seqs_.n_seqs() == 1)
+    return emission_scores_->emissions[i_st * compiled_->n_columns() + columns_[position]];
+  else  // i.e. sum_c count_c * logprob_c, so cost doesn't grow with the number of sequences
+    return compiled_->emission_log_prob(i_st, &seqs_.profile()[position * seqs_.n_profile_columns()]);
+}
+
+typedef BasicTrellis<double> Trellis;
+typedef BasicTrellis<float> FloatTrellis;
+template <> void BasicTrellis<float>::SimdChainViterbiVals(ArenaVector<float> *scoring_previous, ArenaVector<float> *scoring_current, size_t position, TracebackTable *traceback_table, size_t traceback_row);  // these throw (the simd kernels only do doubles)
+template <> void BasicTrellis<float>::SimdChainForwardVals(ArenaVector<float> *scoring_previous, ArenaVector<float> *scoring_current, size_t position);
+extern template class BasicTrellis<double>;  // NOTE both are instantiated in trellis.cc
+extern template class BasicTrellis<float>;
+
 }
 #endif
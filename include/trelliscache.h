@@ -0,0 +1,116 @@
+#ifndef HAM_TRELLISCACHE_H
+#define HAM_TRELLISCACHE_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <stdint.h>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// The trellises we've calculated from scratch for one gene, keyed by their query strings, plus a trie over the query columns so we can find
+// a chunk cache for a new query (a trellis whose query strings all start with the new ones) in time proportional to the query length, rather
+// than comparing against every cached trellis. The trie walks the query strings' characters column by column (i.e. interleaved, since the
+// strings in a query all have the same length), with a separate root for each number of sequences, and each node points at the first
+// trellis we added that goes through it.
+// NOTE not copyable, since the trie points into <trellises_> (which never moves anything, since it's a map and we never erase from it)
+template <class TrellisT> class TrellisCache {
+public:
+  TrellisCache() {}
+  TrellisCache(const TrellisCache&) = delete;
+  TrellisCache &operator=(const TrellisCache&) = delete;
+  TrellisT &Add(vector<string> &query_strs, TrellisT trell);  // put <trell> in the cache for <query_strs>, and return a reference to the cached copy
+  TrellisT *FindExtension(vector<string> &query_strs);  // a cached trellis whose query strings each start with the corresponding one in <query_strs> (or nullptr)
+  void Clear();
+  size_t size() { return trellises_.size(); }
+
+private:
+  struct Node {
+    vector<pair<char, uint32_t> > children;  // there's only a handful of characters, so a linear search is fine
+    TrellisT *trellis;
+  };
+  size_t Child(size_t inode, char ch);  // SIZE_MAX if there isn't one
+  void CheckLengths(vector<string> &query_strs);
+
+  map<vector<string>, TrellisT> trellises_;
+  map<size_t, size_t> roots_;  // root node for each number of query strings
+  vector<Node> nodes_;
+};
+
+// ----------------------------------------------------------------------------------------
+template <class TrellisT> TrellisT &TrellisCache<TrellisT>::Add(vector<string> &query_strs, TrellisT trell) {
+  CheckLengths(query_strs);
+  TrellisT &cached(trellises_[query_strs]);
+  cached = trell;
+
+  if(roots_.count(query_strs.size()) == 0) {
+    roots_[query_strs.size()] = nodes_.size();
+    nodes_.push_back(Node{{}, nullptr});
+  }
+  size_t inode(roots_[query_strs.size()]);
+  if(nodes_[inode].trellis == nullptr)
+    nodes_[inode].trellis = &cached;
+  size_t length(query_strs.size() > 0 ? query_strs[0].size() : 0);
+  for(size_t position = 0; position < length; ++position) {
+    for(auto &query_str : query_strs) {
+      size_t ichild(Child(inode, query_str[position]));
+      if(ichild == SIZE_MAX) {
+	ichild = nodes_.size();
+	nodes_[inode].children.push_back(pair<char, uint32_t>(query_str[position], ichild));
+	nodes_.push_back(Node{{}, nullptr});
+      }
+      inode = ichild;
+      if(nodes_[inode].trellis == nullptr)
+	nodes_[inode].trellis = &cached;
+    }
+  }
+  return cached;
+}
+
+// ----------------------------------------------------------------------------------------
+template <class TrellisT> TrellisT *TrellisCache<TrellisT>::FindExtension(vector<string> &query_strs) {
+  CheckLengths(query_strs);
+  auto it(roots_.find(query_strs.size()));
+  if(it == roots_.end())
+    return nullptr;
+  size_t inode(it->second);
+  size_t length(query_strs.size() > 0 ? query_strs[0].size() : 0);
+  for(size_t position = 0; position < length; ++position) {
+    for(auto &query_str : query_strs) {
+      inode = Child(inode, query_str[position]);
+      if(inode == SIZE_MAX)
+	return nullptr;
+    }
+  }
+  return nodes_[inode].trellis;
+}
+
+// ----------------------------------------------------------------------------------------
+template <class TrellisT> void TrellisCache<TrellisT>::Clear() {
+  trellises_.clear();
+  roots_.clear();
+  nodes_.clear();
+}
+
+// ----------------------------------------------------------------------------------------
+template <class TrellisT> size_t TrellisCache<TrellisT>::Child(size_t inode, char ch) {
+  for(auto &child : nodes_[inode].children) {
+    if(child.first == ch)
+      return child.second;
+  }
+  return SIZE_MAX;
+}
+
+// ----------------------------------------------------------------------------------------
+template <class TrellisT> void TrellisCache<TrellisT>::CheckLengths(vector<string> &query_strs) {
+  for(auto &query_str : query_strs) {
+    if(query_str.size() != query_strs[0].size())
+      throw runtime_error("ERROR query strings of different lengths (" + to_string(query_str.size()) + " and " + to_string(query_strs[0].size()) + ") in trellis cache");
+  }
+}
+
+}
+#endif
@@ -0,0 +1,65 @@
+#ifndef HAM_TRIETRELLIS_H
+#define HAM_TRIETRELLIS_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "sequences.h"
+#include "model.h"
+#include "alleletrie.h"
+#include "simdkernels.h"
+#include "tracebackpath.h"
+#include "tracebacktable.h"
+#include "arena.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Viterbi for all the genes in an AlleleTrie on the same sequences, where we only fill in each trie node's states once, rather than once for
+// every gene below it. At each position we go through the nodes parents-first, so each node can take the previous column's values for its
+// from-states out of its ancestors. Each gene's log probs and traceback table are then stitched together from the nodes on its path.
+// We visit edges and add things up in the same order as Trellis's chain kernels, so each gene's log probs and path are exactly the same as
+// running it on its own (and Trellis::AdoptViterbi() can turn a gene into a chunk cache). Only works for chain models (CompiledModel::is_chain()).
+class TrieTrellis {
+public:
+  TrieTrellis(AlleleTrie *trie, SequencesView seqs, vector<size_t> igenes);  // only calculate what we need for the genes <igenes>
+  void Viterbi();
+  void Traceback(size_t igene, TracebackPath &path);
+
+  size_t n_positions() { return n_positions_; }
+  // same as the corresponding BatchTrellis accessors, but for gene <igene> in the trie
+  double ending_viterbi_log_prob(size_t igene) { return n_positions_ == 0 ? -INFINITY : viterbi_log_probs_[igene][n_positions_ - 1]; }
+  int32_t ending_viterbi_pointer(size_t igene) { return n_positions_ == 0 ? -1 : viterbi_indices_[igene][n_positions_ - 1]; }
+  double viterbi_log_prob(size_t igene, size_t position) { return viterbi_log_probs_[igene][position]; }
+  int viterbi_index(size_t igene, size_t position) { return viterbi_indices_[igene][position]; }
+  TracebackTable &traceback_table(size_t igene) { return traceback_tables_[igene]; }
+
+private:
+  const double *EmissionColumn(size_t inode, size_t position);  // emission log probs of <inode>'s states at <position>
+  double PreviousVal(size_t inode, size_t ist);  // previous column's value for <ist>, which is in either <inode> or one of its ancestors
+  void InitVals(size_t inode);
+  void MiddleVals(size_t inode, size_t position);
+  void CacheViterbiVals(size_t inode, size_t position);
+  void FillGene(size_t igene);
+
+  AlleleTrie *trie_;
+  SequencesView seqs_;
+  vector<size_t> igenes_;
+  size_t n_positions_;
+  const SimdKernels *simd_kernels_;
+  vector<uint8_t> live_nodes_;  // nodes on the path of at least one of <igenes_>
+  ArenaVector<uint8_t> columns_;  // if we only have one sequence, its emission table column at each position
+  vector<ArenaVector<double> > scoring_previous_, scoring_current_;  // [node][state in node]
+  vector<ArenaVector<uint16_t> > cells_;  // [node][position x state in node] traceback cells (one plus the from-list offset, zero for none)
+  vector<ArenaVector<double> > best_log_probs_;  // [node][position] best log prob (including the end transition) of the node's states
+  vector<ArenaVector<int> > best_indices_;  // [node][position] and the first state that has it
+  ArenaVector<double> emission_column_, chain_vals_;
+  ArenaVector<uint8_t> chain_improved_;
+  vector<ArenaVector<double> > viterbi_log_probs_;  // [gene][position] (only for <igenes_>)
+  vector<ArenaVector<int> > viterbi_indices_;
+  vector<TracebackTable> traceback_tables_;
+};
+
+}
+#endif
@@ -0,0 +1,55 @@
+#ifndef HAM_VITERBIFILTER_H
+#define HAM_VITERBIFILTER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "sequences.h"
+#include "model.h"
+#include "compiledmodel.h"
+#include "arena.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Rough, cheap viterbi in saturating int16 arithmetic on the quantized log probs in CompiledModel::transition_scores<int16_t>() and emission_scores<int16_t>() (a la HMMER's ViterbiFilter).
+// We fill in every state in every column with plain branch-free loops (no frontiers, no traceback), which the compiler vectorizes to eight or
+// sixteen states per instruction. Each table lookup is off by up to 0.5 / kQuantizedScale, and anything below about -1000 saturates to
+// -INFINITY, so it's only good for deciding which genes are worth running the real Viterbi on (see DPHandler::FilterGenes()).
+class ViterbiFilter {
+public:
+  ViterbiFilter(Model *hmm, SequencesView seqs);
+  void Run();
+  double ending_log_prob(size_t length);  // approximate log prob of the best path for the first <length> positions (-INFINITY if there isn't one, or if it saturated)
+  bool saturated(size_t length) { return first_saturated_position_ < length; }  // did any finite score saturate in the first <length> positions? (if not, -INFINITY really means there's no path)
+
+private:
+  // each of these sets <saturated> if any finite score in it saturates
+  const int16_t *EmissionColumn(size_t position, int &saturated);
+  void MiddleVals(size_t position, int &saturated);
+  int16_t EndingScore(int &saturated);
+
+  Model *hmm_;
+  CompiledModel *compiled_;
+  const TransitionScores<int16_t> *transition_scores_;
+  const EmissionScores<int16_t> *emission_scores_;
+  SequencesView seqs_;
+  ArenaVector<uint8_t> columns_;  // if we only have one sequence, its emission table column at each position
+  ArenaVector<int16_t> scoring_previous_, scoring_current_;
+  ArenaVector<int16_t> emission_column_;  // for more than one sequence, quantized emission log probs of the current column
+  ArenaVector<int16_t> ending_scores_;  // best score (including the transition to end) at each position
+  size_t first_saturated_position_;  // first position at which two finite scores added up to less than we can hold (SIZE_MAX if none did)
+};
+
+// ----------------------------------------------------------------------------------------
+// NOTE only for non-positive scores, so we only need to saturate at the bottom. Sets <saturated> if we saturated without either of them
+// being -INFINITY (branch-free, so the loops still vectorize).
+inline int16_t SaturatingAdd(int16_t lhs, int16_t rhs, int &saturated) {
+  int sum(lhs + rhs);
+  saturated |= (sum < kQuantizedMinusInfinity) & (lhs != kQuantizedMinusInfinity) & (rhs != kQuantizedMinusInfinity);
+  return sum < kQuantizedMinusInfinity ? kQuantizedMinusInfinity : sum;
+}
+
+}
+#endif
@@ -0,0 +1,142 @@
+#include "alleletrie.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+AlleleTrie::AlleleTrie(vector<string> &genes, vector<Model*> &hmms) :
+  genes_(genes),
+  hmms_(hmms)
+{
+  if(genes_.size() != hmms_.size())
+    throw runtime_error("ERROR different numbers of genes (" + to_string(genes_.size()) + ") and hmms (" + to_string(hmms_.size()) + ") for allele trie");
+
+  init_log_probs_.resize(hmms_.size());
+  max_from_.resize(hmms_.size());
+  paths_.resize(hmms_.size());
+  for(size_t igene = 0; igene < hmms_.size(); ++igene) {
+    indices_[genes_[igene]] = igene;
+    CompiledModel *compiled(hmms_[igene]->compiled());
+    if(compiled->n_columns() != hmms_[0]->compiled()->n_columns())
+      throw runtime_error("ERROR hmms " + hmms_[igene]->name() + " and " + hmms_[0]->name() + " in allele trie have different tracks");
+    init_log_probs_[igene].assign(compiled->n_states(), -INFINITY);
+    for(size_t iinit = 0; iinit < compiled->init_indices().size(); ++iinit)
+      init_log_probs_[igene][compiled->init_indices()[iinit]] = compiled->init_log_probs()[iinit];
+    max_from_[igene].resize(compiled->n_states());
+    size_t max_from(0);
+    for(size_t ist = 0; ist < compiled->n_states(); ++ist) {
+      for(size_t ifrom = compiled->from_begin(ist); ifrom < compiled->from_end(ist); ++ifrom)
+	max_from = max(max_from, (size_t)compiled->from_indices()[ifrom]);
+      max_from_[igene][ist] = max_from;
+    }
+  }
+
+  vector<size_t> igenes(hmms_.size());
+  for(size_t igene = 0; igene < hmms_.size(); ++igene)
+    igenes[igene] = igene;
+  if(igenes.size() > 0)
+    AddNodes(igenes, 0, kNoParent);
+}
+
+// ----------------------------------------------------------------------------------------
+// Add the nodes for <igenes>, which share all the states before <state_begin> (in the nodes from <parent> up to the root): first a node for
+// however many more states they all share, then recurse on the groups of them that share the next state.
+void AlleleTrie::AddNodes(vector<size_t> igenes, size_t state_begin, size_t parent) {
+  size_t iref(igenes[0]);
+  size_t min_n_states(SIZE_MAX), max_n_states(0);
+  for(auto &igene : igenes) {
+    min_n_states = min(min_n_states, hmms_[igene]->n_states());
+    max_n_states = max(max_n_states, hmms_[igene]->n_states());
+  }
+
+  size_t first_diff(state_begin);  // first state that they don't all have the same
+  while(first_diff < min_n_states) {
+    bool all_same(true);
+    for(size_t ii = 1; ii < igenes.size(); ++ii)
+      all_same &= SameState(iref, igenes[ii], first_diff);
+    if(!all_same)
+      break;
+    ++first_diff;
+  }
+
+  if(igenes.size() == 1 || (first_diff == min_n_states && min_n_states == max_n_states)) {  // leaf, with all the rest of the states
+    nodes_.push_back(Node{parent, state_begin, hmms_[iref]->n_states(), hmms_[iref]});
+    for(auto &igene : igenes)
+      paths_[igene].push_back(nodes_.size() - 1);
+    return;
+  }
+
+  size_t shared_end(ClosedEnd(iref, state_begin, first_diff));
+  if(shared_end > state_begin) {
+    nodes_.push_back(Node{parent, state_begin, shared_end, hmms_[iref]});
+    parent = nodes_.size() - 1;
+    for(auto &igene : igenes)
+      paths_[igene].push_back(parent);
+  }
+
+  // split them up by what they have at <first_diff> (those that end there go together)
+  vector<vector<size_t> > groups;
+  for(auto &igene : igenes) {
+    bool found(false);
+    for(auto &group : groups) {
+      size_t jgene(group[0]);
+      bool ends(hmms_[igene]->n_states() == first_diff), jends(hmms_[jgene]->n_states() == first_diff);
+      if((ends && jends) || (!ends && !jends && SameState(igene, jgene, first_diff))) {
+	group.push_back(igene);
+	found = true;
+	break;
+      }
+    }
+    if(!found)
+      groups.push_back(vector<size_t>{igene});
+  }
+  for(auto &group : groups)
+    AddNodes(group, shared_end, parent);
+}
+
+// ----------------------------------------------------------------------------------------
+// true if state <ist> has the same from-list, probabilities, and emissions in both genes' hmms
+bool AlleleTrie::SameState(size_t igene, size_t jgene, size_t ist) {
+  CompiledModel *ic(hmms_[igene]->compiled()), *jc(hmms_[jgene]->compiled());
+  assert(ist < ic->n_states() && ist < jc->n_states());
+  if(ic->from_end(ist) - ic->from_begin(ist) != jc->from_end(ist) - jc->from_begin(ist))
+    return false;
+  for(size_t ioff = 0; ioff < ic->from_end(ist) - ic->from_begin(ist); ++ioff) {
+    if(ic->from_indices()[ic->from_begin(ist) + ioff] != jc->from_indices()[jc->from_begin(ist) + ioff] || ic->from_log_probs()[ic->from_begin(ist) + ioff] != jc->from_log_probs()[jc->from_begin(ist) + ioff])
+      return false;
+  }
+  if(ic->chain_log_probs()[ist] != jc->chain_log_probs()[ist] || ic->end_log_prob(ist) != jc->end_log_prob(ist) || init_log_probs_[igene][ist] != init_log_probs_[jgene][ist])
+    return false;
+  for(size_t icol = 0; icol < ic->n_columns(); ++icol) {
+    if(ic->emission_log_prob(ist, icol) != jc->emission_log_prob(ist, icol))
+      return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------------------
+// largest end in (<state_begin>, <state_end>] such that none of the states before it have from-states at or after it (or <state_begin> if there isn't one)
+size_t AlleleTrie::ClosedEnd(size_t igene, size_t state_begin, size_t state_end) {
+  for(size_t end = state_end; end > state_begin; --end) {
+    if(max_from_[igene][end - 1] < end)
+      return end;
+  }
+  return state_begin;
+}
+
+// ----------------------------------------------------------------------------------------
+size_t AlleleTrie::n_node_states() {
+  size_t n_states(0);
+  for(auto &node : nodes_)
+    n_states += node.state_end - node.state_begin;
+  return n_states;
+}
+
+// ----------------------------------------------------------------------------------------
+size_t AlleleTrie::n_states() {
+  size_t n_states(0);
+  for(auto &hmm : hmms_)
+    n_states += hmm->n_states();
+  return n_states;
+}
+
+}
@@ -0,0 +1,116 @@
+#include "arena.h"
+#include <sys/mman.h>
+
+namespace ham {
+
+static const size_t kAlignment(64);  // cache line
+static const size_t kHugePageSize(2 << 20);
+
+// ----------------------------------------------------------------------------------------
+static size_t RoundUp(size_t bytes, size_t alignment) {
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+// ----------------------------------------------------------------------------------------
+static thread_local Arena *current_arena(nullptr);
+
+// ----------------------------------------------------------------------------------------
+Arena::Arena(size_t block_size, bool hugepages) :
+  block_size_(block_size),
+  hugepages_(hugepages),
+  iblock_(0),
+  top_(nullptr),
+  n_live_(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------
+Arena::~Arena() {
+  for(auto &block : blocks_)
+    free(block.begin);
+}
+
+// ----------------------------------------------------------------------------------------
+Arena *Arena::thread_arena() {
+  static thread_local Arena arena;
+  return &arena;
+}
+
+// ----------------------------------------------------------------------------------------
+Arena *Arena::current() {
+  return current_arena;
+}
+
+// ----------------------------------------------------------------------------------------
+void Arena::set_current(Arena *arena) {
+  current_arena = arena;
+}
+
+// ----------------------------------------------------------------------------------------
+size_t Arena::bytes_reserved() {
+  lock_guard<mutex> lock(mutex_);
+  size_t bytes(0);
+  for(auto &block : blocks_)
+    bytes += block.size;
+  return bytes;
+}
+
+// ----------------------------------------------------------------------------------------
+Arena::Block Arena::NewBlock(size_t min_size) {
+  size_t alignment(hugepages_ ? kHugePageSize : kAlignment);
+  Block block;
+  block.size = RoundUp(max(min_size, block_size_), alignment);
+  void *ptr(nullptr);
+  if(posix_memalign(&ptr, alignment, block.size) != 0)
+    throw bad_alloc();
+#ifdef MADV_HUGEPAGE
+  if(hugepages_)
+    madvise(ptr, block.size, MADV_HUGEPAGE);  // just a hint, so we don't care if it fails
+#endif
+  block.begin = static_cast<char*>(ptr);
+  return block;
+}
+
+// ----------------------------------------------------------------------------------------
+void *Arena::Allocate(size_t bytes) {
+  lock_guard<mutex> lock(mutex_);
+  bytes = RoundUp(max(bytes, (size_t)1), kAlignment);
+  if(blocks_.size() == 0) {
+    blocks_.push_back(NewBlock(bytes));
+    iblock_ = 0;
+    top_ = blocks_[0].begin;
+  }
+  // move on to the next block that's big enough (or make a new one) if we don't fit in the current one
+  while(top_ + bytes > blocks_[iblock_].begin + blocks_[iblock_].size) {
+    ++iblock_;
+    if(iblock_ == blocks_.size())
+      blocks_.push_back(NewBlock(bytes));
+    top_ = blocks_[iblock_].begin;
+  }
+  void *ptr(top_);
+  top_ += bytes;
+  ++n_live_;
+  return ptr;
+}
+
+// ----------------------------------------------------------------------------------------
+void Arena::Deallocate(void *ptr, size_t bytes) {
+  lock_guard<mutex> lock(mutex_);
+  assert(n_live_ > 0);
+  --n_live_;
+  if(n_live_ == 0) {
+    Rewind();
+    return;
+  }
+  bytes = RoundUp(max(bytes, (size_t)1), kAlignment);
+  if(static_cast<char*>(ptr) + bytes == top_)  // if it was the most recent allocation (which is common, e.g. for temporary trellises), we can reuse its space right away
+    top_ = static_cast<char*>(ptr);
+}
+
+// ----------------------------------------------------------------------------------------
+void Arena::Rewind() {
+  iblock_ = 0;
+  top_ = blocks_.size() > 0 ? blocks_[0].begin : nullptr;
+}
+
+}
@@ -8,8 +8,8 @@ Args::Args(int argc, const char * argv[]):
   debug_ints_ {0, 1, 2},
   algo_vals_(algo_strings_),
   debug_vals_(debug_ints_),
-  hmmdir_arg_("", "hmmdir", "directory in which to look for hmm model files", true, "", "string"),
-  datadir_arg_("", "datadir", "directory in which to look for non-sample-specific data (eg human germline seqs)", true, "", "string"),
+  hmmdir_arg_("", "hmmdir", "directory in which to look for hmm model files (required unless --hmm-bundle is set)", false, "", "string"),
+  datadir_arg_("", "datadir", "directory in which to look for non-sample-specific data (eg human germline seqs) (required unless --hmm-bundle is set)", false, "", "string"),
   infile_arg_("", "infile", "input (whitespace-separated) file", true, "", "string"),
   outfile_arg_("", "outfile", "output csv file", true, "", "string"),
   annotationfile_arg_("", "annotationfile", "if specified, write annotations for each cluster to here", false, "", "string"),
@@ -19,6 +19,8 @@ Args::Args(int argc, const char * argv[]):
   algorithm_arg_("", "algorithm", "algorithm to run", true, "", &algo_vals_),
   ambig_base_arg_("", "ambig-base", "ambiguous base", false, "", "string"),
   seed_unique_id_arg_("", "seed-unique-id", "seed unique id", false, "", "string"),
+  simd_arg_("", "simd", "instruction set for the vectorized dp kernels: auto (best the cpu supports), scalar, sse4, avx2, or avx512", false, "auto", "string"),
+  hmm_bundle_arg_("", "hmm-bundle", "read the hmms and germline info from this bundle (written by ham-compile) instead of from --hmmdir and --datadir", false, "", "string"),
   hamming_fraction_bound_lo_arg_("", "hamming-fraction-bound-lo", "if hamming fraction for a pair is smaller than this, merge them without calculating lratio", false, 0.0, "float"),
   hamming_fraction_bound_hi_arg_("", "hamming-fraction-bound-hi", "if hamming fraction for a pair is larger than this, skip without calculating lratio", false, 1.0, "float"),
   logprob_ratio_threshold_arg_("", "logprob-ratio-threshold", "", false, -INFINITY, "float"),
@@ -28,6 +30,11 @@ Args::Args(int argc, const char * argv[]):
   biggest_naive_seq_cluster_to_calculate_arg_("", "biggest-naive-seq-cluster-to-calculate", "", false, 99999, "int"),
   biggest_logprob_cluster_to_calculate_arg_("", "biggest-logprob-cluster-to-calculate", "", false, 99999, "int"),
   n_partitions_to_write_arg_("", "n-partitions-to-write", "how many partitions, before the best one, should we write to the output file", false, 99999, "int"),
+  checkpoint_interval_arg_("", "checkpoint-interval", "if nonzero, viterbi keeps only every nth dp table column (instead of the whole traceback table) and recomputes tracebacks from these checkpoints. If negative, use roughly sqrt(sequence length)", false, 0, "int"),
+  viterbi_filter_n_best_arg_("", "viterbi-filter-n-best", "if nonzero, first score each gene with a quick quantized viterbi, and only run the real viterbi on this many of the best genes in each region (ignored for forward)", false, 0, "int"),
+  n_gene_threads_arg_("", "n-gene-threads", "if greater than one, run the genes in each region for each kset on this many threads (results are the same; ignored with --validate-float-dp)", false, 1, "int"),
+  n_threads_arg_("", "n-threads", "if greater than one, run this many queries at once (output is still written in input order; ignored for --partition and --cache-naive-seqs)", false, 1, "int"),
+  batch_queries_arg_("", "batch-queries", "if greater than one, run viterbi for up to this many single-sequence queries with the same length, k bounds, genes, and (rounded) mute freq together, filling their trellises in lockstep in batch trellises (gives the same results; ignored for --partition and --cache-naive-seqs)", false, 1, "int"),
   n_final_clusters_arg_("", "n-final-clusters", "instead of stopping at the most likely partition, stop when you have this many clusters", false, 0, "unsigned"),
   random_seed_arg_("", "random-seed", "", false, time(NULL), "unsigned"),
   no_chunk_cache_arg_("", "no-chunk-cache", "don't perform chunk caching?", false),
@@ -37,6 +44,15 @@ Args::Args(int argc, const char * argv[]):
   cache_naive_hfracs_arg_("", "cache-naive-hfracs", "cache naive hamming fraction between sequence sets (in addition to log probs and naive seqs)", false),
   only_cache_new_vals_arg_("", "only-cache-new-vals", "only write sequence sets with newly-calculated values to cache file", false),
   write_logprob_for_each_partition_arg_("", "write-logprob-for-each-partition", "By default, we don't know the total logprob of each partition (since many merges are by naive hfrac). This argument tells us that this is the last time through (with one process) and we want to know the total probability of each partition.", false),
+  hugepage_arena_arg_("", "hugepage-arena", "ask for transparent huge pages to back the per-thread arena from which we allocate the dp tables", false),
+  fast_log_sum_exp_arg_("", "fast-log-sum-exp", "in the forward algorithm, add log probs with a lookup table rather than log() and exp(), and add up each column's ending probs all at once (forward log probs change by up to about 1e-10)", false),
+  scaled_forward_arg_("", "scaled-forward", "run the forward algorithm with plain probabilities, rescaled at each position, rather than log probs", false),
+  float_dp_arg_("", "float-dp", "run the dp algorithms in single precision (the viterbi and forward log probs change by up to about 1e-4)", false),
+  lockstep_genes_arg_("", "lockstep-genes", "run viterbi for genes with the same hmm topology (e.g. alleles of the same length) together in one batch trellis (gives the same results)", false),
+  allele_trie_arg_("", "allele-trie", "run viterbi for the genes in each region on a trie of their hmms, so the states that several alleles share are only filled in once (gives the same results)", false),
+  j_suffix_trellis_arg_("", "j-suffix-trellis", "fill in one dp table backwards from the end of the query for each j gene, which gives the scores and paths for every j start position at once (log probs change by rounding, and tied paths may be broken differently)", false),
+  factorized_forward_arg_("", "factorized-forward", "for --algorithm forward, factor the sum over ksets: since each kset's forward prob is the product of its v, d, and j forward probs, get every kset's out of one dp table per gene and region start position (plus the j suffix tables), rather than running each kset separately (implies --j-suffix-trellis). There's no viterbi equivalent, and it only runs in double precision", false),
+  validate_float_dp_arg_("", "validate-float-dp", "also run each dp table in the other precision (see --float-dp), and report the largest difference in log prob for each query", false),
   str_headers_ {},
   int_headers_ {"k_v_min", "k_v_max", "k_d_min", "k_d_max", "cdr3_length"},
   float_headers_ {"mut_freq"},
@@ -61,11 +77,18 @@ Args::Args(int argc, const char * argv[]):
     cmd.add(algorithm_arg_);
     cmd.add(ambig_base_arg_);
     cmd.add(seed_unique_id_arg_);
+    cmd.add(simd_arg_);
+    cmd.add(hmm_bundle_arg_);
     cmd.add(debug_arg_);
     cmd.add(naive_hamming_cluster_arg_);
     cmd.add(biggest_naive_seq_cluster_to_calculate_arg_);
     cmd.add(biggest_logprob_cluster_to_calculate_arg_);
     cmd.add(n_partitions_to_write_arg_);
+    cmd.add(checkpoint_interval_arg_);
+    cmd.add(viterbi_filter_n_best_arg_);
+    cmd.add(n_gene_threads_arg_);
+    cmd.add(n_threads_arg_);
+    cmd.add(batch_queries_arg_);
     cmd.add(n_final_clusters_arg_);
     cmd.add(random_seed_arg_);
     cmd.add(no_chunk_cache_arg_);
@@ -73,6 +96,15 @@ Args::Args(int argc, const char * argv[]):
     cmd.add(cache_naive_hfracs_arg_);
     cmd.add(only_cache_new_vals_arg_);
     cmd.add(write_logprob_for_each_partition_arg_);
+    cmd.add(hugepage_arena_arg_);
+    cmd.add(fast_log_sum_exp_arg_);
+    cmd.add(scaled_forward_arg_);
+    cmd.add(float_dp_arg_);
+    cmd.add(validate_float_dp_arg_);
+    cmd.add(lockstep_genes_arg_);
+    cmd.add(allele_trie_arg_);
+    cmd.add(j_suffix_trellis_arg_);
+    cmd.add(factorized_forward_arg_);
     cmd.add(partition_arg_);
     cmd.add(dont_rescale_emissions_arg_);
 
@@ -90,6 +122,14 @@ Args::Args(int argc, const char * argv[]):
   for(auto & head : float_headers_)
     floats_[head] = vector<double>();
 
+  if(hmm_bundle() == "" && (hmmdir() == "" || datadir() == ""))
+    throw runtime_error("ERROR need either --hmm-bundle, or both --hmmdir and --datadir");
+
+  if(factorized_forward() && algorithm() != "forward")
+    throw runtime_error("ERROR --factorized-forward only works with --algorithm forward");
+  if(factorized_forward() && (float_dp() || validate_float_dp()))
+    throw runtime_error("ERROR --factorized-forward can't be used with --float-dp or --validate-float-dp");
+
   vector<string> loci{"igh", "igk", "igl", "tra", "trb", "trg", "trd"};  // this is ugly... but oh, well
   if(find(loci.begin(), loci.end(), locus()) == loci.end())
     throw runtime_error("--locus argument '" + locus() + "' not among ig{h,k,l} or tr{a,b,g,d}");
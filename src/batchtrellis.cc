@@ -0,0 +1,261 @@
+#include "batchtrellis.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+BatchTrellis::BatchTrellis(Model *hmm, vector<Sequence> &seqs) {
+  vector<Model*> hmms(seqs.size(), hmm);
+  owned_seqs_.resize(seqs.size());
+  vector<SequencesView> lane_seqs;
+  for(size_t ilane = 0; ilane < seqs.size(); ++ilane) {
+    owned_seqs_[ilane].AddSeq(seqs[ilane]);
+    lane_seqs.push_back(SequencesView(owned_seqs_[ilane]));
+  }
+  Init(hmms, lane_seqs);
+}
+
+// ----------------------------------------------------------------------------------------
+BatchTrellis::BatchTrellis(Model *hmm, vector<SequencesView> &seqs) {
+  vector<Model*> hmms(seqs.size(), hmm);
+  Init(hmms, seqs);
+}
+
+// ----------------------------------------------------------------------------------------
+BatchTrellis::BatchTrellis(vector<Model*> &hmms, SequencesView seqs) {
+  vector<SequencesView> lane_seqs(hmms.size(), seqs);
+  Init(hmms, lane_seqs);
+}
+
+// ----------------------------------------------------------------------------------------
+void BatchTrellis::Init(vector<Model*> &hmms, vector<SequencesView> &seqs) {
+  assert(hmms.size() == seqs.size());
+  if(hmms.size() == 0)
+    throw runtime_error("ERROR no lanes for batch trellis");
+  hmms_ = hmms;
+  seqs_ = seqs;
+  compiled_ = hmms_[0]->compiled();
+  n_lanes_ = hmms_.size();
+  n_positions_ = seqs_[0].GetSequenceLength();
+  n_states_ = compiled_->n_states();
+
+  columns_.resize(n_positions_ * n_lanes_);
+  for(size_t ilane = 0; ilane < n_lanes_; ++ilane) {
+    if(!hmms_[ilane]->compiled()->SameTopology(*compiled_))
+      throw runtime_error("ERROR models " + hmms_[ilane]->name() + " and " + hmms_[0]->name() + " in batch trellis have different topologies");
+    if(seqs_[ilane].GetSequenceLength() != n_positions_)
+      throw runtime_error("ERROR sequences in batch trellis have different lengths (" + to_string(seqs_[ilane].GetSequenceLength()) + " and " + to_string(n_positions_) + ")");
+    if(seqs_[ilane].n_seqs() == 1) {
+      for(size_t position = 0; position < n_positions_; ++position)
+        columns_[position * n_lanes_ + ilane] = hmms_[ilane]->track()->column(seqs_[ilane].value(0, position));
+    } else {
+      seqs_[ilane].profile();
+    }
+  }
+
+  // transpose each lane's transition log probs into [entry x lane]
+  size_t n_from(compiled_->from_end(n_states_ - 1));
+  size_t n_init(compiled_->init_indices().size());
+  from_log_probs_.resize(n_from * n_lanes_);
+  init_log_probs_.resize(n_init * n_lanes_);
+  end_log_probs_.resize(n_states_ * n_lanes_);
+  if(compiled_->is_chain()) {
+    chain_log_probs_.resize(n_states_ * n_lanes_);
+    chain_pointers_.resize(n_states_ * n_lanes_);
+  }
+  for(size_t ilane = 0; ilane < n_lanes_; ++ilane) {
+    CompiledModel *compiled(hmms_[ilane]->compiled());
+    for(size_t ifrom = 0; ifrom < n_from; ++ifrom)
+      from_log_probs_[ifrom * n_lanes_ + ilane] = compiled->from_log_probs()[ifrom];
+    for(size_t iinit = 0; iinit < n_init; ++iinit)
+      init_log_probs_[iinit * n_lanes_ + ilane] = compiled->init_log_probs()[iinit];
+    for(size_t i_st = 0; i_st < n_states_; ++i_st) {
+      end_log_probs_[i_st * n_lanes_ + ilane] = compiled->end_log_prob(i_st);
+      if(compiled_->is_chain()) {
+	chain_log_probs_[i_st * n_lanes_ + ilane] = compiled->chain_log_probs()[i_st];
+	bool has_chain_edge(compiled->residual_end(i_st) < compiled->from_end(i_st));
+	chain_pointers_[i_st * n_lanes_ + ilane] = has_chain_edge ? compiled->residual_end(i_st) - compiled->from_begin(i_st) + 1 : 0;
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void BatchTrellis::Viterbi() {
+  scoring_previous_.assign(n_states_ * n_lanes_, -INFINITY);
+  scoring_current_.assign(n_states_ * n_lanes_, -INFINITY);
+  emissions_.resize(n_states_ * n_lanes_);
+  edge_vals_.resize(n_lanes_);
+  chain_vals_.resize(compiled_->is_chain() ? n_states_ * n_lanes_ : 0);
+  pointers_.resize(n_states_ * n_lanes_);
+  traceback_tables_.resize(n_lanes_);
+  for(auto &table : traceback_tables_)
+    table.Init(n_positions_, compiled_);
+  viterbi_log_probs_.assign(n_positions_ * n_lanes_, -INFINITY);
+  viterbi_indices_.assign(n_positions_ * n_lanes_, -1);
+  ending_viterbi_log_probs_.assign(n_lanes_, -INFINITY);
+  ending_viterbi_pointers_.assign(n_lanes_, -1);
+  if(n_positions_ == 0)
+    return;
+
+  // first position
+  FillEmissions(0);
+  const vector<uint16_t> &init_indices(compiled_->init_indices());
+  for(size_t iinit = 0; iinit < init_indices.size(); ++iinit) {
+    const double *emissions(&emissions_[init_indices[iinit] * n_lanes_]);
+    const double *init_log_probs(&init_log_probs_[iinit * n_lanes_]);
+    double *current(&scoring_current_[init_indices[iinit] * n_lanes_]);
+    for(size_t ilane = 0; ilane < n_lanes_; ++ilane)
+      current[ilane] = emissions[ilane] + init_log_probs[ilane];
+  }
+  CacheViterbiVals(0);
+
+  for(size_t position = 1; position < n_positions_; ++position) {
+    scoring_previous_.swap(scoring_current_);
+    MiddleViterbiVals(position);
+    CacheViterbiVals(position);
+  }
+
+  // the best value at the last position is the ending value (for the first state that has it, as in Trellis::Viterbi())
+  for(size_t ilane = 0; ilane < n_lanes_; ++ilane) {
+    ending_viterbi_log_probs_[ilane] = viterbi_log_probs_[(n_positions_ - 1) * n_lanes_ + ilane];
+    ending_viterbi_pointers_[ilane] = viterbi_indices_[(n_positions_ - 1) * n_lanes_ + ilane];
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// best log prob (including the end transition) of the paths ending at <position>, and the first state that has it (as in Trellis::CacheViterbiVals())
+void BatchTrellis::CacheViterbiVals(size_t position) {
+  double *best(&viterbi_log_probs_[position * n_lanes_]);
+  int *best_indices(&viterbi_indices_[position * n_lanes_]);
+  for(size_t i_st = 0; i_st < n_states_; ++i_st) {
+    const double *current(&scoring_current_[i_st * n_lanes_]);
+    const double *end_log_probs(&end_log_probs_[i_st * n_lanes_]);
+    for(size_t ilane = 0; ilane < n_lanes_; ++ilane) {
+      double logprob(current[ilane] + end_log_probs[ilane]);
+      bool better(logprob > best[ilane]);
+      best[ilane] = better ? logprob : best[ilane];
+      best_indices[ilane] = better ? (int)i_st : best_indices[ilane];
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void BatchTrellis::FillEmissions(size_t position) {
+  for(size_t ilane = 0; ilane < n_lanes_; ++ilane) {
+    CompiledModel *compiled(hmms_[ilane]->compiled());
+    if(seqs_[ilane].n_seqs() == 1) {
+      const double *emission_column(compiled->emission_column(columns_[position * n_lanes_ + ilane]));
+      for(size_t i_st = 0; i_st < n_states_; ++i_st)
+        emissions_[i_st * n_lanes_ + ilane] = emission_column[i_st];
+    } else {  // see Trellis::EmissionLogprob()
+      const uint32_t *counts(&seqs_[ilane].profile()[position * seqs_[ilane].n_profile_columns()]);
+      for(size_t i_st = 0; i_st < n_states_; ++i_st)
+        emissions_[i_st * n_lanes_ + ilane] = compiled->emission_log_prob(i_st, counts);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Go through each state's whole from-list in order. A -INFINITY previous value or emission makes the edge's value -INFINITY, which never
+// beats anything, so we don't need to skip them explicitly.
+// NOTE we add the emission and transition first, then the previous value, which is the order the Trellis kernels end up using (see Trellis::FillChainVals())
+void BatchTrellis::MiddleViterbiVals(size_t position) {
+  FillEmissions(position);
+  fill(scoring_current_.begin(), scoring_current_.end(), -INFINITY);
+  fill(pointers_.begin(), pointers_.end(), 0);
+  if(compiled_->is_chain()) {
+    ChainViterbiVals();
+  } else {
+    const uint16_t *from_indices(compiled_->from_indices());
+    double *edge_vals(edge_vals_.data());
+    for(size_t i_st_current = 0; i_st_current < n_states_; ++i_st_current) {
+      const double *emissions(&emissions_[i_st_current * n_lanes_]);
+      for(size_t ifrom = compiled_->from_begin(i_st_current); ifrom < compiled_->from_end(i_st_current); ++ifrom) {
+	const double *previous(&scoring_previous_[from_indices[ifrom] * n_lanes_]);
+	const double *from_log_probs(&from_log_probs_[ifrom * n_lanes_]);
+	for(size_t ilane = 0; ilane < n_lanes_; ++ilane)  // NOTE two separate loops, so the compiler can't reassociate the additions
+	  edge_vals[ilane] = emissions[ilane] + from_log_probs[ilane];
+	for(size_t ilane = 0; ilane < n_lanes_; ++ilane)
+	  edge_vals[ilane] += previous[ilane];
+	ImproveLanes(edge_vals, &scoring_current_[i_st_current * n_lanes_], &pointers_[i_st_current * n_lanes_], ifrom - compiled_->from_begin(i_st_current));
+      }
+    }
+  }
+
+  for(size_t ilane = 0; ilane < n_lanes_; ++ilane)
+    traceback_tables_[ilane].set_row(position, &pointers_[ilane], n_lanes_);
+}
+
+// ----------------------------------------------------------------------------------------
+// Same as MiddleViterbiVals(), except we go through the residual edges of the few states that have them, and then do all the chain edges
+// for every state and lane at once (since the chain edge is the last entry in each from-list, this visits the edges in the same order).
+// In the [state x lane] layout, the chain edge into cell <icell> comes from cell <icell> - <n_lanes_>, so these are plain streaming loops.
+void BatchTrellis::ChainViterbiVals() {
+  const uint16_t *from_indices(compiled_->from_indices());
+  double *edge_vals(edge_vals_.data());
+  for(auto &i_st_current : compiled_->residual_states()) {
+    const double *emissions(&emissions_[i_st_current * n_lanes_]);
+    for(size_t ifrom = compiled_->from_begin(i_st_current); ifrom < compiled_->residual_end(i_st_current); ++ifrom) {
+      const double *previous(&scoring_previous_[from_indices[ifrom] * n_lanes_]);
+      const double *from_log_probs(&from_log_probs_[ifrom * n_lanes_]);
+      for(size_t ilane = 0; ilane < n_lanes_; ++ilane)
+	edge_vals[ilane] = emissions[ilane] + from_log_probs[ilane];
+      for(size_t ilane = 0; ilane < n_lanes_; ++ilane)
+	edge_vals[ilane] += previous[ilane];
+      ImproveLanes(edge_vals, &scoring_current_[i_st_current * n_lanes_], &pointers_[i_st_current * n_lanes_], ifrom - compiled_->from_begin(i_st_current));
+    }
+  }
+
+  size_t n_cells(n_states_ * n_lanes_);
+  const double *emissions(emissions_.data());
+  const double *chain_log_probs(chain_log_probs_.data());
+  const double *previous(scoring_previous_.data());
+  const uint16_t *chain_pointers(chain_pointers_.data());
+  double *chain_vals(chain_vals_.data());
+  double *current(scoring_current_.data());
+  uint16_t *pointers(pointers_.data());
+  for(size_t icell = n_lanes_; icell < n_cells; ++icell)  // the first state has no chain edge
+    chain_vals[icell] = emissions[icell] + chain_log_probs[icell];
+  for(size_t icell = n_lanes_; icell < n_cells; ++icell)
+    chain_vals[icell] += previous[icell - n_lanes_];
+  for(size_t icell = n_lanes_; icell < n_cells; ++icell) {
+    bool better(chain_vals[icell] > current[icell]);
+    current[icell] = better ? chain_vals[icell] : current[icell];
+    pointers[icell] = better ? chain_pointers[icell] : pointers[icell];
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// for each lane where <vals> beats <current>, take it and point the traceback at the <ifrom_offset>th entry in the state's from-list
+void BatchTrellis::ImproveLanes(const double *vals, double *current, uint16_t *pointers, size_t ifrom_offset) {
+  uint16_t cell(ifrom_offset + 1);
+  for(size_t ilane = 0; ilane < n_lanes_; ++ilane) {  // branch-free, so it vectorizes
+    bool better(vals[ilane] > current[ilane]);
+    current[ilane] = better ? vals[ilane] : current[ilane];
+    pointers[ilane] = better ? cell : pointers[ilane];
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void BatchTrellis::Traceback(size_t ilane, TracebackPath &path) {
+  assert(ilane < n_lanes_);
+  assert(path.model());
+  path.set_model(hmms_[ilane]);
+  if(ending_viterbi_log_probs_[ilane] == -INFINITY)  // no valid path through this hmm
+    return;
+  path.set_score(ending_viterbi_log_probs_[ilane]);
+  path.push_back(ending_viterbi_pointers_[ilane]);
+
+  int32_t pointer(ending_viterbi_pointers_[ilane]);
+  for(size_t position = n_positions_ - 1; position > 0; position--) {
+    pointer = traceback_tables_[ilane].get(position, pointer);
+    if(pointer == -1) {
+      cerr << "No valid path at Position: " << position << endl;
+      return;
+    }
+    path.push_back(pointer);
+  }
+  assert(path.size() > 0);
+}
+
+}
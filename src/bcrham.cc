@@ -8,12 +8,17 @@
 #include <ctime>
 #include <fstream>
 #include <cfenv>
+#include <mutex>
+#include <memory>
+#include <tuple>
 
 #include "dphandler.h"
 #include "bcrutils.h"
 #include "text.h"
 #include "args.h"
 #include "glomerator.h"
+#include "simdkernels.h"
+#include "threadpool.h"
 #include "tclap/CmdLine.h"
 
 using namespace TCLAP;
@@ -29,12 +34,17 @@ int main(int argc, const char * argv[]) {
   clock_t run_start(clock());
   Args args(argc, argv);
   srand(args.random_seed());
+  SetSimdLevel(args.simd());
+  if(args.fast_log_sum_exp())
+    SetLogSumExpMode(kFastLogSumExp);
 
   // init some infrastructure
   vector<string> characters {"A", "C", "G", "T"};
   Track track("NUKES", characters, args.ambig_base());
-  GermLines gl(args.datadir(), args.locus());
-  HMMHolder hmms(args.hmmdir(), gl, &track);
+  unique_ptr<HMMBundle> bundle(args.hmm_bundle() == "" ? nullptr : new HMMBundle(args.hmm_bundle()));
+  GermLines gl(bundle ? GermLines(*bundle, args.locus()) : GermLines(args.datadir(), args.locus()));
+  HMMHolder hmms(args.hmmdir(), gl, &track, bundle.get());
+  hmms.Prefetch(args.str_lists_["only_genes"], max(1, max(args.n_threads(), args.n_gene_threads())));  // read every hmm the queries need up front, rather than in the middle of the first query that needs each one
   vector<vector<Sequence> > qry_seq_list(GetSeqs(args, &track));
 
   if(args.cache_naive_seqs()) {
@@ -81,34 +91,81 @@ void run_algorithm(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qr
 
   int n_vtb_calculated(0), n_fwd_calculated(0);
 
-  for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
-    if(args.debug() > 1) cout << "  ---------" << endl;
-    KSet kmin(args.integers_["k_v_min"][iqry], args.integers_["k_d_min"][iqry]);
-    KSet kmax(args.integers_["k_v_max"][iqry], args.integers_["k_d_max"][iqry]);
-    KBounds kbounds(kmin, kmax);
-    vector<Sequence> qry_seqs(qry_seq_list[iqry]);
-
-    DPHandler dph(args.algorithm(), &args, gl, hmms);
-    Result result = dph.Run(qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
-    // if(FishyMultiSeqAnnotation(qry_seqs.size(), result.best_event()))
-    //   dph.HandleFishyAnnotations(result, qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
-
-    if(args.debug() > 1) cout << "       ----" << endl;
-
-    if(result.no_path_)
-      StreamErrorput(ofs, args.algorithm(), qry_seqs, "no_path");
-    else if(args.algorithm() == "viterbi")
-      StreamViterbiOutput(ofs, result.best_event(), qry_seqs, "");
-    else if(args.algorithm() == "forward")
-      StreamForwardOutput(ofs, qry_seqs, result.total_score(), "");
-    else
-      assert(0);
-
-    if(args.algorithm() == "viterbi")
-      ++n_vtb_calculated;
-    else if(args.algorithm() == "forward")
-      ++n_fwd_calculated;
+  // With --batch-queries, single-sequence viterbi queries with the same length, k bounds, genes, and mute freq go together in batches
+  // of up to that many, which DPHandler::RunBatch() fills in lockstep. Everything else is a batch of one.
+  vector<vector<size_t> > batches;
+  map<tuple<size_t, int, int, int, int, vector<string>, double>, size_t> open_batches;  // batch that we're currently filling up for each key
+  for(size_t iqry = 0; iqry < qry_seq_list.size(); ++iqry) {
+    if(args.batch_queries() < 2 || args.algorithm() != "viterbi" || qry_seq_list[iqry].size() != 1) {
+      batches.push_back(vector<size_t>{iqry});
+      continue;
+    }
+    auto key(make_tuple(qry_seq_list[iqry][0].size(), args.integers_.at("k_v_min").at(iqry), args.integers_.at("k_v_max").at(iqry), args.integers_.at("k_d_min").at(iqry), args.integers_.at("k_d_max").at(iqry), args.str_lists_.at("only_genes").at(iqry), args.floats_.at("mut_freq").at(iqry)));
+    auto it(open_batches.find(key));
+    if(it == open_batches.end() || batches[it->second].size() >= (size_t)args.batch_queries()) {
+      open_batches[key] = batches.size();
+      batches.push_back(vector<size_t>());
+    }
+    batches[open_batches[key]].push_back(iqry);
   }
+
+  // With --n-threads, each thread runs whichever batch is next with its own DPHandler (all sharing <hmms>, which never modifies a model once
+  // it's made), and results are written as soon as all the queries before them are done.
+  ThreadPool pool(max(1, args.n_threads()));
+  mutex mtx;  // protects everything to do with output
+  vector<unique_ptr<Result> > results(qry_seq_list.size());
+  size_t n_written(0);
+
+  pool.ParallelFor(batches.size(), [&](size_t ibatch) {
+      vector<size_t> &batch(batches[ibatch]);
+      size_t ifirst(batch[0]);
+      if(args.debug() > 1) cout << "  ---------" << endl;
+      KSet kmin(args.integers_.at("k_v_min").at(ifirst), args.integers_.at("k_d_min").at(ifirst));
+      KSet kmax(args.integers_.at("k_v_max").at(ifirst), args.integers_.at("k_d_max").at(ifirst));
+      KBounds kbounds(kmin, kmax);
+
+      DPHandler dph(args.algorithm(), &args, gl, hmms);
+      vector<unique_ptr<Result> > batch_results;
+      if(batch.size() == 1) {
+	vector<Sequence> &qry_seqs(qry_seq_list[ifirst]);
+	batch_results.push_back(unique_ptr<Result>(new Result(dph.Run(qry_seqs, kbounds, args.str_lists_.at("only_genes").at(ifirst), args.floats_.at("mut_freq").at(ifirst)))));
+	// if(FishyMultiSeqAnnotation(qry_seqs.size(), result.best_event()))
+	//   dph.HandleFishyAnnotations(result, qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
+      } else {
+	vector<Sequence> batch_seqs;
+	vector<double> mute_freqs;
+	for(auto &iqry : batch) {
+	  batch_seqs.push_back(qry_seq_list[iqry][0]);
+	  mute_freqs.push_back(args.floats_.at("mut_freq").at(iqry));
+	}
+	for(auto &result : dph.RunBatch(batch_seqs, kbounds, args.str_lists_.at("only_genes").at(ifirst), mute_freqs))
+	  batch_results.push_back(unique_ptr<Result>(new Result(result)));
+      }
+
+      if(args.debug() > 1) cout << "       ----" << endl;
+
+      lock_guard<mutex> lock(mtx);
+      for(size_t iresult = 0; iresult < batch.size(); ++iresult)
+	results[batch[iresult]] = move(batch_results[iresult]);
+      for( ; n_written < results.size() && results[n_written]; ++n_written) {  // write out everything that's ready, in order
+	Result &res(*results[n_written]);
+	vector<Sequence> &seqs(qry_seq_list[n_written]);
+	if(res.no_path_)
+	  StreamErrorput(ofs, args.algorithm(), seqs, "no_path");
+	else if(args.algorithm() == "viterbi")
+	  StreamViterbiOutput(ofs, res.best_event(), seqs, "");
+	else if(args.algorithm() == "forward")
+	  StreamForwardOutput(ofs, seqs, res.total_score(), "");
+	else
+	  assert(0);
+
+	if(args.algorithm() == "viterbi")
+	  ++n_vtb_calculated;
+	else if(args.algorithm() == "forward")
+	  ++n_fwd_calculated;
+	results[n_written].reset();
+      }
+    });
   printf("        calcd:   vtb %-4d  fwd %-4d\n", n_vtb_calculated, n_fwd_calculated);
   ofs.close();
 }
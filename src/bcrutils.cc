@@ -180,6 +180,58 @@ GermLines::GermLines(string gldir, string locus):
   ifs.close();
 }
 
+// ----------------------------------------------------------------------------------------
+GermLines::GermLines(HMMBundle &bundle, string locus):
+  regions_({"v", "d", "j"})
+{
+  BundleReader in(bundle.germline_reader());
+  locus_ = in.String();
+  if(locus_ != locus)
+    throw runtime_error("ERROR bundle " + bundle.fname() + " is for locus " + locus_ + ", not " + locus);
+  dummy_d_gene = in.String();
+  for(auto & region : regions_) {
+    names_[region] = vector<string>();
+    uint64_t n_genes(in.U64());
+    for(uint64_t igene = 0; igene < n_genes; ++igene)
+      names_[region].push_back(in.String());
+  }
+  uint64_t n_seqs(in.U64());
+  for(uint64_t iseq = 0; iseq < n_seqs; ++iseq) {
+    string name(in.String());
+    seqs_[name] = in.String();
+  }
+  for(auto positions : {&cyst_positions_, &tryp_positions_}) {
+    uint64_t n_positions(in.U64());
+    for(uint64_t ipos = 0; ipos < n_positions; ++ipos) {
+      string name(in.String());
+      (*positions)[name] = in.Int();
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void GermLines::Write(BundleWriter &out) {
+  out.String(locus_);
+  out.String(dummy_d_gene);
+  for(auto & region : regions_) {
+    out.U64(names_[region].size());
+    for(auto & name : names_[region])
+      out.String(name);
+  }
+  out.U64(seqs_.size());
+  for(auto & kv : seqs_) {
+    out.String(kv.first);
+    out.String(kv.second);
+  }
+  for(auto positions : {&cyst_positions_, &tryp_positions_}) {
+    out.U64(positions->size());
+    for(auto & kv : *positions) {
+      out.String(kv.first);
+      out.Int(kv.second);
+    }
+  }
+}
+
 // ----------------------------------------------------------------------------------------
 // replace * with _star_ and /OR15 with _slash_
 string GermLines::SanitizeName(string gene_name) {
@@ -219,14 +271,14 @@ void RecoEvent::SetNaiveSeq(GermLines &gl) {
   for(auto & region : gl.regions_) {
     int del_5p = deletions_[region + "_5p"];
     int del_3p = deletions_[region + "_3p"];
-    original_seqs[region] = gl.seqs_[genes_[region]];
+    original_seqs[region] = gl.seqs_.at(genes_[region]);
     lengths[region] = original_seqs[region].size() - del_5p - del_3p;
     eroded_seqs[region] = original_seqs[region].substr(del_5p, lengths[region]);
   }
   naive_seq_ = insertions_["fv"] + eroded_seqs["v"] + insertions_["vd"] + eroded_seqs["d"] + insertions_["dj"] + eroded_seqs["j"] + insertions_["jf"];
 
-  int eroded_gl_cpos = gl.cyst_positions_[genes_["v"]] - deletions_["v_5p"] + insertions_["fv"].size();
-  int eroded_gl_tpos = gl.tryp_positions_[genes_["j"]] - deletions_["j_5p"];
+  int eroded_gl_cpos = gl.cyst_positions_.at(genes_["v"]) - deletions_["v_5p"] + insertions_["fv"].size();
+  int eroded_gl_tpos = gl.tryp_positions_.at(genes_["j"]) - deletions_["j_5p"];
   int tpos_in_joined_seq = eroded_gl_tpos + insertions_["fv"].size() + eroded_seqs["v"].size() + insertions_["vd"].size() + eroded_seqs["d"].size() + insertions_["dj"].size();
   cyst_position_ = eroded_gl_cpos;
   tryp_position_ = tpos_in_joined_seq;
@@ -243,6 +295,14 @@ KBounds KBounds::LogicalOr(KBounds rhs) {
   return kbr;
 }
 
+// ----------------------------------------------------------------------------------------
+bool SupportPair::operator < (const SupportPair &rhs) const {
+  double rounded(round(logprob() * 1e6)), rhs_rounded(round(rhs.logprob() * 1e6));  // to_string() writes six decimal places
+  if(rounded != rhs_rounded)
+    return rounded < rhs_rounded;
+  return gene() < rhs.gene();
+}
+
 // ----------------------------------------------------------------------------------------
 void Result::Finalize(GermLines &gl, map<string, double> &unsorted_per_gene_support, KSet best_kset, KBounds kbounds) {
   assert(!finalized_);
@@ -302,54 +362,172 @@ void Result::check_boundaries(KSet best, KBounds kbounds) {
 }
 
 // ----------------------------------------------------------------------------------------
-void HMMHolder::CacheAll() {
-  for(auto & region : gl_.regions_) {
-    for(auto & gene : gl_.names_[region]) {
-      string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
-      if(ifstream(infname)) {
-        cout << "    read " << infname << endl;
-        hmms_[gene] = new Model;
-        hmms_[gene]->Parse(infname);
-      }
+void HMMHolder::CacheAll(size_t n_threads) {
+  set<string> genes;
+  for(auto & region : gl_.regions_)
+    genes.insert(gl_.names_[region].begin(), gl_.names_[region].end());
+  Load(genes, n_threads);
+}
+
+// ----------------------------------------------------------------------------------------
+void HMMHolder::Prefetch(vector<vector<string> > &gene_lists, size_t n_threads) {
+  set<string> genes;
+  for(auto & gene_list : gene_lists)
+    genes.insert(gene_list.begin(), gene_list.end());
+  Load(genes, n_threads);
+}
+
+// ----------------------------------------------------------------------------------------
+// Genes that aren't available get skipped here, so (just as if we hadn't prefetched) we only throw if someone actually asks for them.
+void HMMHolder::Load(set<string> &genes, size_t n_threads) {
+  vector<string> to_read;
+  {
+    lock_guard<mutex> lock(mutex_);
+    for(auto & gene : genes) {
+      if(hmms_.count(gene) == 0 && Available(gene))
+	to_read.push_back(gene);
     }
   }
+
+  vector<Model*> hmms(to_read.size(), nullptr);
+  try {
+    ThreadPool pool(n_threads);
+    pool.ParallelFor(to_read.size(), [&](size_t igene) { hmms[igene] = Read(to_read[igene]); });
+  } catch(...) {
+    for(auto & hmm : hmms)
+      delete hmm;
+    throw;
+  }
+
+  lock_guard<mutex> lock(mutex_);
+  for(size_t igene = 0; igene < to_read.size(); ++igene) {
+    if(hmms_.count(to_read[igene]) == 0)
+      hmms_[to_read[igene]] = hmms[igene];
+    else  // someone else read it while we weren't looking
+      delete hmms[igene];
+  }
 }
 
 // ----------------------------------------------------------------------------------------
-Model *HMMHolder::Get(string gene) {
-  if(hmms_.find(gene) == hmms_.end()) {   // if we don't already have it, read it from disk
-    hmms_[gene] = new Model;
-    string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
-    // if (true) cout << "    read " << infname << endl;
-    hmms_[gene]->Parse(infname);
+Model *HMMHolder::Get(string gene, double overall_mute_freq) {
+  Model *hmm(nullptr);
+  pair<string, double> key(gene, overall_mute_freq);
+  {
+    lock_guard<mutex> lock(mutex_);
+    hmm = GetFromFile(gene);
+    if(overall_mute_freq == -INFINITY)
+      return hmm;
+    if(pins_.count(key.second) == 0)
+      throw runtime_error("ERROR asked for a snapshot of " + gene + " at mute freq " + to_string(overall_mute_freq) + ", but it isn't pinned");
+    auto it(snapshots_.find(key));
+    if(it != snapshots_.end()) {
+      snapshot_lru_.splice(snapshot_lru_.begin(), snapshot_lru_, it->second.second);  // move it to the front
+      return it->second.first;
+    }
+  }
+
+  Model *snapshot(new Model(*hmm, overall_mute_freq));  // rescaling takes a while, so don't hold the lock (<hmm> is never modified or deleted)
+  lock_guard<mutex> lock(mutex_);
+  auto it(snapshots_.find(key));
+  if(it != snapshots_.end()) {  // somebody else made the same one while we were making ours
+    delete snapshot;
+    return it->second.first;
   }
-  return hmms_[gene];
+  snapshot_lru_.push_front(key);
+  snapshots_[key] = pair<Model*, list<pair<string, double> >::iterator>(snapshot, snapshot_lru_.begin());
+  EvictSnapshots();
+  return snapshot;
 }
 
 // ----------------------------------------------------------------------------------------
-void HMMHolder::RescaleOverallMuteFreqs(map<string, set<string> > &only_genes, double overall_mute_freq) {
-  // WOE BETIDE THEE WHO FORGETETH TO RE-RESET THESE
-  // Seriously! If you don't re-rescale 'em when you're done with the sequences to which <overall_mute_freq> correspond, the mute freqs in the hmms will be *wrong*
+void HMMHolder::PinMuteFreq(double overall_mute_freq) {
+  if(overall_mute_freq == -INFINITY)
+    return;
+  lock_guard<mutex> lock(mutex_);
+  pins_[overall_mute_freq] += 1;
+}
 
-  // then actually do the rescaling for each necessary gene
-  for(auto &region : gl_.regions_) {
-    for(auto &gene : only_genes[region]) {
-      Get(gene)->RescaleOverallMuteFreq(overall_mute_freq);
-    }
+// ----------------------------------------------------------------------------------------
+void HMMHolder::UnpinMuteFreq(double overall_mute_freq) {
+  if(overall_mute_freq == -INFINITY)
+    return;
+  lock_guard<mutex> lock(mutex_);
+  auto it(pins_.find(overall_mute_freq));
+  if(it == pins_.end())
+    throw runtime_error("ERROR tried to unpin mute freq " + to_string(overall_mute_freq) + ", which isn't pinned");
+  if(--it->second == 0)
+    pins_.erase(it);
+  EvictSnapshots();
+}
+
+// ----------------------------------------------------------------------------------------
+void HMMHolder::EvictSnapshots() {
+  auto it(snapshot_lru_.end());
+  while(snapshots_.size() > kMaxSnapshots && it != snapshot_lru_.begin()) {
+    --it;
+    if(pins_.count(it->second) > 0)  // somebody may still be using it
+      continue;
+    auto isnap(snapshots_.find(*it));
+    delete isnap->second.first;
+    snapshots_.erase(isnap);
+    it = snapshot_lru_.erase(it);
   }
 }
 
 // ----------------------------------------------------------------------------------------
-void HMMHolder::UnRescaleOverallMuteFreqs(map<string, set<string> > &only_genes) {
-  for(auto &region : gl_.regions_) {
-    for(auto &gene : only_genes[region]) {
-      Get(gene)->UnRescaleOverallMuteFreq();
+Model *HMMHolder::GetFromFile(string gene) {
+  auto it(hmms_.find(gene));
+  if(it != hmms_.end())
+    return it->second;
+  Model *hmm(Read(gene));  // if we don't already have it, read it from disk
+  hmms_[gene] = hmm;
+  return hmm;
+}
+
+// ----------------------------------------------------------------------------------------
+Model *HMMHolder::Read(string gene) {
+  Model *hmm(new Model);
+  try {
+    if(bundle_) {
+      BundleReader record(bundle_->model_reader(gene));
+      hmm->Read(record);
+    } else {
+      string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
+      // if (true) cout << "    read " << infname << endl;
+      hmm->Parse(infname);
     }
+  } catch(...) {
+    delete hmm;
+    throw;
+  }
+  return hmm;
+}
+
+// ----------------------------------------------------------------------------------------
+bool HMMHolder::Available(string gene) {
+  if(bundle_)
+    return bundle_->has_model(gene);
+  return (bool)ifstream(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
+}
+
+// ----------------------------------------------------------------------------------------
+AlleleTrie HMMHolder::BuildAlleleTrie(set<string> &genes, double overall_mute_freq) {
+  vector<string> trie_genes;
+  vector<Model*> trie_hmms;
+  for(auto &gene : genes) {
+    Model *hmm(Get(gene, overall_mute_freq));
+    if(!hmm->compiled()->is_chain())
+      continue;
+    trie_genes.push_back(gene);
+    trie_hmms.push_back(hmm);
   }
+  return AlleleTrie(trie_genes, trie_hmms);
 }
 
 // ----------------------------------------------------------------------------------------
 HMMHolder::~HMMHolder() {
+  for(auto & entry : snapshots_)  // before the hmms, since they share their states
+    delete entry.second.first;
   for(auto & entry : hmms_)
     delete entry.second;
 }
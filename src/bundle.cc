@@ -0,0 +1,147 @@
+#include "bundle.h"
+
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+void BundleWriter::String(const string &str) {
+  U64(str.size());
+  Bytes(str.data(), str.size());
+}
+
+// ----------------------------------------------------------------------------------------
+void BundleWriter::Doubles(const vector<double> &vals) {
+  U64(vals.size());
+  Bytes(vals.data(), vals.size() * sizeof(double));
+}
+
+// ----------------------------------------------------------------------------------------
+void BundleWriter::Bytes(const void *data, size_t size) {
+  buffer_.append((const char*)data, size);
+}
+
+// ----------------------------------------------------------------------------------------
+void BundleWriter::SetU64(size_t offset, uint64_t val) {
+  if(offset + sizeof(val) > buffer_.size())
+    throw runtime_error("ERROR offset " + to_string(offset) + " past the end of bundle buffer of size " + to_string(buffer_.size()));
+  memcpy(&buffer_[offset], &val, sizeof(val));
+}
+
+// ----------------------------------------------------------------------------------------
+void BundleWriter::Write(string fname) {
+  ofstream ofs(fname, ios::binary);
+  if(!ofs.is_open())
+    throw runtime_error("ERROR couldn't open bundle file " + fname + " for writing");
+  ofs.write(buffer_.data(), buffer_.size());
+  if(!ofs)
+    throw runtime_error("ERROR failed writing bundle file " + fname);
+}
+
+// ----------------------------------------------------------------------------------------
+string BundleReader::String() {
+  uint64_t size(U64());
+  if(size > size_ - pos_)
+    throw runtime_error("ERROR string of length " + to_string(size) + " runs off the end of bundle record");
+  string str(data_ + pos_, size);
+  pos_ += size;
+  return str;
+}
+
+// ----------------------------------------------------------------------------------------
+vector<double> BundleReader::Doubles() {
+  uint64_t size(U64());
+  if(size > (size_ - pos_) / sizeof(double))
+    throw runtime_error("ERROR vector of length " + to_string(size) + " runs off the end of bundle record");
+  vector<double> vals(size);
+  Bytes(vals.data(), size * sizeof(double));
+  return vals;
+}
+
+// ----------------------------------------------------------------------------------------
+void BundleReader::Bytes(void *dest, size_t size) {
+  if(size > size_ - pos_)
+    throw runtime_error("ERROR tried to read " + to_string(size) + " bytes at " + to_string(pos_) + " in bundle record of size " + to_string(size_));
+  memcpy(dest, data_ + pos_, size);
+  pos_ += size;
+}
+
+// ----------------------------------------------------------------------------------------
+HMMBundle::HMMBundle(string fname) :
+  fname_(fname),
+  data_(nullptr),
+  size_(0)
+{
+  int fd(open(fname.c_str(), O_RDONLY));
+  if(fd < 0)
+    throw runtime_error("ERROR bundle file " + fname + " d.n.e.");
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    throw runtime_error("ERROR couldn't stat bundle file " + fname);
+  }
+  size_ = st.st_size;
+  void *mapped(size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED);
+  close(fd);  // the mapping stays valid without it
+  if(mapped == MAP_FAILED)
+    throw runtime_error("ERROR couldn't map bundle file " + fname);
+  data_ = (const char*)mapped;
+
+  try {
+    BundleReader header(data_, size_);
+    char magic[sizeof(kBundleMagic)];
+    header.Bytes(magic, sizeof(magic));
+    if(memcmp(magic, kBundleMagic, sizeof(magic)) != 0)
+      throw runtime_error("ERROR " + fname + " isn't an hmm bundle");
+    uint32_t version(header.U32());
+    if(version != kBundleVersion)
+      throw runtime_error("ERROR bundle " + fname + " has version " + to_string(version) + ", but we can only read version " + to_string(kBundleVersion) + " (rerun ham-compile)");
+    if(header.U32() != kBundleByteOrder)
+      throw runtime_error("ERROR bundle " + fname + " was written on a machine with different byte order");
+    index_offset_ = header.U64();
+    germline_offset_ = header.pos();
+    if(index_offset_ < germline_offset_ || index_offset_ > size_)
+      throw runtime_error("ERROR bad index offset " + to_string(index_offset_) + " in bundle " + fname);
+
+    BundleReader index(data_ + index_offset_, size_ - index_offset_);
+    uint64_t n_models(index.U64());
+    for(uint64_t imodel = 0; imodel < n_models; ++imodel) {
+      string gene(index.String());
+      uint64_t offset(index.U64()), size(index.U64());
+      if(offset < germline_offset_ || offset > index_offset_ || size > index_offset_ - offset)
+	throw runtime_error("ERROR bad record for " + gene + " in bundle " + fname);
+      index_[gene] = pair<uint64_t, uint64_t>(offset, size);
+    }
+  } catch(...) {
+    munmap((void*)data_, size_);
+    throw;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+HMMBundle::~HMMBundle() {
+  munmap((void*)data_, size_);
+}
+
+// ----------------------------------------------------------------------------------------
+BundleReader HMMBundle::model_reader(string gene) {
+  auto it(index_.find(gene));
+  if(it == index_.end())
+    throw runtime_error("ERROR no hmm for " + gene + " in bundle " + fname_);
+  return BundleReader(data_ + it->second.first, it->second.second);
+}
+
+// ----------------------------------------------------------------------------------------
+vector<string> HMMBundle::genes() {
+  vector<string> genes;
+  for(auto &kv : index_)
+    genes.push_back(kv.first);
+  return genes;
+}
+
+}
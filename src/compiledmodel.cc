@@ -0,0 +1,222 @@
+#include "compiledmodel.h"
+#include "state.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+CompiledModel::CompiledModel() :
+  topology_(new Topology())
+{
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE assumes the states' indices, transitions, and from-state indices have already been set (i.e. call this at the end of Model::Finalize())
+void CompiledModel::Compile(vector<State*> &states, State *initial, Track *track) {
+  shared_ptr<Topology> topology(new Topology);  // NOTE we only modify it in here, before anybody else can see it
+  Topology &tp(*topology);
+  tp.track = track;
+  tp.n_states = states.size();
+  tp.n_columns = track->n_columns();
+  if(tp.n_states >= UINT16_MAX)
+    throw runtime_error("ERROR too many states (" + to_string(tp.n_states) + ") for CompiledModel");
+
+  tp.from_offsets.assign(1, 0);
+  tp.max_n_from = 0;
+  for(size_t ist = 0; ist < tp.n_states; ++ist) {
+    for(auto &i_st_previous : *states[ist]->from_state_indices()) {
+      tp.from_indices.push_back(i_st_previous);
+      tp.scores.from_log_probs.push_back(states[i_st_previous]->transition_logprob(ist));
+    }
+    tp.from_offsets.push_back(tp.from_indices.size());
+    tp.max_n_from = max(tp.max_n_from, tp.from_offsets[ist + 1] - tp.from_offsets[ist]);
+  }
+
+  for(size_t ist = 0; ist < tp.n_states; ++ist) {
+    if(!initial->can_transition_to(ist))
+      continue;
+    tp.init_indices.push_back(ist);
+    tp.scores.init_log_probs.push_back(initial->transition_logprob(ist));
+  }
+
+  tp.scores.end_log_probs.resize(tp.n_states);
+  tp.to_offsets.assign(1, 0);
+  for(size_t ist = 0; ist < tp.n_states; ++ist) {
+    tp.scores.end_log_probs[ist] = states[ist]->end_transition_logprob();
+    for(auto &trans : *states[ist]->transitions())  // already sorted by to-state index
+      tp.to_indices.push_back(trans->to_state()->index());
+    tp.to_offsets.push_back(tp.to_indices.size());
+  }
+
+  DetectChain(tp);
+  topology_ = topology;
+  SetEmissions(states);
+}
+
+// ----------------------------------------------------------------------------------------
+void CompiledModel::ShareTopology(CompiledModel &base) {
+  assert(emission_scores_.emissions.empty());  // we can't rebuild the lazy emission tables, so this only works on a fresh CompiledModel
+  topology_ = base.topology_;
+}
+
+// ----------------------------------------------------------------------------------------
+// A state has a chain edge if the last entry in its from-list is the state before it (so if we handle the chain edges after the residual
+// ones, we get exactly the same results, including ties, as going through the from-lists in order). Other states (e.g. inserts, which can
+// come from each other) just have residual edges. We call the model a chain if at least half the states have a chain edge.
+void CompiledModel::DetectChain(Topology &tp) {
+  vector<double> &chain_log_probs(tp.scores.chain_log_probs);
+  chain_log_probs.assign(tp.n_states, -INFINITY);
+  size_t n_chain_edges(0);
+  for(size_t ist = 1; ist < tp.n_states; ++ist) {
+    if(tp.from_offsets[ist + 1] == tp.from_offsets[ist])
+      continue;
+    size_t ilast(tp.from_offsets[ist + 1] - 1);
+    if(tp.from_indices[ilast] != ist - 1 || tp.scores.from_log_probs[ilast] == -INFINITY)
+      continue;
+    chain_log_probs[ist] = tp.scores.from_log_probs[ilast];
+    ++n_chain_edges;
+  }
+  tp.is_chain = tp.n_states > 1 && 2 * n_chain_edges >= tp.n_states;
+  if(!tp.is_chain)
+    chain_log_probs.assign(tp.n_states, -INFINITY);
+  tp.residual_states.clear();
+  for(size_t ist = 0; ist < tp.n_states; ++ist) {
+    size_t residual_end(chain_log_probs[ist] == -INFINITY ? tp.from_offsets[ist + 1] : tp.from_offsets[ist + 1] - 1);  // see residual_end()
+    if(residual_end > tp.from_offsets[ist])
+      tp.residual_states.push_back(ist);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+bool CompiledModel::SameTopology(CompiledModel &other) {
+  if(topology_ == other.topology_)
+    return true;
+  const Topology &tp(*topology_), &otp(*other.topology_);
+  if(tp.n_states != otp.n_states || tp.n_columns != otp.n_columns || tp.from_offsets != otp.from_offsets || tp.from_indices != otp.from_indices || tp.init_indices != otp.init_indices)
+    return false;
+  if(tp.is_chain != otp.is_chain || tp.residual_states != otp.residual_states)
+    return false;
+  for(size_t ist = 0; ist < tp.n_states; ++ist) {  // a zero-probability chain edge counts as a residual edge, so check they're all the same
+    if(residual_end(ist) != other.residual_end(ist))
+      return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> static void ExpVector(const vector<double> &log_probs, vector<T> &probs) {
+  probs.resize(log_probs.size());
+  for(size_t i = 0; i < log_probs.size(); ++i)
+    probs[i] = exp(log_probs[i]);
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> static void ConvertVector(const vector<double> &vals, vector<T> &converted) {
+  converted.assign(vals.begin(), vals.end());
+}
+
+// ----------------------------------------------------------------------------------------
+static void QuantizeVector(const vector<double> &log_probs, vector<int16_t> &quantized) {
+  quantized.resize(log_probs.size());
+  for(size_t i = 0; i < log_probs.size(); ++i)
+    quantized[i] = QuantizeLogProb(log_probs[i]);
+}
+
+// ----------------------------------------------------------------------------------------
+template <> void CompiledModel::BuildTransitionTables<double>(bool with_probs) {
+  if(!with_probs)  // the log probs are always there
+    return;
+  const Topology &tp(*topology_);
+  call_once(tp.probs_built, [&tp]() {
+      ExpVector(tp.scores.from_log_probs, tp.scores.from_probs);
+      ExpVector(tp.scores.chain_log_probs, tp.scores.chain_probs);
+      ExpVector(tp.scores.init_log_probs, tp.scores.init_probs);
+      ExpVector(tp.scores.end_log_probs, tp.scores.end_probs);
+    });
+}
+
+// ----------------------------------------------------------------------------------------
+template <> void CompiledModel::BuildTransitionTables<float>(bool with_probs) {
+  const Topology &tp(*topology_);
+  call_once(tp.float_built, [&tp]() {
+      ConvertVector(tp.scores.from_log_probs, tp.float_scores.from_log_probs);
+      ConvertVector(tp.scores.chain_log_probs, tp.float_scores.chain_log_probs);
+      ConvertVector(tp.scores.init_log_probs, tp.float_scores.init_log_probs);
+      ConvertVector(tp.scores.end_log_probs, tp.float_scores.end_log_probs);
+    });
+  if(!with_probs)
+    return;
+  BuildTransitionTables<double>(true);
+  call_once(tp.float_probs_built, [&tp]() {
+      ConvertVector(tp.scores.from_probs, tp.float_scores.from_probs);
+      ConvertVector(tp.scores.chain_probs, tp.float_scores.chain_probs);
+      ConvertVector(tp.scores.init_probs, tp.float_scores.init_probs);
+      ConvertVector(tp.scores.end_probs, tp.float_scores.end_probs);
+    });
+}
+
+// ----------------------------------------------------------------------------------------
+template <> void CompiledModel::BuildTransitionTables<int16_t>(bool) {  // (no plain probs for int16)
+  const Topology &tp(*topology_);
+  call_once(tp.quantized_built, [&tp]() {
+      QuantizeVector(tp.scores.from_log_probs, tp.quantized_scores.from_log_probs);
+      QuantizeVector(tp.scores.chain_log_probs, tp.quantized_scores.chain_log_probs);
+      QuantizeVector(tp.scores.init_log_probs, tp.quantized_scores.init_log_probs);
+      QuantizeVector(tp.scores.end_log_probs, tp.quantized_scores.end_log_probs);
+    });
+}
+
+// ----------------------------------------------------------------------------------------
+template <> void CompiledModel::BuildEmissionTables<double>(bool with_probs) {
+  if(!with_probs)
+    return;
+  call_once(emission_probs_built_, [this]() {
+      ExpVector(emission_scores_.emissions_by_column, emission_scores_.emission_probs_by_column);
+    });
+}
+
+// ----------------------------------------------------------------------------------------
+template <> void CompiledModel::BuildEmissionTables<float>(bool with_probs) {
+  call_once(float_emissions_built_, [this]() {
+      ConvertVector(emission_scores_.emissions, float_emission_scores_.emissions);
+      ConvertVector(emission_scores_.emissions_by_column, float_emission_scores_.emissions_by_column);
+    });
+  if(!with_probs)
+    return;
+  BuildEmissionTables<double>(true);
+  call_once(float_emission_probs_built_, [this]() {
+      ConvertVector(emission_scores_.emission_probs_by_column, float_emission_scores_.emission_probs_by_column);
+    });
+}
+
+// ----------------------------------------------------------------------------------------
+template <> void CompiledModel::BuildEmissionTables<int16_t>(bool) {  // (no plain probs for int16)
+  call_once(quantized_emissions_built_, [this]() {
+      QuantizeVector(emission_scores_.emissions, quantized_emission_scores_.emissions);
+      QuantizeVector(emission_scores_.emissions_by_column, quantized_emission_scores_.emissions_by_column);
+    });
+}
+
+// ----------------------------------------------------------------------------------------
+void CompiledModel::SetEmissions(vector<State*> &states, vector<vector<double> > *log_probs) {
+  size_t n_st(n_states()), n_cols(n_columns());
+  Track *track(topology_->track);
+  assert(states.size() == n_st);
+  assert(log_probs == nullptr || log_probs->size() == n_st);
+  vector<double> &emissions(emission_scores_.emissions);
+  emissions.resize(n_st * n_cols);
+  for(size_t ist = 0; ist < n_st; ++ist) {
+    for(size_t isymbol = 0; isymbol < track->alphabet_size(); ++isymbol)
+      emissions[ist * n_cols + isymbol] = log_probs ? (*log_probs)[ist][isymbol] : states[ist]->EmissionLogprob(isymbol);
+    // states with no ambiguous char would've read off the end of their emission table, so we may as well make it impossible
+    double ambig_logprob = states[ist]->ambiguous_char() == "" ? -INFINITY : states[ist]->EmissionLogprob(track->ambiguous_index());
+    emissions[ist * n_cols + track->column(track->ambiguous_index())] = ambig_logprob;
+  }
+
+  emission_scores_.emissions_by_column.resize(n_cols * n_st);
+  for(size_t ist = 0; ist < n_st; ++ist) {
+    for(size_t icol = 0; icol < n_cols; ++icol)
+      emission_scores_.emissions_by_column[icol * n_st + ist] = emissions[ist * n_cols + icol];
+  }
+}
+
+}
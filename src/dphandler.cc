@@ -5,7 +5,13 @@ DPHandler::DPHandler(string algorithm, Args *args, GermLines &gl, HMMHolder &hmm
   algorithm_(algorithm),
   args_(args),
   gl_(gl),
-  hmms_(hmms)
+  hmms_(hmms),
+  thread_pool_(args->n_gene_threads() > 1 && !args->validate_float_dp() ? ThreadPool::shared(args->n_gene_threads()) : nullptr),
+  overall_mute_freq_(-INFINITY),
+  ibatch_(0),
+  n_float_validations_(0),
+  n_float_path_mismatches_(0),
+  max_float_deviation_(0.)
 {
 }
 
@@ -16,55 +22,114 @@ DPHandler::~DPHandler() {
 
 // ----------------------------------------------------------------------------------------
 void DPHandler::Clear() {
+  ClearCaches();
+  batch_trellises_.clear();
+  batch_seqs_.clear();
+  run_seqs_.clear();  // now that none of the trellises are looking at them
+  for(auto &mute_freq : pinned_mute_freqs_)  // now that nothing of ours points at their snapshots
+    hmms_.UnpinMuteFreq(mute_freq);
+  pinned_mute_freqs_.clear();
+}
+
+// ----------------------------------------------------------------------------------------
+void DPHandler::ClearCaches() {
   scratch_cachefo_.clear();
-  paths_.clear();
-  scores_.clear();
+  float_scratch_cachefo_.clear();
+  region_results_.clear();
   per_gene_support_.clear();
+  suffix_trellises_.clear();
+  allele_tries_.clear();
 }
 
 // ----------------------------------------------------------------------------------------
-Sequences DPHandler::GetSubSeqs(Sequences &seqs, KSet kset, string region) {
+SequencesView DPHandler::GetSubSeqs(Sequences &seqs, KSet kset, string region) {
   // get subsequences for one region
   size_t k_v(kset.v), k_d(kset.d);
   if(region == "v")
-    return Sequences(seqs, 0, k_v);  // v region (plus vd insert) runs from zero up to k_v
+    return SequencesView(seqs, 0, k_v);  // v region (plus vd insert) runs from zero up to k_v
   else if(region == "d")
-    return Sequences(seqs, k_v, k_d);  // d region (plus dj insert) runs from k_v up to k_v + k_d
+    return SequencesView(seqs, k_v, k_d);  // d region (plus dj insert) runs from k_v up to k_v + k_d
   else if(region == "j")
-    return Sequences(seqs, k_v + k_d, seqs.GetSequenceLength() - k_v - k_d);  // j region runs from k_v + k_d to end
+    return SequencesView(seqs, k_v + k_d, seqs.GetSequenceLength() - k_v - k_d);  // j region runs from k_v + k_d to end
   else
     assert(0);
 }
 
 // ----------------------------------------------------------------------------------------
-map<string, Sequences> DPHandler::GetSubSeqs(Sequences &seqs, KSet kset) {
+map<string, SequencesView> DPHandler::GetSubSeqs(Sequences &seqs, KSet kset) {
   // get subsequences for all regions
-  map<string, Sequences> subseqs;
+  map<string, SequencesView> subseqs;
   for(auto & region : gl_.regions_)
     subseqs[region] = GetSubSeqs(seqs, kset, region);
   return subseqs;
 }
 
 
+// ----------------------------------------------------------------------------------------
+// Clear() the caches if <clear_cache> is set, and return an empty Sequences for the next Run() to put its queries in. We keep it until the
+// next Clear(), since the trellises in the caches look at it.
+Sequences &DPHandler::NewSequences(bool clear_cache) {
+  if(clear_cache)  // default is true, and be VERY FUCKING CAREFUL if you change that
+    Clear();  // delete all existing trellisi, paths, and logprobs NOTE in principal it kinda ought to be faster to keep everything cached between calls to Run()... but in practice there's a fair bit of overhead to keeping all that stuff hanging around, and it's much more efficient to do the caching in Glomerator (which we already do). So, in sum, it's generally faster to Clear() right here. One exception is if you, say, run viterbi on the same sequence fifty times in a row... then you want to keep the cache around. But why would you do that? In practice the only time you're running on the same sequence many times is in Glomerator, and there we're already doing caching more efficiently at a higher level.
+  run_seqs_.push_back(Sequences());
+  return run_seqs_.back();
+}
+
 // ----------------------------------------------------------------------------------------
 Result DPHandler::Run(Sequence seq, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq, bool clear_cache) {
-  vector<Sequence> seqvector{seq};
-  return Run(seqvector, kbounds, only_gene_list, overall_mute_freq, clear_cache);
+  Sequences &seqs(NewSequences(clear_cache));
+  seqs.AddSeq(seq);
+  return Run(seqs, kbounds, only_gene_list, overall_mute_freq);
 }
 
 // ----------------------------------------------------------------------------------------
 Result DPHandler::Run(vector<Sequence*> pseqvector, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq, bool clear_cache) {
-  vector<Sequence> seqvector(GetSeqVector(pseqvector));
-  return Run(seqvector, kbounds, only_gene_list, overall_mute_freq, clear_cache);
+  Sequences &seqs(NewSequences(clear_cache));  // NOTE this is the only copy we make of the sequences -- everything below looks at them through SequencesViews
+  for(auto &pseq : pseqvector)
+    seqs.AddSeq(*pseq);
+  return Run(seqs, kbounds, only_gene_list, overall_mute_freq);
 }
 
 // ----------------------------------------------------------------------------------------
 Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq, bool clear_cache) {
-  clock_t run_start(clock());
-
-  Sequences seqs;
+  Sequences &seqs(NewSequences(clear_cache));
   for(auto &seq : seqvector)
     seqs.AddSeq(seq);
+  return Run(seqs, kbounds, only_gene_list, overall_mute_freq);
+}
+
+// ----------------------------------------------------------------------------------------
+vector<Result> DPHandler::RunBatch(vector<Sequence> &seqvector, KBounds kbounds, vector<string> only_gene_list, vector<double> overall_mute_freqs) {
+  assert(overall_mute_freqs.size() == seqvector.size());
+  Clear();
+  for(size_t iquery = 0; iquery < seqvector.size(); ++iquery) {
+    if(seqvector[iquery].size() != seqvector[0].size())
+      throw runtime_error("ERROR sequences of different lengths (" + to_string(seqvector[iquery].size()) + " and " + to_string(seqvector[0].size()) + ") in query batch");
+    if(!args_->dont_rescale_emissions() && overall_mute_freqs[iquery] != overall_mute_freqs[0])
+      throw runtime_error("ERROR mute freqs " + to_string(overall_mute_freqs[iquery]) + " and " + to_string(overall_mute_freqs[0]) + " in query batch would need different snapshots");
+    batch_seqs_.push_back(&NewSequences(false));
+    batch_seqs_.back()->AddSeq(seqvector[iquery]);
+  }
+
+  vector<Result> results;
+  for(ibatch_ = 0; ibatch_ < batch_seqs_.size(); ++ibatch_) {
+    ClearCaches();  // but keep <batch_trellises_> (and the sequences they look at) for the later queries
+    results.push_back(Run(*batch_seqs_[ibatch_], kbounds, only_gene_list, overall_mute_freqs[ibatch_]));
+  }
+  batch_trellises_.clear();
+  batch_seqs_.clear();
+  return results;
+}
+
+// ----------------------------------------------------------------------------------------
+Result DPHandler::Run(Sequences &seqs, KBounds kbounds, vector<string> &only_gene_list, double overall_mute_freq) {
+  clock_t run_start(clock());
+  Arena *arena(Arena::thread_arena());
+  arena->set_hugepages(args_->hugepage_arena());
+  ArenaScope arena_scope(arena);  // allocate trellises from this thread's arena (it gets rewound once Clear() has destroyed all of them)
+
+  if(seqs.n_seqs() > 1)
+    seqs.profile();  // count the columns once here, so the subsequences for each kset can just take their chunk of it
 
   // convert <only_gene_list> to a set for each region
   map<string, set<string> > only_genes;
@@ -80,18 +145,36 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
 
   if(kbounds.vmin == 0 || kbounds.dmin == 0 || kbounds.vmax <= kbounds.vmin || kbounds.dmax <= kbounds.dmin) // make sure max values for k_v and k_d are greater than their min values (it at least used to seg fault if you passed in one of them as zero)
     throw runtime_error("k bounds trivial, nonsensical, or include zero (v: " + to_string(kbounds.vmin) + " " + to_string(kbounds.vmax) + "  d: " + to_string(kbounds.dmin) + " " + to_string(kbounds.dmax) + ")");
-  if(clear_cache)  // default is true, and be VERY FUCKING CAREFUL if you change that
-    Clear();  // delete all existing trellisi, paths, and logprobs NOTE in principal it kinda ought to be faster to keep everything cached between calls to Run()... but in practice there's a fair bit of overhead to keeping all that stuff hanging around, and it's much more efficient to do the caching in Glomerator (which we already do). So, in sum, it's generally faster to Clear() right here. One exception is if you, say, run viterbi on the same sequence fifty times in a row... then you want to keep the cache around. But why would you do that? In practice the only time you're running on the same sequence many times is in Glomerator, and there we're already doing caching more efficiently at a higher level.
+  n_float_validations_ = 0;
+  n_float_path_mismatches_ = 0;
+  max_float_deviation_ = 0.;
   map<KSet, double> best_scores; // best score for each kset (summed over regions)
   map<KSet, double> total_scores; // total score for each kset (summed over regions)
   map<KSet, map<string, string> > best_genes; // map from a kset to its corresponding triplet of best genes
-  if(!args_->dont_rescale_emissions()) {  // reset the emission probabilities in the hmms to reflect the frequences in this particular set of sequences
+  overall_mute_freq_ = -INFINITY;
+  if(!args_->dont_rescale_emissions()) {  // use hmms whose emission probabilities reflect the frequences in this particular set of sequences
     assert(overall_mute_freq != -INFINITY);  // make sure the caller remembered to set it
-    // NOTE it's super important to *un*set them after you're done
-    hmms_.RescaleOverallMuteFreqs(only_genes, overall_mute_freq);
+    overall_mute_freq_ = overall_mute_freq;
+    hmms_.PinMuteFreq(overall_mute_freq_);
+    pinned_mute_freqs_.push_back(overall_mute_freq_);
   }
 
   Result result(kbounds, args_->locus());
+  map<string, set<string> > run_genes(only_genes);  // genes we actually run
+  if(algorithm_ == "viterbi" && args_->viterbi_filter_n_best() > 0)
+    FilterGenes(seqs, kbounds, run_genes);
+  bool factorized(algorithm_ == "forward" && args_->factorized_forward());  // Args makes sure we're not also asked for --float-dp (but in partition mode we still run viterbi for naive seqs)
+  if((args_->j_suffix_trellis() || factorized) && !args_->float_dp() && !args_->validate_float_dp())
+    FillSuffixTrellises(seqs, kbounds, run_genes["j"]);
+  if(factorized)
+    FillFactorizedScores(seqs, kbounds, run_genes, &best_scores, &total_scores);
+  if(algorithm_ == "viterbi" && args_->allele_trie()) {
+    for(auto &region : gl_.regions_) {
+      allele_tries_[region] = hmms_.BuildAlleleTrie(run_genes[region], overall_mute_freq_);
+      if(args_->debug())
+	printf("      allele trie for %s: %zu genes, %zu nodes, %zu of %zu states\n", region.c_str(), allele_tries_[region].n_genes(), allele_tries_[region].n_nodes(), allele_tries_[region].n_node_states(), allele_tries_[region].n_states());
+    }
+  }
 
   // loop over k_v k_d space
   double best_score(-INFINITY);
@@ -106,7 +189,8 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
         continue;
       }
       KSet kset(k_v, k_d);
-      RunKSet(seqs, kset, only_genes, &best_scores, &total_scores, &best_genes);
+      if(!factorized)
+	RunKSet(seqs, kset, run_genes, &best_scores, &total_scores, &best_genes);
       ++n_run;
       *total_score = AddInLogSpace(total_scores[kset], *total_score);  // sum up the probabilities for each kset, log P_tot = log \sum_i P_k_i
       if(args_->debug() == 2 && algorithm_ == "forward") printf("            %9.2f (%.1e)  tot: %7.2f\n", total_scores[kset], exp(total_scores[kset]), *total_score);
@@ -118,6 +202,8 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
         result.PushBackRecoEvent(FillRecoEvent(seqs, kset, best_genes[kset], best_scores[kset]));
     }
   }
+  if(args_->validate_float_dp())
+    printf("      float dp validation: max log prob deviation %.2e over %d dp tables (%d viterbi paths differ)  %s\n", max_float_deviation_, n_float_validations_, n_float_path_mismatches_, seqs.name_str(":").c_str());
   if(args_->debug() && n_too_long > 0) cout << "      skipped " << n_too_long << " (of " << n_total << ") k sets 'cause they were longer than the sequence (ran " << n_run << ")" << endl;
 
   // return if no valid path
@@ -146,7 +232,7 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
     }
     double cpu_seconds(((clock() - run_start) / (double)CLOCKS_PER_SEC));
     printf("           %s %12.3f   %-25s  %2zuv %2zud %2zuj  %5.2fs   %s\n", alg_str.c_str(), prob, kstr,
-	   only_genes["v"].size(), only_genes["d"].size(), only_genes["j"].size(),  // hmms_.NameString(&only_genes, 30)
+	   run_genes["v"].size(), run_genes["d"].size(), run_genes["j"].size(),  // hmms_.NameString(&only_genes, 30)
 	   cpu_seconds, seqs.name_str(":").c_str());
 
     if(result.boundary_error()) {   // not necessarily a big deal yet -- the bounds get automatical expanded
@@ -160,9 +246,6 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
     }
   }
 
-  if(!args_->dont_rescale_emissions())  // if we rescaled them above, re-rescale the overall mean mute freqs
-    hmms_.UnRescaleOverallMuteFreqs(only_genes);
-
   return result;
 }
 
@@ -213,61 +296,275 @@ void DPHandler::PrintCachedTrellisSize() {
 }
 
 // ----------------------------------------------------------------------------------------
-void DPHandler::FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin) {
+DPHandler::RegionResult &DPHandler::FillTrellis(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, string gene, string &origin) {
+  RegionResult &result(AddRegionResult(region, gene, kset, query_seqs.GetSequenceLength()));
+  TracebackPath *path(result.path.get());
+  double uncorrected_score;  // still need to tack on the gene choice prob to this score
+  if(args_->float_dp())
+    uncorrected_score = FillTrellis(query_seqs, query_strs, gene, origin, float_scratch_cachefo_, path);
+  else
+    uncorrected_score = FillTrellis(query_seqs, query_strs, gene, origin, scratch_cachefo_, path);
+  if(args_->validate_float_dp())
+    ValidateFloatDP(query_seqs, gene, uncorrected_score, path);
 
-  Trellis *cached_trellis(nullptr);
-  if(!args_->no_chunk_cache()) {   // figure out if we've already got a trellis with a dp table which includes the one we're about to calculate (we should, unless this is the first kset)
-    // NOTE we're no longer looking through previously chunk cached cachefo here. Which I think is ok, but possible only because we loop over ksets in decreasing order (?)
-    for(auto &kv : scratch_cachefo_[gene]) {  // kv: (query string vector, trellis)
-      vector<string> cached_query_strs(kv.first);
-      if(cached_query_strs.size() != query_strs.size())  // have to have same number of sequences (it'd be much harder for this to happen now that I'm now reusing dphandlers)
-	continue;
+  // correct the score for gene choice probs
+  double gene_choice_score = log(hmms_.Get(gene, overall_mute_freq_)->overall_prob());
+  result.score = AddWithMinusInfinities(uncorrected_score, gene_choice_score);
+  return result;
+}
 
-      // loop over all the query strings for this trellis to see if they all match
-      bool found_match(true);
-      for(size_t iseq = 0; iseq < cached_query_strs.size(); ++iseq) {  // NOTE this starts to seem like it might be bottlenecking me when I'm applying it for short d sequences
-        if(cached_query_strs[iseq].find(query_strs[iseq]) != 0) {  // if <query_strs[iseq]> (the current query) doesn't appear starting at position zero in <cached_query_strs[iseq]> (a previously cached query), we'll need to recalculate
-          found_match = false;
-          break;
-        }
-      }
+// ----------------------------------------------------------------------------------------
+// Fill in a SuffixTrellis for each of <j_genes> on the longest j query sequence that any kset in <kbounds> can give us (i.e. starting at the
+// smallest k_v + k_d), so RunKSet() can get every j start position out of it rather than running a trellis for each one.
+void DPHandler::FillSuffixTrellises(Sequences &seqs, KBounds kbounds, set<string> &j_genes) {
+  suffix_trellises_.clear();
+  suffix_start_ = kbounds.vmin + kbounds.dmin;
+  if(suffix_start_ >= seqs.GetSequenceLength())
+    return;
+  SequencesView suffix_seqs(seqs, suffix_start_, seqs.GetSequenceLength() - suffix_start_);
+  for(auto &gene : j_genes) {
+    auto inserted(suffix_trellises_.insert(pair<string, SuffixTrellis>(gene, SuffixTrellis(hmms_.Get(gene, overall_mute_freq_), suffix_seqs))));
+    SuffixTrellis &strell(inserted.first->second);
+    if(algorithm_ == "viterbi")
+      strell.Viterbi();
+    else
+      strell.Forward();
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// same as FillTrellis(), but for a j gene whose suffix trellis we've already filled in
+DPHandler::RegionResult &DPHandler::FillFromSuffixTrellis(KSet kset, string gene, string &origin) {
+  SuffixTrellis &strell(suffix_trellises_.at(gene));
+  assert(kset.v + kset.d >= suffix_start_);
+  size_t start(kset.v + kset.d - suffix_start_);
+  RegionResult &result(AddRegionResult("j", gene, kset, strell.n_positions() - start));
+  double uncorrected_score;
+  if(algorithm_ == "viterbi") {
+    TracebackPath &path(*result.path);
+    path = TracebackPath(strell.model());
+    uncorrected_score = strell.viterbi_log_prob(start);
+    if(uncorrected_score != -INFINITY)
+      strell.Traceback(start, path);
+  } else {
+    uncorrected_score = strell.forward_log_prob(start);
+  }
+  double gene_choice_score = log(hmms_.Get(gene, overall_mute_freq_)->overall_prob());
+  result.score = AddWithMinusInfinities(uncorrected_score, gene_choice_score);
+  origin = "suffix";
+  return result;
+}
+
+// ----------------------------------------------------------------------------------------
+// For --factorized-forward, fill in <best_scores> and <total_scores> for every kset in <kbounds> (the same things forward RunKSet() would give us)
+// without going through the ksets one at a time. Since a kset's total is just the product of the three regions' totals, and each region's forward
+// tables give us the log prob at every position, we only need one dp table per gene for v, one per gene and k_v for d, and the j suffix tables. We
+// sum everything up in the same order as RunKSet(), so the results are identical to running without --factorized-forward (but with
+// --j-suffix-trellis). This only works because forward sums over paths: a viterbi path has to be traced back through a single kset, which we don't do.
+void DPHandler::FillFactorizedScores(Sequences &seqs, KBounds kbounds, map<string, set<string> > &genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores) {
+  size_t seq_length(seqs.GetSequenceLength());
+  if(kbounds.vmin + kbounds.dmin >= seq_length)  // every kset is too long
+    return;
+
+  vector<double> j_total(seq_length, -INFINITY), j_best(seq_length, -INFINITY);  // indexed by j start position
+  for(auto &gene : genes["j"]) {
+    if(suffix_trellises_.count(gene) == 0)
+      continue;
+    SuffixTrellis &strell(suffix_trellises_.at(gene));
+    double gene_choice_score = log(hmms_.Get(gene, overall_mute_freq_)->overall_prob());
+    for(size_t start = suffix_start_; start < seq_length; ++start) {
+      double gene_score(AddWithMinusInfinities(strell.forward_log_prob(start - suffix_start_), gene_choice_score));
+      j_total[start] = AddInLogSpace(gene_score, j_total[start]);
+      j_best[start] = max(j_best[start], gene_score);
+    }
+  }
+
+  vector<double> v_total, v_best, d_total, d_best;  // indexed by k_v - 1 (resp. k_d - 1)
+  RegionForwardLogProbs(SequencesView(seqs, 0, min(kbounds.vmax - 1, seq_length - 1 - kbounds.dmin)), genes["v"], v_total, v_best);
+  for(size_t k_v = kbounds.vmin; k_v < kbounds.vmax && k_v + kbounds.dmin < seq_length; ++k_v) {
+    RegionForwardLogProbs(SequencesView(seqs, k_v, min(kbounds.dmax - 1, seq_length - 1 - k_v)), genes["d"], d_total, d_best);
+    for(size_t k_d = kbounds.dmin; k_d < kbounds.dmax && k_v + k_d < seq_length; ++k_d) {
+      KSet kset(k_v, k_d);
+      (*best_scores)[kset] = AddWithMinusInfinities(v_best[k_v - 1], AddWithMinusInfinities(d_best[k_d - 1], j_best[k_v + k_d]));
+      (*total_scores)[kset] = AddWithMinusInfinities(v_total[k_v - 1], AddWithMinusInfinities(d_total[k_d - 1], j_total[k_v + k_d]));
+      if((*best_scores)[kset] == -INFINITY)  // RunKSet() gives up on ksets for which some region has no valid gene
+	(*total_scores)[kset] = -INFINITY;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Run forward for each of <genes> on <query_seqs>, and fill in the log prob (including the gene choice prob) of each length of query summed over
+// the genes, and of the best gene.
+void DPHandler::RegionForwardLogProbs(SequencesView query_seqs, set<string> &genes, vector<double> &total_log_probs, vector<double> &best_log_probs) {
+  size_t length(query_seqs.GetSequenceLength());
+  total_log_probs.assign(length, -INFINITY);
+  best_log_probs.assign(length, -INFINITY);
+  for(auto &gene : genes) {
+    Trellis trell(hmms_.Get(gene, overall_mute_freq_), query_seqs);
+    trell.SetScaledForward(args_->scaled_forward());
+    trell.Forward();
+    double gene_choice_score = log(hmms_.Get(gene, overall_mute_freq_)->overall_prob());
+    for(size_t len = 1; len <= length; ++len) {
+      double gene_score(AddWithMinusInfinities(trell.ending_forward_log_prob(len), gene_choice_score));
+      total_log_probs[len - 1] = AddInLogSpace(gene_score, total_log_probs[len - 1]);
+      best_log_probs[len - 1] = max(best_log_probs[len - 1], gene_score);
+    }
+  }
+}
 
-      // if they all match, then use it
-      if(found_match) {
-	cached_trellis = &scratch_cachefo_[gene][cached_query_strs];  // will copy over the required chunk of the old trellis into a new trellis for the current query
+// ----------------------------------------------------------------------------------------
+// Run viterbi on <region>'s allele trie (see TrieTrellis) for the genes in <genes> that would otherwise need a trellis from scratch, and put the
+// results in <scratch_cachefo_>, where the gene loop in RunKSet() picks them up as chunk caches (same as FillLockstepTrellises()).
+void DPHandler::FillTrieTrellises(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, set<string> &genes) {
+  if(args_->no_chunk_cache() || args_->float_dp() || args_->checkpoint_interval() != 0)
+    return;
+  AlleleTrie &trie(allele_tries_[region]);
+  vector<size_t> igenes;
+  for(auto &gene : genes) {
+    if(!trie.has(gene))
+      continue;
+    InitCache(gene);
+    if(FindRegionResult(region, gene, kset, query_seqs.GetSequenceLength()) != nullptr || scratch_cachefo_[gene].FindExtension(query_strs) != nullptr)
+      continue;
+    igenes.push_back(trie.index(gene));
+  }
+  if(igenes.size() < 2)  // may as well just let FillTrellis() do it
+    return;
+
+  TrieTrellis trie_trell(&trie, query_seqs, igenes);
+  trie_trell.Viterbi();
+  for(auto &igene : igenes) {
+    Trellis &trell(scratch_cachefo_[trie.gene(igene)].Add(query_strs, Trellis(trie.hmm(igene), query_seqs)));
+    trell.AdoptViterbi(trie_trell, igene);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Run viterbi in lockstep (see BatchTrellis) for the genes in <genes> that would otherwise need a trellis from scratch, in batches of genes with the same
+// topology, and put the results in <scratch_cachefo_>. The gene loop in RunKSet() then picks them up as chunk caches, so we get exactly the same results.
+void DPHandler::FillLockstepTrellises(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, set<string> &genes) {
+  if(args_->no_chunk_cache() || args_->float_dp() || args_->checkpoint_interval() != 0)
+    return;
+  const size_t max_lanes(16);
+  vector<vector<string> > groups;  // genes with the same topology
+  for(auto &gene : genes) {
+    InitCache(gene);
+    if(FindRegionResult(region, gene, kset, query_seqs.GetSequenceLength()) != nullptr || scratch_cachefo_[gene].FindExtension(query_strs) != nullptr)
+      continue;
+    bool found_group(false);
+    for(auto &group : groups) {
+      if(group.size() < max_lanes && hmms_.Get(gene, overall_mute_freq_)->compiled()->SameTopology(*hmms_.Get(group[0], overall_mute_freq_)->compiled())) {
+        group.push_back(gene);
+        found_group = true;
         break;
       }
     }
+    if(!found_group)
+      groups.push_back(vector<string>{gene});
+  }
+
+  for(auto &group : groups) {
+    if(group.size() < 2)  // may as well just let FillTrellis() do it
+      continue;
+    vector<Model*> hmms;
+    for(auto &gene : group)
+      hmms.push_back(hmms_.Get(gene, overall_mute_freq_));
+    BatchTrellis batch(hmms, query_seqs);
+    batch.Viterbi();
+    for(size_t ilane = 0; ilane < group.size(); ++ilane) {
+      Trellis &trell(scratch_cachefo_[group[ilane]].Add(query_strs, Trellis(hmms[ilane], query_seqs)));
+      trell.AdoptViterbi(batch, ilane);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// For RunBatch(), put a trellis in <scratch_cachefo_> for each of <genes> that would otherwise need one from scratch on <query_seqs>. The first
+// query that needs a gene on a given stretch of sequence runs viterbi on it in one batch trellis for itself and all the queries after it
+// (which all have the same length, k bounds, and genes, so they'll need it on the same stretch), and the later ones just pick up their lanes.
+// As with FillLockstepTrellises(), the gene loop in RunKSet() then picks them up as chunk caches, so we get exactly the same results.
+void DPHandler::FillBatchTrellises(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, set<string> &genes) {
+  if(args_->no_chunk_cache() || args_->float_dp() || args_->checkpoint_interval() != 0)
+    return;
+  size_t start(query_seqs.pos()), length(query_seqs.GetSequenceLength());
+  for(auto &gene : genes) {
+    InitCache(gene);
+    if(FindRegionResult(region, gene, kset, length) != nullptr || scratch_cachefo_[gene].FindExtension(query_strs) != nullptr || (region == "j" && suffix_trellises_.count(gene) > 0))
+      continue;
+    Model *hmm(hmms_.Get(gene, overall_mute_freq_));
+    auto key(make_tuple(gene, start, length));
+    if(batch_trellises_.count(key) == 0) {
+      if(batch_seqs_.size() - ibatch_ < 2)  // may as well just let FillTrellis() do it
+	continue;
+      vector<SequencesView> lane_seqs;
+      for(size_t iquery = ibatch_; iquery < batch_seqs_.size(); ++iquery)
+	lane_seqs.push_back(SequencesView(*batch_seqs_[iquery], start, length));
+      batch_trellises_[key] = make_pair(unique_ptr<BatchTrellis>(new BatchTrellis(hmm, lane_seqs)), ibatch_);
+      batch_trellises_[key].first->Viterbi();
+    }
+    auto &batch(batch_trellises_[key]);
+    Trellis &trell(scratch_cachefo_[gene].Add(query_strs, Trellis(hmm, query_seqs)));  // NOTE adopt it in place, since a copy of a trellis that's been run still points at the original's tables
+    trell.AdoptViterbi(*batch.first, ibatch_ - batch.second);
   }
+}
+
+// ----------------------------------------------------------------------------------------
+// find or make a trellis for <query_seqs> in <cachefo> (which is either the double or float cache), and run the dp algorithm on it
+template <class TrellisT> double DPHandler::FillTrellis(SequencesView &query_seqs, vector<string> &query_strs, string gene, string &origin, map<string, TrellisCache<TrellisT> > &cachefo, TracebackPath *path) {
 
-  Trellis tmptrell(hmms_.Get(gene), query_seqs, cached_trellis);  // NOTE chunk cached trellisi don't get kept around -- we should be able to always just go back to the original one
-  Trellis *trell(&tmptrell);  // convenience pointer
+  TrellisCache<TrellisT> &cache(cachefo.at(gene));
+  TrellisT *cached_trellis(args_->no_chunk_cache() ? nullptr : cache.FindExtension(query_strs));  // see if we've already got a trellis with a dp table which includes the one we're about to calculate (we should, unless this is the first kset)
+  TrellisT tmptrell(hmms_.Get(gene, overall_mute_freq_), query_seqs, cached_trellis);  // NOTE chunk cached trellisi don't get kept around -- we should be able to always just go back to the original one
+  TrellisT *trell(&tmptrell);  // convenience pointer
   if(cached_trellis == nullptr) {   // if we didn't find a suitable chunk cached trellis
-    scratch_cachefo_[gene][query_strs] = Trellis(hmms_.Get(gene), query_seqs);
-    trell = &scratch_cachefo_[gene][query_strs];
+    trell = &cache.Add(query_strs, TrellisT(hmms_.Get(gene, overall_mute_freq_), query_seqs));
+    trell->SetCheckpointInterval(args_->checkpoint_interval());
+    trell->SetScaledForward(args_->scaled_forward());
     origin = "scratch";
   } else {
     origin = "chunk";
   }
 
-  // run the actual dp algorithms
-  double uncorrected_score;  // still need to tack on the gene choice prob to this score
+  return RunTrellis(trell, gene, path);
+}
+
+// ----------------------------------------------------------------------------------------
+template <class TrellisT> double DPHandler::RunTrellis(TrellisT *trell, string gene, TracebackPath *path) {
   if(algorithm_ == "viterbi") {
     trell->Viterbi();
-    uncorrected_score = trell->ending_viterbi_log_prob();
-    paths_[gene][kset] = TracebackPath(hmms_.Get(gene));
-    if(uncorrected_score != -INFINITY)   // if there's a valid path
-      trell->Traceback(paths_[gene][kset]);
+    *path = TracebackPath(hmms_.Get(gene, overall_mute_freq_));
+    if(trell->ending_viterbi_log_prob() != -INFINITY)   // if there's a valid path
+      trell->Traceback(*path);
+    return trell->ending_viterbi_log_prob();
   } else if(algorithm_ == "forward") {
     trell->Forward();
-    uncorrected_score = trell->ending_forward_log_prob();
+    return trell->ending_forward_log_prob();
   } else {
     assert(0);
   }
+}
 
-  // correct the score for gene choice probs
-  double gene_choice_score = log(hmms_.Get(gene)->overall_prob());
-  scores_[gene][kset] = AddWithMinusInfinities(uncorrected_score, gene_choice_score);
+// ----------------------------------------------------------------------------------------
+// rerun <query_seqs> from scratch in whichever precision we *didn't* use, and keep track of how far apart they are
+void DPHandler::ValidateFloatDP(SequencesView &query_seqs, string gene, double uncorrected_score, TracebackPath *path) {
+  TracebackPath other_path;
+  double other_score;
+  if(args_->float_dp()) {
+    Trellis trell(hmms_.Get(gene, overall_mute_freq_), query_seqs);
+    trell.SetScaledForward(args_->scaled_forward());
+    other_score = RunTrellis(&trell, gene, &other_path);
+  } else {
+    FloatTrellis trell(hmms_.Get(gene, overall_mute_freq_), query_seqs);
+    trell.SetScaledForward(args_->scaled_forward());
+    other_score = RunTrellis(&trell, gene, &other_path);
+  }
+
+  ++n_float_validations_;
+  if(uncorrected_score != other_score)  // NOTE if only one of them is -INFINITY, the deviation is infinite
+    max_float_deviation_ = max(max_float_deviation_, fabs(uncorrected_score - other_score));
+  if(path != nullptr && path->name_vector() != other_path.name_vector())
+    ++n_float_path_mismatches_;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -276,7 +573,7 @@ void DPHandler::PrintPath(KSet kset, vector<string> query_strs, string gene, dou
     // cout << "                    " << gene << " " << score << endl;
     return;
   }
-  vector<string> path_names = paths_[gene][kset].name_vector();
+  vector<string> path_names = FindRegionResult(gl_.GetRegion(gene), gene, kset, query_strs[0].size())->path->name_vector();
   if(path_names.size() == 0) {
     if(args_->debug()) cout << "                     " << gene << " has no valid path" << endl;
     return;
@@ -294,7 +591,7 @@ void DPHandler::PrintPath(KSet kset, vector<string> query_strs, string gene, dou
   TermColors tc;
 
   // make a string for the germline match
-  string germline(gl_.seqs_[gene]);
+  string germline(gl_.seqs_.at(gene));
   string modified_germline = germline.substr(left_erosion_length, germline.size() - right_erosion_length - left_erosion_length);  // remove deletions
   modified_germline = left_insert + modified_germline + right_insert;  // add insertions to either end
   assert(modified_germline.size() == query_strs[0].size());
@@ -332,7 +629,7 @@ RecoEvent DPHandler::FillRecoEvent(Sequences &seqs, KSet kset, map<string, strin
     }
     assert(best_genes.find(region) != best_genes.end());
     string gene(best_genes[region]);
-    vector<string> path_names = paths_[gene][kset].name_vector();
+    vector<string> path_names = FindRegionResult(region, gene, kset, query_strs[0].size())->path->name_vector();
     if(path_names.size() == 0) {
       if(args_->debug()) cout << "                     " << gene << " has no valid path" << endl;
       event.SetScore(-INFINITY);
@@ -363,45 +660,146 @@ RecoEvent DPHandler::FillRecoEvent(Sequences &seqs, KSet kset, map<string, strin
 
 // ----------------------------------------------------------------------------------------
 vector<string> DPHandler::GetQueryStrs(Sequences &seqs, KSet kset, string region) {
-  Sequences query_seqs(GetSubSeqs(seqs, kset, region));
+  SequencesView query_seqs(GetSubSeqs(seqs, kset, region));
   vector<string> query_strs;
   for(size_t iseq = 0; iseq < seqs.n_seqs(); ++iseq)
-    query_strs.push_back(query_seqs[iseq].undigitized());
+    query_strs.push_back(query_seqs.undigitized(iseq));
   return query_strs;
 }
 
 // ----------------------------------------------------------------------------------------
-KSet DPHandler::FindPartialCacheMatch(string region, string gene, KSet kset) {
-  // this is just to avoid having to store all the query string vectors (they get big)
-  if(scores_[gene].find(kset) != scores_[gene].end())  // the exact same kset shouldn't actually be in there (except maybe if we're rerunning with expanded boundaries?) but I think we may as well check
-    return kset;
-  if(region == "v") {
-    for(auto &kv : scores_[gene]) {  // kv: (KSet, double)
-      if(kv.first.v == kset.v)  // for v, we just need k_v to be the same
-	return kv.first;
-    }
-  } else if(region == "j") {
-    for(auto &kv : scores_[gene]) {  // kv: (KSet, double)
-      if(kv.first.v + kv.first.d == kset.v + kset.d)  // for j, we need k_v and k_d to sum to the same thing
-	return kv.first;
+// Within one Run() each region's subsequence is determined by where it starts and how long it is, so e.g. all the ksets with the same k_v share
+// their v result, and all the ones with the same k_v + k_d share their j result.
+uint64_t DPHandler::RegionKey(string region, KSet kset, size_t length) {
+  uint64_t start(0);
+  if(region == "d")
+    start = kset.v;
+  else if(region == "j")
+    start = kset.v + kset.d;
+  return (start << 32) | length;
+}
+
+// ----------------------------------------------------------------------------------------
+DPHandler::RegionResult *DPHandler::FindRegionResult(string region, string gene, KSet kset, size_t length) {
+  unordered_map<uint64_t, RegionResult> &results(region_results_.at(gene));  // NOTE not operator[], since we're called from several threads at once (see FillRegionResults())
+  auto it(results.find(RegionKey(region, kset, length)));
+  return it == results.end() ? nullptr : &it->second;
+}
+
+// ----------------------------------------------------------------------------------------
+DPHandler::RegionResult &DPHandler::AddRegionResult(string region, string gene, KSet kset, size_t length) {
+  RegionResult &result(region_results_.at(gene)[RegionKey(region, kset, length)]);  // NOTE references into an unordered_map stay valid when it rehashes
+  result.score = -INFINITY;
+  if(algorithm_ == "viterbi")
+    result.path = make_shared<TracebackPath>();
+  return result;
+}
+
+// ----------------------------------------------------------------------------------------
+// Score each gene with the quantized viterbi filter on every subsequence RunKSet() could give it, and remove all but the
+// args_->viterbi_filter_n_best() best ones in each region from <only_genes>. Each filter pass covers every kset that shares a start position.
+void DPHandler::FilterGenes(Sequences &seqs, KBounds kbounds, map<string, set<string> > &only_genes) {
+  // the (start, length) of each region's subsequence for each kset that we'll actually run
+  map<string, set<pair<size_t, size_t> > > chunks;
+  for(size_t k_v = kbounds.vmin; k_v < kbounds.vmax; ++k_v) {
+    for(size_t k_d = kbounds.dmin; k_d < kbounds.dmax; ++k_d) {
+      if(k_v + k_d >= seqs.GetSequenceLength())
+        continue;
+      chunks["v"].insert(pair<size_t, size_t>(0, k_v));  // see GetSubSeqs()
+      chunks["d"].insert(pair<size_t, size_t>(k_v, k_d));
+      chunks["j"].insert(pair<size_t, size_t>(k_v + k_d, seqs.GetSequenceLength() - k_v - k_d));
     }
   }
 
-  return KSet(0, 0);
+  for(auto &region : gl_.regions_) {
+    if(only_genes[region].size() <= (size_t)args_->viterbi_filter_n_best())
+      continue;
+    map<size_t, size_t> max_lengths;  // longest subsequence we need from each start position
+    for(auto &chunk : chunks[region])
+      max_lengths[chunk.first] = max(max_lengths[chunk.first], chunk.second);
+
+    vector<pair<double, string> > gene_scores;
+    string saturated_gene;  // a gene whose best score saturated (if there are any)
+    for(auto &gene : only_genes[region]) {
+      double best_score(-INFINITY);
+      bool saturated(false);  // did any subsequence come out -INFINITY only because it saturated?
+      for(auto &kv : max_lengths) {
+        ViterbiFilter filter(hmms_.Get(gene, overall_mute_freq_), SequencesView(seqs, kv.first, kv.second));
+        filter.Run();
+        for(auto it = chunks[region].lower_bound(pair<size_t, size_t>(kv.first, 0)); it != chunks[region].end() && it->first == kv.first; ++it) {
+          double score(filter.ending_log_prob(it->second));
+          saturated = saturated || (score == -INFINITY && filter.saturated(it->second));
+          best_score = max(best_score, score);
+        }
+      }
+      if(best_score == -INFINITY && saturated)
+	saturated_gene = gene;
+      gene_scores.push_back(pair<double, string>(AddWithMinusInfinities(best_score, log(hmms_.Get(gene, overall_mute_freq_)->overall_prob())), gene));
+    }
+    // The int16 scores saturate at about -1000 (see QuantizeLogProb()), which e.g. a v region with ten or so sequences easily gets below. We
+    // can't rank a gene whose every subsequence saturated, so if there's one we run all of them. Genes that really have no path (e.g. a d or j
+    // that none of the chunk lengths fit) are just -INFINITY, so they sort to the end.
+    if(saturated_gene != "") {
+      if(args_->debug() == 2)
+	printf("      viterbi filter saturated for %s in %s, so keeping all %zu genes\n", saturated_gene.c_str(), region.c_str(), gene_scores.size());
+      continue;
+    }
+
+    stable_sort(gene_scores.begin(), gene_scores.end(), [](const pair<double, string> &lhs, const pair<double, string> &rhs) { return lhs.first > rhs.first; });
+    only_genes[region].clear();
+    for(size_t igene = 0; igene < (size_t)args_->viterbi_filter_n_best(); ++igene)
+      only_genes[region].insert(gene_scores[igene].second);
+    if(args_->debug() == 2)
+      printf("      viterbi filter kept %d of %zu %s genes (cutoff %.2f)\n", args_->viterbi_filter_n_best(), gene_scores.size(), region.c_str(), gene_scores[args_->viterbi_filter_n_best() - 1].first);
+  }
 }
 
 // ----------------------------------------------------------------------------------------
 void DPHandler::InitCache(string gene) {
-  if(scores_.find(gene) == scores_.end()) {
-    scratch_cachefo_[gene] = map<vector<string>, Trellis>();
-    paths_[gene] = map<KSet, TracebackPath>();
-    scores_[gene] = map<KSet, double>();
+  if(region_results_.find(gene) == region_results_.end()) {
+    scratch_cachefo_[gene].Clear();
+    float_scratch_cachefo_[gene].Clear();
+    region_results_[gene] = unordered_map<uint64_t, RegionResult>();
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Fill in (or find in the cache) the result for each of <genes> on <region>'s query sequences, on <thread_pool_> if we have one. Each gene only
+// touches its own entries in the per-gene caches, so we create those first, and the threads never insert into any of the maps themselves.
+void DPHandler::FillRegionResults(string region, KSet kset, SequencesView &query_seqs, vector<string> &query_strs, vector<string> &genes, vector<RegionResult*> &results, vector<string> &origins) {
+  for(auto &gene : genes) {
+    InitCache(gene);
+    hmms_.Get(gene, overall_mute_freq_);  // make sure it's read from disk (and rescaled)
+  }
+  auto fill_gene = [&](size_t igene) {
+    string &gene(genes[igene]);
+    RegionResult *result(FindRegionResult(region, gene, kset, query_seqs.GetSequenceLength()));  // only this region's query sequence(s) need to be the same
+    if(result != nullptr) {  // first see if we have a match for these exact strings
+      // NOTE that we don't put anything about this gene/kset combo into the trellis caches. Which is fine now, since later we'll only need the path and score info
+      origins[igene] = "cached";
+    } else if(region == "j" && suffix_trellises_.count(gene) > 0) {
+      result = &FillFromSuffixTrellis(kset, gene, origins[igene]);
+    } else {  // no exact cache match, so proceed to check for chunk caching (if that fails it'll actually calculate things)
+      result = &FillTrellis(region, kset, query_seqs, query_strs, gene, origins[igene]);
+    }
+    results[igene] = result;
+  };
+
+  if(thread_pool_ == nullptr) {
+    for(size_t igene = 0; igene < genes.size(); ++igene)
+      fill_gene(igene);
+    return;
   }
+  Arena *arena(Arena::current());  // the workers allocate from our caller's arena, so everything this DPHandler caches gets rewound together in Clear() (rather than pinning blocks in the workers' own arenas, which are shared with every other DPHandler that uses the pool)
+  thread_pool_->ParallelFor(genes.size(), [&](size_t igene) {
+      ArenaScope arena_scope(arena);
+      fill_gene(igene);
+    });
 }
 
 // ----------------------------------------------------------------------------------------
 void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes) {
-  map<string, Sequences> subseqs(GetSubSeqs(seqs, kset));
+  map<string, SequencesView> subseqs(GetSubSeqs(seqs, kset));
   (*best_scores)[kset] = -INFINITY;
   (*total_scores)[kset] = -INFINITY;  // total log prob of this kset, i.e. log(P_v * P_d * P_j), where e.g. P_v = \sum_i P(v_i k_v)
   (*best_genes)[kset] = map<string, string>();
@@ -430,20 +828,19 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
 
     regional_best_scores[region] = -INFINITY;
     regional_total_scores[region] = -INFINITY;
-    for(auto & gene : only_genes[region]) {
-      InitCache(gene);
-      string origin;
-      KSet partial_cache_match(FindPartialCacheMatch(region, gene, kset));  // "partial" in the sense that only this region's query sequence(s) need to be the same
-      if(!partial_cache_match.isnull()) {  // first see if we have a match for these exact strings
-	paths_[gene][kset] = paths_[gene][partial_cache_match];
-	scores_[gene][kset] = scores_[gene][partial_cache_match];
-	// NOTE that we don't put anything about this gene/kset combo into the trellis caches. Which is fine now, since later we'll only need the path and score info
-	origin = "cached";
-      } else {  // no exact cache match, so proceed to check for chunk caching (if that fails it'll actually calculate things)
-	FillTrellis(kset, subseqs[region], query_strs, gene, origin);
-      }
-
-      double gene_score(scores_[gene][kset]);  // convenience variable
+    if(algorithm_ == "viterbi" && args_->allele_trie())
+      FillTrieTrellises(region, kset, subseqs[region], query_strs, only_genes[region]);
+    if(algorithm_ == "viterbi" && args_->lockstep_genes())
+      FillLockstepTrellises(region, kset, subseqs[region], query_strs, only_genes[region]);
+    if(algorithm_ == "viterbi" && batch_seqs_.size() > 1)
+      FillBatchTrellises(region, kset, subseqs[region], query_strs, only_genes[region]);
+    vector<string> genes(only_genes[region].begin(), only_genes[region].end());
+    vector<RegionResult*> results(genes.size(), nullptr);
+    vector<string> origins(genes.size());
+    FillRegionResults(region, kset, subseqs.at(region), query_strs, genes, results, origins);
+    for(size_t igene = 0; igene < genes.size(); ++igene) {  // then add them up in the same order whether we used threads or not
+      string &gene(genes[igene]), &origin(origins[igene]);
+      double gene_score(results[igene]->score);  // convenience variable
       if(args_->debug() == 2 && algorithm_ == "viterbi")
         PrintPath(kset, query_strs, gene, gene_score, origin);
 
@@ -547,7 +944,7 @@ string DPHandler::GetInsertion(string side, vector<string> names) {
 size_t DPHandler::GetErosionLength(string side, vector<string> names, string gene_name) {
   // NOTE this does *not* count a bunch of Ns at the end as an erosion, that interpretation is made in partitiondriver.py
 
-  string germline(gl_.seqs_[gene_name]);
+  string germline(gl_.seqs_.at(gene_name));
 
   // first check if we eroded the entire sequence. If so we can't say how much was left and how much was right, so just (integer) divide by two (arbitrarily giving one side the odd base if necessary)
   bool its_inserts_all_the_way_down(true);
@@ -602,7 +999,7 @@ size_t DPHandler::GetErosionLength(string side, vector<string> names, string gen
   if(side == "left") {
     length = state_index;
   } else if(side == "right") {
-    size_t germline_length = gl_.seqs_[gene_name].size();
+    size_t germline_length = gl_.seqs_.at(gene_name).size();
     length = germline_length - state_index - 1;
   } else {
     assert(0);
@@ -38,6 +38,18 @@ void Emission::Parse(YAML::Node config, Track *track) {
   scores_.SetLogProbs(log_probs);  // NOTE <log_probs> must already be logged
 }
 
+// ----------------------------------------------------------------------------------------
+void Emission::Init(Track *track, vector<double> log_probs) {
+  track_ = track;
+  scores_.Init(track_);
+  if(log_probs.size() != track_->alphabet_size())
+    throw runtime_error("ERROR emission log probs (" + to_string(log_probs.size()) + ") not the same length as the alphabet (" + to_string(track_->alphabet_size()) + ")");
+  total_ = 0.0;
+  for(auto &log_prob : log_probs)
+    total_ += exp(log_prob);
+  scores_.SetLogProbs(log_probs);
+}
+
 // ----------------------------------------------------------------------------------------
 void Emission::Print() {
   cout << "    " << track_->name() << "     (normed to within at least " << EPS << ")" << endl;
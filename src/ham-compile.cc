@@ -0,0 +1,68 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "bcrutils.h"
+#include "bundle.h"
+#include "tclap/CmdLine.h"
+
+using namespace TCLAP;
+using namespace ham;
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+// Write the germline info for one locus, plus the hmm for each of its genes that has one in the hmm dir, to a bundle that bcrham can read
+// with --hmm-bundle (see bundle.h).
+int main(int argc, const char *argv[]) {
+  ValueArg<string> hmmdir_arg("", "hmmdir", "directory in which to look for hmm model files", true, "", "string");
+  ValueArg<string> datadir_arg("", "datadir", "directory in which to look for non-sample-specific data (eg human germline seqs)", true, "", "string");
+  ValueArg<string> locus_arg("", "locus", "ig{h,k,l} or tr{a,b,g,d}", true, "", "string");
+  ValueArg<string> outfile_arg("o", "outfile", "output bundle file", true, "", "string");
+  try {
+    CmdLine cmd("ham-compile -- write hmms and germline info to a bundle for bcrham", ' ', "");
+    cmd.add(hmmdir_arg);
+    cmd.add(datadir_arg);
+    cmd.add(locus_arg);
+    cmd.add(outfile_arg);
+    cmd.parse(argc, argv);
+  } catch(ArgException &e) {
+    cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
+    throw;
+  }
+
+  GermLines gl(datadir_arg.getValue(), locus_arg.getValue());
+
+  BundleWriter out;
+  out.Bytes(kBundleMagic, sizeof(kBundleMagic));
+  out.U32(kBundleVersion);
+  out.U32(kBundleByteOrder);
+  size_t index_offset_pos(out.size());
+  out.U64(0);  // index offset, which we fill in at the end
+  gl.Write(out);
+
+  vector<pair<string, pair<uint64_t, uint64_t> > > index;  // gene, and the offset and size of its record
+  for(auto &region : gl.regions_) {
+    for(auto &gene : gl.names_[region]) {
+      string infname(hmmdir_arg.getValue() + "/" + gl.SanitizeName(gene) + ".yaml");
+      if(!ifstream(infname))
+	continue;
+      Model hmm;
+      hmm.Parse(infname);
+      size_t offset(out.size());
+      hmm.Write(out);
+      index.push_back(pair<string, pair<uint64_t, uint64_t> >(gene, pair<uint64_t, uint64_t>(offset, out.size() - offset)));
+    }
+  }
+
+  out.SetU64(index_offset_pos, out.size());
+  out.U64(index.size());
+  for(auto &entry : index) {
+    out.String(entry.first);
+    out.U64(entry.second.first);
+    out.U64(entry.second.second);
+  }
+  out.Write(outfile_arg.getValue());
+  cout << "    wrote " << index.size() << " hmms for " << gl.locus_ << " to " << outfile_arg.getValue() << " (" << out.size() << " bytes)" << endl;
+  return 0;
+}
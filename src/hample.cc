@@ -1,9 +1,16 @@
 #include <iostream>
 #include <fstream>
+#include <random>
 
 #include "model.h"
 #include "trellis.h"
 #include "text.h"
+#include "simdkernels.h"
+#include "viterbifilter.h"
+#include "batchtrellis.h"
+#include "trietrellis.h"
+#include "suffixtrellis.h"
+#include "trelliscache.h"
 #include "tclap/CmdLine.h"
 
 using namespace ham;
@@ -12,6 +19,17 @@ using namespace std;
 
 // ----------------------------------------------------------------------------------------
 void CheckChunkCaching(Model &hmm, Trellis &trellis, Sequences seqs);  // for checking with scons test, ignore if you're not scons
+void CheckKernels(Model &hmm, Sequences seqs);  // same
+void CheckGenericKernels(Model &hmm, Sequences seqs);  // same
+void CheckLogSumExp();  // same
+void CheckFloat(Model &hmm, Trellis &trellis, Sequences seqs, bool scaled_forward);  // same
+void CheckViterbiFilter(Model &hmm, Sequences seqs);  // same
+void CheckBatchTrellis(string hmmfname, Model &hmm, Sequences seqs);  // same
+void CheckAlleleTrie(string hmmfname, Model &hmm, Sequences seqs);  // same
+void CheckSuffixTrellis(Model &hmm, Sequences seqs);  // same
+void CheckTrellisCache();  // same
+void CheckLargeModel();  // same
+void RotateValues(YAML::Node node);
 
 // ----------------------------------------------------------------------------------------
 int main(int argc, const char *argv[]) {
@@ -20,17 +38,29 @@ int main(int argc, const char *argv[]) {
   ValueArg<string> hmmfname_arg("f", "hmmfname", "hmm (.yaml) model file", true, "", "string");
   ValueArg<string> seqs_arg("s", "seqs", "colon-separated list of sequences", true, "", "string");
   ValueArg<string> outfile_arg("o", "outfile", "output text file", false, "", "string");
+  ValueArg<int> checkpoint_interval_arg("", "checkpoint-interval", "if nonzero, keep only every nth viterbi dp table column and recompute the traceback from these (if negative, use roughly sqrt(sequence length))", false, 0, "int");
+  SwitchArg fast_log_sum_exp_arg("", "fast-log-sum-exp", "add log probs with a lookup table rather than log() and exp()", false);
+  SwitchArg scaled_forward_arg("", "scaled-forward", "run forward with rescaled plain probabilities rather than log probs", false);
+  ValueArg<string> simd_arg("", "simd", "instruction set for the vectorized dp kernels: auto, scalar, sse4, avx2, or avx512", false, "auto", "string");
   try {
     CmdLine cmd("ham -- the fantabulous HMM compiler", ' ', "");
     cmd.add(hmmfname_arg);
     cmd.add(seqs_arg);
     cmd.add(outfile_arg);
+    cmd.add(checkpoint_interval_arg);
+    cmd.add(simd_arg);
+    cmd.add(fast_log_sum_exp_arg);
+    cmd.add(scaled_forward_arg);
     cmd.parse(argc, argv);
   } catch(ArgException &e) {
     cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
     throw;
   }
 
+  SetSimdLevel(simd_arg.getValue());
+  if(fast_log_sum_exp_arg.getValue())
+    SetLogSumExpMode(kFastLogSumExp);
+
   // read hmm model file
   Model hmm;
   hmm.Parse(hmmfname_arg.getValue());
@@ -43,6 +73,8 @@ int main(int argc, const char *argv[]) {
 
   // make the trellis, a wrapper for holding the DP tables and running the algorithms
   Trellis trell(&hmm, seqs);
+  trell.SetCheckpointInterval(checkpoint_interval_arg.getValue());
+  trell.SetScaledForward(scaled_forward_arg.getValue());
   trell.Viterbi();
   TracebackPath path(&hmm);
   trell.Traceback(path);
@@ -67,6 +99,16 @@ int main(int argc, const char *argv[]) {
     ofs.close();
   }
   CheckChunkCaching(hmm, trell, seqs);
+  CheckKernels(hmm, seqs);
+  CheckGenericKernels(hmm, seqs);
+  CheckLogSumExp();
+  CheckFloat(hmm, trell, seqs, scaled_forward_arg.getValue());
+  CheckViterbiFilter(hmm, seqs);
+  CheckBatchTrellis(hmmfname_arg.getValue(), hmm, seqs);
+  CheckAlleleTrie(hmmfname_arg.getValue(), hmm, seqs);
+  CheckSuffixTrellis(hmm, seqs);
+  CheckTrellisCache();
+  CheckLargeModel();
 }
 
 // ----------------------------------------------------------------------------------------
@@ -108,3 +150,483 @@ void CheckChunkCaching(Model &hmm, Trellis &trell, Sequences seqs) {
   }
   cout << "caching ok!" << endl;
 }
+
+// ----------------------------------------------------------------------------------------
+// check that the vectorized kernels for each instruction set this cpu supports agree with the scalar ones (just for use by `scons test`)
+void CheckKernels(Model &hmm, Sequences seqs) {
+  SimdLevel original_level(simd_level());
+  SetSimdLevel(kScalar);
+  Trellis scalar_trell(&hmm, seqs);
+  scalar_trell.Viterbi();
+  TracebackPath scalar_path(&hmm);
+  scalar_trell.Traceback(scalar_path);
+  scalar_trell.Forward();
+
+  double max_deviation(0.);
+  for(int level = kSSE4; level <= DetectSimdLevel(); ++level) {
+    SetSimdLevel(SimdLevel(level));
+    Trellis trell(&hmm, seqs);
+    trell.Viterbi();
+    TracebackPath path(&hmm);
+    trell.Traceback(path);
+    trell.Forward();
+
+    // viterbi should be exactly the same...
+    if(trell.ending_viterbi_log_prob() != scalar_trell.ending_viterbi_log_prob())
+      throw runtime_error("ERROR " + SimdLevelName(SimdLevel(level)) + " kernels didn't give the same viterbi log prob: " + to_string(trell.ending_viterbi_log_prob()) + " " + to_string(scalar_trell.ending_viterbi_log_prob()));
+    assert(path.size() == scalar_path.size());
+    for(size_t ipos = 0; ipos < path.size(); ++ipos) {
+      if(path[ipos] != scalar_path[ipos])
+        throw runtime_error("ERROR " + SimdLevelName(SimdLevel(level)) + " kernels didn't give the same viterbi path");
+    }
+
+    // ...whereas forward can be off by a few ulps
+    double forward_val(trell.ending_forward_log_prob()), scalar_forward_val(scalar_trell.ending_forward_log_prob());
+    if(forward_val == scalar_forward_val)
+      continue;
+    double deviation(fabs(forward_val - scalar_forward_val));
+    max_deviation = max(deviation, max_deviation);
+    if(deviation > 1e-12 * max(1., fabs(scalar_forward_val)))
+      throw runtime_error("ERROR " + SimdLevelName(SimdLevel(level)) + " kernels didn't give the same forward log prob: " + to_string(forward_val) + " " + to_string(scalar_forward_val));
+  }
+  SetSimdLevel(original_level);
+  cout << "kernels ok (up to " << SimdLevelName(DetectSimdLevel()) << ", max forward deviation " << max_deviation << ")" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that, for chain models, the scalar chain kernels give exactly the same answers as running the same model through the generic kernels (just for use by `scons test`)
+void CheckGenericKernels(Model &hmm, Sequences seqs) {
+  if(!hmm.compiled()->is_chain())
+    return;
+  SimdLevel original_level(simd_level());
+  SetSimdLevel(kScalar);
+  Trellis chain_trell(&hmm, seqs);
+  chain_trell.Viterbi();
+  TracebackPath chain_path(&hmm);
+  chain_trell.Traceback(chain_path);
+  chain_trell.Forward();
+  SetSimdLevel(original_level);
+
+  Trellis trell(&hmm, seqs);
+  trell.UseGenericKernels();
+  trell.Viterbi();
+  TracebackPath path(&hmm);
+  trell.Traceback(path);
+  trell.Forward();
+
+  if(trell.ending_viterbi_log_prob() != chain_trell.ending_viterbi_log_prob())
+    throw runtime_error("ERROR chain kernels didn't give the same viterbi log prob as the generic ones: " + to_string(chain_trell.ending_viterbi_log_prob()) + " " + to_string(trell.ending_viterbi_log_prob()));
+  if(!(path == chain_path))
+    throw runtime_error("ERROR chain kernels didn't give the same viterbi path as the generic ones");
+  if(trell.ending_forward_log_prob() != chain_trell.ending_forward_log_prob())
+    throw runtime_error("ERROR chain kernels didn't give the same forward log prob as the generic ones: " + to_string(chain_trell.ending_forward_log_prob()) + " " + to_string(trell.ending_forward_log_prob()));
+  cout << "generic kernels ok" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that the fast log(1 + exp(-d)) is as accurate as we claim, and that LogSumExp() agrees with adding things up one at a time (just for use by `scons test`)
+void CheckLogSumExp() {
+  double max_error(0.);
+  for(double d = 0.; d < 50.; d += 0.000377) {
+    double error(fabs(FastLog1pExp(d) - log1p(exp(-d))));
+    if(error > kFastLog1pExpMaxError)
+      throw runtime_error("ERROR fast log1p(exp(-d)) off by " + to_string(error) + " at d = " + to_string(d));
+    max_error = max(error, max_error);
+  }
+
+  vector<double> vals {-3.2, -INFINITY, -0.7, -41.5, -1.1, -700., -0.7};
+  double total(-INFINITY);
+  for(auto &val : vals)
+    total = AddInLogSpace(val, total);
+  double tolerance(1e-12 + (log_sum_exp_mode() == kFastLogSumExp ? vals.size() * kFastLog1pExpMaxError : 0.));  // each AddInLogSpace() call can be off by up to kFastLog1pExpMaxError in fast mode
+  if(fabs(LogSumExp(vals.data(), vals.size()) - total) > tolerance)
+    throw runtime_error("ERROR LogSumExp() gave " + to_string(LogSumExp(vals.data(), vals.size())) + " but expected " + to_string(total));
+  vector<double> empty_vals {-INFINITY, -INFINITY};
+  if(LogSumExp(empty_vals.data(), empty_vals.size()) != -INFINITY)
+    throw runtime_error("ERROR LogSumExp() of all -INFINITY wasn't -INFINITY");
+  cout << "log sum exp ok (max fast error " << max_error << ")" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that single-precision dp gives about the same log probs as <trell> (which has already run both algorithms), and report how far off it is (just for use by `scons test`)
+void CheckFloat(Model &hmm, Trellis &trell, Sequences seqs, bool scaled_forward) {
+  FloatTrellis float_trell(&hmm, seqs);
+  float_trell.SetScaledForward(scaled_forward);
+  float_trell.Viterbi();
+  TracebackPath float_path(&hmm);
+  float_trell.Traceback(float_path);
+  float_trell.Forward();
+  TracebackPath path(&hmm);
+  trell.Traceback(path);
+
+  double max_deviation(0.);
+  vector<pair<double, double> > vals {{trell.ending_viterbi_log_prob(), float_trell.ending_viterbi_log_prob()}, {trell.ending_forward_log_prob(), float_trell.ending_forward_log_prob()}};
+  for(auto &vpair : vals) {
+    if(vpair.first == vpair.second)
+      continue;
+    double deviation(fabs(vpair.first - vpair.second));
+    if(deviation > 1e-4 * max(1., fabs(vpair.first)))
+      throw runtime_error("ERROR float dp gave log prob " + to_string(vpair.second) + " but double gave " + to_string(vpair.first));
+    max_deviation = max(deviation, max_deviation);
+  }
+  cout << "float ok (max deviation " << max_deviation << ", viterbi paths " << (path == float_path ? "agree" : "differ") << ")" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that the quantized viterbi filter is within its rounding error of the real viterbi log prob at every length, and that it only loses a
+// path when it says it saturated, e.g. on enough copies of <seqs> (just for use by `scons test`)
+void CheckViterbiFilter(Model &hmm, Sequences seqs) {
+  Trellis trell(&hmm, seqs);
+  trell.Viterbi();
+  ViterbiFilter filter(&hmm, seqs);
+  filter.Run();
+  double max_deviation(0.);
+  for(size_t length = 1; length <= seqs.GetSequenceLength(); ++length) {
+    double exact_val(trell.ending_viterbi_log_prob(length)), filter_val(filter.ending_log_prob(length));
+    if(exact_val == -INFINITY || filter_val == -INFINITY) {
+      if(exact_val != filter_val)
+        throw runtime_error("ERROR viterbi filter gave " + to_string(filter_val) + " but viterbi gave " + to_string(exact_val) + " for length " + to_string(length));
+      if(filter.saturated(length))
+        throw runtime_error("ERROR viterbi filter says it saturated for length " + to_string(length) + ", but viterbi has no path");
+      continue;
+    }
+    double deviation(fabs(filter_val - exact_val));
+    if(deviation > (2 * length + 1) * 0.5 / kQuantizedScale)  // at most one rounding per table lookup
+      throw runtime_error("ERROR viterbi filter gave " + to_string(filter_val) + " but viterbi gave " + to_string(exact_val) + " for length " + to_string(length));
+    max_deviation = max(deviation, max_deviation);
+  }
+
+  Sequences copies;  // enough copies of the first sequence that the best path is well below where the int16 scores saturate
+  size_t length(seqs.GetSequenceLength());
+  double copies_log_prob(0.);
+  while(copies_log_prob > -1100.) {
+    for(size_t iseq = max((size_t)1, copies.n_seqs()); iseq > 0; --iseq)  // double the number of copies
+      copies.AddSeq(seqs[0]);
+    Trellis copies_trell(&hmm, copies);
+    copies_trell.Viterbi();
+    copies_log_prob = copies_trell.ending_viterbi_log_prob();
+  }
+  ViterbiFilter copies_filter(&hmm, copies);
+  copies_filter.Run();
+  if(copies_log_prob == -INFINITY || copies_filter.ending_log_prob(length) != -INFINITY || !copies_filter.saturated(length))
+    throw runtime_error("ERROR viterbi filter gave " + to_string(copies_filter.ending_log_prob(length)) + (copies_filter.saturated(length) ? " (saturated)" : " (not saturated)") + " for " + to_string(copies.n_seqs()) + " copies of the first sequence, but viterbi gave " + to_string(copies_log_prob));
+  cout << "viterbi filter ok (max deviation " << max_deviation << ", saturated with " << copies.n_seqs() << " copies)" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that running each of <seqs> (plus their reverses and rotations, so we have a few lanes) in one batch trellis, and then each of them
+// against <hmm> and a copy with all its probabilities shuffled (but the same topology) in another, gives exactly the same log probs and paths
+// as running them one at a time (just for use by `scons test`)
+void CheckBatchTrellis(string hmmfname, Model &hmm, Sequences seqs) {
+  vector<Sequence> batch_seqs;
+  for(size_t iseq = 0; iseq < seqs.n_seqs(); ++iseq) {
+    string seqstr(seqs[iseq].undigitized());
+    batch_seqs.push_back(Sequence(hmm.track(), "seq", seqstr));
+    string reversed(seqstr.rbegin(), seqstr.rend());
+    batch_seqs.push_back(Sequence(hmm.track(), "reversed", reversed));
+    string rotated(seqstr.substr(seqstr.size() / 3) + seqstr.substr(0, seqstr.size() / 3));
+    batch_seqs.push_back(Sequence(hmm.track(), "rotated", rotated));
+  }
+
+  BatchTrellis batch_trell(&hmm, batch_seqs);
+  batch_trell.Viterbi();
+  for(size_t ilane = 0; ilane < batch_seqs.size(); ++ilane) {
+    Sequences lane_seqs;
+    lane_seqs.AddSeq(batch_seqs[ilane]);
+    Trellis trell(&hmm, lane_seqs);
+    trell.Viterbi();
+    TracebackPath path(&hmm), batch_path(&hmm);
+    trell.Traceback(path);
+    batch_trell.Traceback(ilane, batch_path);
+    if(batch_trell.ending_viterbi_log_prob(ilane) != trell.ending_viterbi_log_prob())
+      throw runtime_error("ERROR batch trellis gave viterbi log prob " + to_string(batch_trell.ending_viterbi_log_prob(ilane)) + " but trellis gave " + to_string(trell.ending_viterbi_log_prob()) + " for lane " + to_string(ilane));
+    if(!(batch_path == path))
+      throw runtime_error("ERROR batch trellis gave a different viterbi path for lane " + to_string(ilane));
+  }
+
+  YAML::Node config(YAML::LoadFile(hmmfname));
+  for(size_t ist = 0; ist < config["states"].size(); ++ist) {
+    YAML::Node state(config["states"][ist]);
+    if(state["emissions"])
+      RotateValues(state["emissions"]["probs"]);
+    if(state["transitions"])
+      RotateValues(state["transitions"]);
+  }
+  Model shuffled;
+  shuffled.Parse(config, hmmfname);
+  vector<Model*> hmms{&hmm, &shuffled};
+  size_t n_differing(0);
+  for(size_t iseq = 0; iseq < batch_seqs.size(); ++iseq) {
+    Sequences lane_seqs;
+    lane_seqs.AddSeq(batch_seqs[iseq]);
+    BatchTrellis model_trell(hmms, SequencesView(lane_seqs));
+    model_trell.Viterbi();
+    for(size_t ilane = 0; ilane < hmms.size(); ++ilane) {
+      Trellis trell(hmms[ilane], lane_seqs);
+      trell.Viterbi();
+      if(model_trell.ending_viterbi_log_prob(ilane) != trell.ending_viterbi_log_prob())
+	throw runtime_error("ERROR batch trellis gave viterbi log prob " + to_string(model_trell.ending_viterbi_log_prob(ilane)) + " but trellis gave " + to_string(trell.ending_viterbi_log_prob()) + " for " + batch_seqs[iseq].name() + " against lane " + to_string(ilane));
+      for(size_t position = 0; position < lane_seqs.GetSequenceLength(); ++position) {
+	if(model_trell.viterbi_log_prob(ilane, position) != trell.viterbi_log_probs_pointer()->at(position))
+	  throw runtime_error("ERROR batch trellis gave different chunk cache log probs for " + batch_seqs[iseq].name() + " against lane " + to_string(ilane));
+      }
+      if(trell.ending_viterbi_log_prob() == -INFINITY)
+	continue;
+      TracebackPath path(hmms[ilane]), batch_path(hmms[ilane]);
+      trell.Traceback(path);
+      model_trell.Traceback(ilane, batch_path);
+      if(!(batch_path == path))
+	throw runtime_error("ERROR batch trellis gave a different viterbi path for " + batch_seqs[iseq].name() + " against lane " + to_string(ilane));
+    }
+    if(model_trell.ending_viterbi_log_prob(0) != model_trell.ending_viterbi_log_prob(1))
+      ++n_differing;
+  }
+  if(n_differing == 0)
+    throw runtime_error("ERROR shuffling the probabilities didn't change any viterbi log probs, so the batch trellis model lanes aren't being checked");
+  cout << "batch trellis ok (" << batch_seqs.size() << " lanes, then " << batch_seqs.size() << " batches of " << hmms.size() << " models)" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that running <hmm>, an identical copy of it, and a copy with one of its later states' emissions perturbed on an allele trie (where they
+// share all the states before that one) gives exactly the same log probs and paths as running each of them on its own (just for use by `scons test`)
+void CheckAlleleTrie(string hmmfname, Model &hmm, Sequences seqs) {
+  if(!hmm.compiled()->is_chain())
+    return;
+  Model copy;
+  copy.Parse(hmmfname);
+  Trellis trell(&hmm, seqs);  // and another copy, with the emission probs rotated in the latest state that <hmm>'s viterbi path goes through (so it only shares the states before that one, and gets a different log prob)
+  trell.Viterbi();
+  TracebackPath path(&hmm);
+  trell.Traceback(path);
+  size_t last_state(0);
+  for(size_t ipos = 0; ipos < path.size(); ++ipos)
+    last_state = max(last_state, (size_t)path[ipos]);
+  YAML::Node config(YAML::LoadFile(hmmfname));
+  YAML::Node probs;
+  for(size_t ist = 0; ist < config["states"].size(); ++ist) {
+    if(config["states"][ist]["name"].as<string>() == hmm.state(last_state)->name())
+      probs = config["states"][ist]["emissions"]["probs"];
+  }
+  RotateValues(probs);
+  Model perturbed;
+  perturbed.Parse(config, hmmfname);
+
+  vector<string> genes{"original", "copy", "perturbed"};
+  vector<Model*> hmms{&hmm, &copy, &perturbed};
+  AlleleTrie trie(genes, hmms);
+  if(trie.n_nodes() < 2 || trie.n_node_states() >= 2 * hmm.n_states())
+    throw runtime_error("ERROR allele trie has " + to_string(trie.n_nodes()) + " nodes with " + to_string(trie.n_node_states()) + " states, but should have shared the states before the perturbed one");
+  if(trie.path(0) != trie.path(1) || trie.path(0) == trie.path(2))
+    throw runtime_error("ERROR allele trie didn't put the identical hmms (and only them) on the same path");
+
+  TrieTrellis trie_trell(&trie, seqs, {0, 1, 2});
+  trie_trell.Viterbi();
+  for(size_t igene = 0; igene < trie.n_genes(); ++igene) {
+    Trellis gene_trell(trie.hmm(igene), seqs);
+    gene_trell.Viterbi();
+    TracebackPath gene_path(trie.hmm(igene)), trie_path(trie.hmm(igene));
+    gene_trell.Traceback(gene_path);
+    trie_trell.Traceback(igene, trie_path);
+    if(trie_trell.ending_viterbi_log_prob(igene) != gene_trell.ending_viterbi_log_prob())
+      throw runtime_error("ERROR allele trie gave viterbi log prob " + to_string(trie_trell.ending_viterbi_log_prob(igene)) + " but trellis gave " + to_string(gene_trell.ending_viterbi_log_prob()) + " for " + trie.gene(igene));
+    for(size_t position = 0; position < seqs.GetSequenceLength(); ++position) {
+      if(trie_trell.viterbi_log_prob(igene, position) != gene_trell.viterbi_log_probs_pointer()->at(position))
+	throw runtime_error("ERROR allele trie gave different chunk cache log probs for " + trie.gene(igene));
+    }
+    if(!(trie_path == gene_path))
+      throw runtime_error("ERROR allele trie gave a different viterbi path for " + trie.gene(igene));
+  }
+  if(trie_trell.ending_viterbi_log_prob(2) == trie_trell.ending_viterbi_log_prob(0))
+    throw runtime_error("ERROR perturbing " + hmm.state(last_state)->name() + " didn't change the viterbi log prob, so the allele trie check isn't checking much");
+  cout << "allele trie ok (" << trie.n_nodes() << " nodes with " << trie.n_node_states() << " states for " << trie.n_genes() << " hmms with " << hmm.n_states() << " states each)" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that the suffix trellis gives the same log probs (up to rounding) and viterbi paths as running a trellis on each suffix (just for use by `scons test`)
+void CheckSuffixTrellis(Model &hmm, Sequences seqs) {
+  SuffixTrellis strell(&hmm, seqs);
+  strell.Viterbi();
+  strell.Forward();
+  double max_deviation(0.);
+  int n_compared(0);
+  for(size_t start = 0; start < seqs.GetSequenceLength(); ++start) {
+    Sequences subseqs(seqs, start, seqs.GetSequenceLength() - start);
+    Trellis trell(&hmm, subseqs);
+    trell.Viterbi();
+    trell.Forward();
+    if((trell.ending_viterbi_log_prob() == -INFINITY) != (strell.viterbi_log_prob(start) == -INFINITY) || (trell.ending_forward_log_prob() == -INFINITY) != (strell.forward_log_prob(start) == -INFINITY))
+      throw runtime_error("ERROR suffix trellis and trellis disagree about whether there's a valid path for the suffix starting at " + to_string(start));
+    if(trell.ending_viterbi_log_prob() == -INFINITY)
+      continue;
+    max_deviation = max(max_deviation, fabs(trell.ending_viterbi_log_prob() - strell.viterbi_log_prob(start)));
+    max_deviation = max(max_deviation, fabs(trell.ending_forward_log_prob() - strell.forward_log_prob(start)));
+    TracebackPath path(&hmm), suffix_path(&hmm);
+    trell.Traceback(path);
+    strell.Traceback(start, suffix_path);
+    if(!(suffix_path == path))
+      throw runtime_error("ERROR suffix trellis gave a different viterbi path for the suffix starting at " + to_string(start));
+    ++n_compared;
+  }
+  if(max_deviation > 1e-9)
+    throw runtime_error("ERROR suffix trellis log probs differ from trellis by up to " + to_string(max_deviation));
+  cout << "suffix trellis ok (" << n_compared << " suffixes, max deviation " << max_deviation << ")" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// shift each value in the yaml map <node> to the next key (wrapping around), e.g. to change an hmm's probabilities without changing its topology
+void RotateValues(YAML::Node node) {
+  vector<double> vals;
+  for(YAML::const_iterator it = node.begin(); it != node.end(); ++it)
+    vals.push_back(it->second.as<double>());
+  size_t ival(0);
+  for(YAML::iterator it = node.begin(); it != node.end(); ++it)
+    it->second = vals[++ival % vals.size()];
+}
+
+// ----------------------------------------------------------------------------------------
+// check that the trellis cache trie finds a chunk cache for exactly the same queries as the old linear search did (i.e. a cached query with
+// the same number of strings, each of which starts with the corresponding new one), on random queries with several interleaved sequences
+// (just for use by `scons test`). The "trellises" are just the cached query strings, so we can check what we get back.
+void CheckTrellisCache() {
+  mt19937 rng(1);
+  auto random_query = [&](size_t n_seqs, size_t length) {
+    vector<string> query_strs(n_seqs);
+    for(auto &query_str : query_strs) {
+      for(size_t ipos = 0; ipos < length; ++ipos)
+	query_str += "ACG"[rng() % 3];  // small alphabet, so lots of the queries share prefixes
+    }
+    return query_strs;
+  };
+
+  TrellisCache<vector<string> > cache;
+  vector<vector<string> > cached;
+  for(size_t iadd = 0; iadd < 200; ++iadd) {
+    vector<string> query_strs(random_query(1 + rng() % 3, rng() % 9));
+    cache.Add(query_strs, query_strs);
+    cached.push_back(query_strs);
+  }
+  if(cache.size() != set<vector<string> >(cached.begin(), cached.end()).size())
+    throw runtime_error("ERROR trellis cache has " + to_string(cache.size()) + " entries after adding " + to_string(cached.size()) + " queries");
+
+  size_t n_found(0), n_queries(0);
+  for(size_t iquery = 0; iquery < 4000; ++iquery) {
+    vector<string> query_strs;
+    if(iquery % 2 == 0) {  // prefix of a random cached query, so we find something fairly often
+      vector<string> &source(cached[rng() % cached.size()]);
+      size_t length(source[0].size() > 0 ? rng() % (source[0].size() + 1) : 0);
+      for(auto &str : source)
+	query_strs.push_back(str.substr(0, length));
+      if(query_strs.size() > 1 && length > 0 && rng() % 2 == 0)  // and sometimes change the last character of one string, so only the interleaved walk can tell they're different
+	query_strs[1][length - 1] = "ACG"[(string("ACG").find(query_strs[1][length - 1]) + 1) % 3];
+    } else {
+      query_strs = random_query(1 + rng() % 3, rng() % 6);
+    }
+
+    bool expect_found(false);
+    for(auto &cached_strs : cached) {
+      if(cached_strs.size() != query_strs.size())
+	continue;
+      bool found_match(true);
+      for(size_t iseq = 0; iseq < cached_strs.size(); ++iseq) {
+	if(cached_strs[iseq].find(query_strs[iseq]) != 0)
+	  found_match = false;
+      }
+      expect_found |= found_match;
+    }
+
+    vector<string> *extension(cache.FindExtension(query_strs));
+    if((extension != nullptr) != expect_found)
+      throw runtime_error("ERROR trellis cache " + string(expect_found ? "didn't find" : "found") + " an extension for " + JoinStrings(query_strs, ":"));
+    if(extension != nullptr) {
+      if(extension->size() != query_strs.size())
+	throw runtime_error("ERROR trellis cache gave a chunk cache with a different number of sequences for " + JoinStrings(query_strs, ":"));
+      for(size_t iseq = 0; iseq < query_strs.size(); ++iseq) {
+	if((*extension)[iseq].find(query_strs[iseq]) != 0)
+	  throw runtime_error("ERROR trellis cache gave " + JoinStrings(*extension, ":") + ", which doesn't extend " + JoinStrings(query_strs, ":"));
+      }
+      ++n_found;
+    }
+    ++n_queries;
+  }
+
+  cache.Clear();
+  if(cache.size() != 0 || cache.FindExtension(cached[0]) != nullptr)
+    throw runtime_error("ERROR trellis cache not empty after Clear()");
+  cout << "trellis cache ok (found extensions for " << n_found << " of " << n_queries << " queries)" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that viterbi paths through states with indices that don't fit in an int16 come out right, on a chain of more than INT16_MAX states in
+// which each state mostly emits one (random) symbol (just for use by `scons test`). Init can go to any of the last few states, and the query
+// matches the emissions of a run of them, so the only decent path is that run (init also goes to the first state, so they're all reachable, but a short
+// query can't get from there to the end of the chain).
+void CheckLargeModel() {
+  size_t n_states(INT16_MAX + 1000), n_init(20), length(10);
+  vector<string> symbols{"A", "C", "G", "T"};
+  mt19937 rng(1);
+  vector<size_t> state_symbols(n_states);
+  for(auto &isym : state_symbols)
+    isym = rng() % symbols.size();
+  YAML::Node config;
+  config["name"] = "large";
+  config["tracks"]["nukes"] = symbols;
+  YAML::Node init;
+  init["name"] = "init";
+  init["transitions"]["s0"] = 0.5;
+  for(size_t ist = n_states - n_init; ist < n_states; ++ist)
+    init["transitions"]["s" + to_string(ist)] = 0.5 / n_init;
+  config["states"].push_back(init);
+  for(size_t ist = 0; ist < n_states; ++ist) {
+    YAML::Node state;
+    state["name"] = "s" + to_string(ist);
+    for(size_t isym = 0; isym < symbols.size(); ++isym)
+      state["emissions"]["probs"][symbols[isym]] = isym == state_symbols[ist] ? 0.97 : 0.01;
+    if(ist < n_states - 1) {
+      state["transitions"]["s" + to_string(ist + 1)] = 0.9;
+      state["transitions"]["end"] = 0.1;
+    } else {
+      state["transitions"]["end"] = 1.;
+    }
+    config["states"].push_back(state);
+  }
+  Model hmm;
+  hmm.Parse(config, "large model");
+
+  size_t first_state(n_states - n_init + 5);
+  string seqstr;
+  for(size_t ipos = 0; ipos < length; ++ipos)
+    seqstr += symbols[state_symbols[first_state + ipos]];
+  Sequences seqs;
+  seqs.AddSeq(Sequence(hmm.track(), "seq", seqstr));
+  double expected_log_prob(log(0.5 / n_init) + length * log(0.97) + (length - 1) * log(0.9) + log(0.1));
+
+  vector<pair<string, TracebackPath> > paths;  // path from each kind of trellis
+  for(int checkpoint_interval : {0, 3}) {
+    Trellis trell(&hmm, seqs);
+    trell.SetCheckpointInterval(checkpoint_interval);
+    trell.Viterbi();
+    if(fabs(trell.ending_viterbi_log_prob() - expected_log_prob) > 1e-9)
+      throw runtime_error("ERROR large model gave viterbi log prob " + to_string(trell.ending_viterbi_log_prob()) + " but expected " + to_string(expected_log_prob));
+    paths.push_back(pair<string, TracebackPath>(checkpoint_interval == 0 ? "trellis" : "checkpointed trellis", TracebackPath(&hmm)));
+    trell.Traceback(paths.back().second);
+  }
+  SuffixTrellis strell(&hmm, seqs);
+  strell.Viterbi();
+  paths.push_back(pair<string, TracebackPath>("suffix trellis", TracebackPath(&hmm)));
+  strell.Traceback(0, paths.back().second);
+  vector<Sequence> batch_seqs{seqs[0], seqs[0]};
+  BatchTrellis batch_trell(&hmm, batch_seqs);
+  batch_trell.Viterbi();
+  paths.push_back(pair<string, TracebackPath>("batch trellis", TracebackPath(&hmm)));
+  batch_trell.Traceback(1, paths.back().second);
+
+  for(auto &name_path : paths) {
+    TracebackPath &path(name_path.second);
+    bool ok(path.size() == length);
+    for(size_t ipos = 0; ok && ipos < length; ++ipos)  // NOTE paths go from the end of the sequence to the start
+      ok = path[ipos] == int(first_state + length - 1 - ipos);
+    if(!ok)
+      throw runtime_error("ERROR " + name_path.first + " gave the wrong viterbi path through the large model");
+  }
+  cout << "large model ok (" << hmm.n_states() << " states, " << paths.size() << " kinds of trellis)" << endl;
+}
@@ -1,5 +1,50 @@
 #include "mathutils.h"
+#include <cassert>
 namespace ham {
+
+// ----------------------------------------------------------------------------------------
+static const int kLog1pExpKnotsPerUnit(64);
+static const double kLog1pExpMaxD(40.);  // log(1 + exp(-40)) = 4e-18, which is zero as far as we're concerned
+
+// ----------------------------------------------------------------------------------------
+// value and (scaled) slope of log(1 + exp(-d)) at each knot, interleaved so each lookup touches only one cache line
+struct Log1pExpKnot {
+  double val;
+  double slope;  // derivative times the knot spacing
+};
+
+// ----------------------------------------------------------------------------------------
+static vector<Log1pExpKnot> MakeLog1pExpTable() {
+  size_t n_knots(kLog1pExpKnotsPerUnit * kLog1pExpMaxD + 2);  // one extra so we can always look at the knot above
+  vector<Log1pExpKnot> table(n_knots);
+  for(size_t ik = 0; ik < n_knots; ++ik) {
+    double d((double)ik / kLog1pExpKnotsPerUnit);
+    table[ik].val = log1p(exp(-d));
+    table[ik].slope = -1. / (1. + exp(d)) / kLog1pExpKnotsPerUnit;
+  }
+  return table;
+}
+
+static const vector<Log1pExpKnot> log1p_exp_table(MakeLog1pExpTable());
+LogSumExpMode log_sum_exp_mode_(kExactLogSumExp);
+
+// ----------------------------------------------------------------------------------------
+void SetLogSumExpMode(LogSumExpMode mode) {
+  log_sum_exp_mode_ = mode;
+}
+
+// ----------------------------------------------------------------------------------------
+double FastLog1pExp(double d) {
+  assert(d >= 0.);
+  if(d >= kLog1pExpMaxD)
+    return 0.;
+  double t(d * kLog1pExpKnotsPerUnit);
+  size_t ik(t);
+  double u(t - ik), u2(u * u), u3(u2 * u);
+  const Log1pExpKnot &lo(log1p_exp_table[ik]), &hi(log1p_exp_table[ik + 1]);
+  return (2 * u3 - 3 * u2 + 1) * lo.val + (u3 - 2 * u2 + u) * lo.slope + (-2 * u3 + 3 * u2) * hi.val + (u3 - u2) * hi.slope;  // hermite basis functions
+}
+
 // ----------------------------------------------------------------------------------------
 // add two numbers, treating -INFINITY as zero, i.e. calculates log a*b = log a + log b, i.e. a *and* b
 double AddWithMinusInfinities(double first, double second) {
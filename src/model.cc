@@ -5,7 +5,8 @@ namespace ham {
 Model::Model() :
   overall_prob_(0.0),
   original_overall_mute_freq_(0.0),
-  rescale_ratio_(-INFINITY),
+  overall_mute_freq_(-INFINITY),
+  base_(nullptr),
   ambiguous_char_(""),
   track_(nullptr),
   initial_(nullptr),
@@ -14,8 +15,42 @@ Model::Model() :
   ending_ = new State;
 }
 
+// ----------------------------------------------------------------------------------------
+Model::Model(Model &base, double overall_mute_freq) :
+  name_(base.name_),
+  overall_prob_(base.overall_prob_),
+  original_overall_mute_freq_(base.original_overall_mute_freq_),
+  overall_mute_freq_(overall_mute_freq),
+  base_(&base),
+  ambiguous_char_(base.ambiguous_char_),
+  track_(base.track_),
+  states_(base.states_),
+  states_by_name_(base.states_by_name_),
+  initial_(base.initial_),
+  ending_(base.ending_),
+  finalized_(base.finalized_)
+{
+  assert(overall_mute_freq != -INFINITY);
+  if(base.base_ != nullptr)
+    throw runtime_error("ERROR tried to make a snapshot of snapshot " + name_);
+  if(original_overall_mute_freq_ == 0.0)
+    throw runtime_error("model.cc: tried to rescale overall mut freqs with zero original_overall_mute_freq_");
+
+  // NOTE it is arguable that the denominator here should be the original mute freq only over the sequences that had
+  //  *this* germline gene (rather than over all sequence in the data set). However, it'd be a bunch more work to do
+  //  it that way, and even if it's more correcter, I don't think it'd make much difference
+  double factor = max(0.01, overall_mute_freq) / original_overall_mute_freq_;  // NOTE the 1% is kind of a hack (to protect against zero) -- but it's roughly equal to the uncertainty on our mute freq estimates, so it's reasonable
+  vector<vector<double> > log_probs;
+  for(auto &state : states_)
+    log_probs.push_back(state->RescaledEmissionLogProbs(factor));  // REMINDER still not in log space
+  compiled_.ShareTopology(base.compiled_);  // only the emissions are different, so we share everything else with <base>
+  compiled_.SetEmissions(states_, &log_probs);
+}
+
 // ----------------------------------------------------------------------------------------
 Model::~Model() {
+  if(base_ != nullptr)  // everything but <compiled_> belongs to <base_>
+    return;
   delete ending_;
   ending_ = nullptr;
   for(auto &kv : states_by_name_)
@@ -28,8 +63,11 @@ void Model::Parse(string infname) {
   if(!ifstream(infname))
     throw runtime_error("input file " + infname + " does not exist.");
 
-  // load yaml
-  YAML::Node config = YAML::LoadFile(infname);
+  Parse(YAML::LoadFile(infname), infname);
+}
+
+// ----------------------------------------------------------------------------------------
+void Model::Parse(YAML::Node config, string infname) {
   // first get model-wide information
   try {
     name_ = config["name"].as<string>();
@@ -64,6 +102,7 @@ void Model::Parse(string infname) {
 
   // then push back each state name
   vector<string> state_names;
+  set<string> state_name_set;  // same thing, for quick lookups (there can be tens of thousands of states)
   for(size_t is = 0; is < config["states"].size(); ++is) {
     string name;
     try {
@@ -72,20 +111,19 @@ void Model::Parse(string infname) {
       cerr << "ERROR invalid state name in " << infname << endl;
       throw;
     }
-    for(auto chkname : state_names) {
-      if(name == chkname) {
-        cerr << "ERROR added two states with name '" << name << "'" << endl;
-        throw;
-      }
+    if(state_name_set.count(name)) {
+      cerr << "ERROR added two states with name '" << name << "'" << endl;
+      throw;
     }
     state_names.push_back(name);
+    state_name_set.insert(name);
   }
 
   // then actually parse the info for each state
   for(size_t ist = 0; ist < state_names.size(); ++ist) {
     State *state(new State);
     try {
-      state->Parse(config["states"][ist], state_names, track_);
+      state->Parse(config["states"][ist], state_name_set, track_);
     } catch(...) {
       cerr << "ERROR invalid specification for state '" << state_names[ist] << "' in " << infname << endl;
       throw;
@@ -94,7 +132,6 @@ void Model::Parse(string infname) {
     if(state->name() == "init") {
       initial_ = state;
     } else {
-      assert(states_.size() < STATE_MAX);
       states_.push_back(state);
     }
     states_by_name_[state->name()] = state;
@@ -104,36 +141,59 @@ void Model::Parse(string infname) {
 }
 
 // ----------------------------------------------------------------------------------------
-void Model::AddState(State* state) {
-  throw runtime_error("do I ever get here?");
-  assert(states_.size() < STATE_MAX);
-  states_.push_back(state);
-  states_by_name_[state->name()] = state;
-  return;
+void Model::Write(BundleWriter &out) {
+  if(base_ != nullptr)
+    throw runtime_error("ERROR tried to write rescaled snapshot " + name_ + " to a bundle");
+  out.String(name_);
+  out.Double(overall_prob_);
+  out.Double(original_overall_mute_freq_);
+  out.String(ambiguous_char_);
+  out.String(track_->name());
+  out.U64(track_->alphabet_size());
+  for(size_t ic = 0; ic < track_->alphabet_size(); ++ic)
+    out.String(track_->symbol(ic));
+  out.U64(states_.size() + 1);
+  initial_->Write(out);
+  for(auto &state : states_)
+    state->Write(out);
 }
 
 // ----------------------------------------------------------------------------------------
-void Model::RescaleOverallMuteFreq(double overall_mute_freq) {
-  assert(overall_mute_freq != -INFINITY);
-
-  if(original_overall_mute_freq_ == 0.0)
-    throw runtime_error("model.cc: tried to rescale overall mut freqs with zero original_overall_mute_freq_");
-
-  // cout << "rescaling " << name_ << " from " << original_overall_mute_freq_ << " to " << overall_mute_freq << endl;
-  for(auto &state : states_) {
-    // NOTE it is arguable that the denominator here should be the original mute freq only over the sequences that had
-    //  *this* germline gene (rather than over all sequence in the data set). However, it'd be a bunch more work to do
-    //  it that way, and even if it's more correcter, I don't think it'd make much difference
-    double factor = max(0.01, overall_mute_freq) / original_overall_mute_freq_;  // NOTE the 1% is kind of a hack (to protect against zero) -- but it's roughly equal to the uncertainty on our mute freq estimates, so it's reasonable
-    state->RescaleOverallMuteFreq(factor);  // REMINDER still not in log space
+void Model::Read(BundleReader &in) {
+  assert(track_ == nullptr && !finalized_);  // shouldn't already be initialized
+  name_ = in.String();
+  overall_prob_ = in.Double();
+  original_overall_mute_freq_ = in.Double();
+  ambiguous_char_ = in.String();
+  track_ = new Track;
+  track_->set_name(in.String());
+  if(ambiguous_char_ != "")
+    track_->SetAmbiguous(ambiguous_char_);
+  uint64_t n_symbols(in.U64());
+  for(uint64_t ic = 0; ic < n_symbols; ++ic)
+    track_->AddSymbol(in.String());
+
+  uint64_t n_states(in.U64());
+  for(uint64_t ist = 0; ist < n_states; ++ist) {
+    State *state(new State);
+    state->Read(in, track_);
+    if(state->name() == "init") {
+      initial_ = state;
+    } else {
+      states_.push_back(state);
+    }
+    states_by_name_[state->name()] = state;
   }
+
+  Finalize();
 }
 
 // ----------------------------------------------------------------------------------------
-void Model::UnRescaleOverallMuteFreq() {
-  // cout << "  unrescaling" << endl;
-  for(auto &state : states_)
-    state->UnRescaleOverallMuteFreq();
+void Model::AddState(State* state) {
+  throw runtime_error("do I ever get here?");
+  states_.push_back(state);
+  states_by_name_[state->name()] = state;
+  return;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -160,6 +220,8 @@ void Model::Finalize() {
 
   AddMaybeFasterFromStateStuff();  // TODO should really somehow be integrated into FinalizeState() (?)
 
+  compiled_.Compile(states_, initial_, track_);
+
   finalized_ = true;
 }
 
@@ -110,9 +110,24 @@ Sequences Sequences::Union(Sequences &otherseqs) {
   return union_seqs;
 }
 // ----------------------------------------------------------------------------------------
-Sequences::Sequences(Sequences &seqs, size_t pos, size_t len) : sequence_length_(0) {
+Sequences::Sequences(Sequences &seqs, size_t pos, size_t len) : sequence_length_(0), n_profile_columns_(0) {
   for(auto & seq : seqs.seqs_)
     AddSeq(Sequence(seq, pos, len));
+  if(seqs.profile_.size() > 0) {  // if the parent already has a profile, take our chunk of it
+    n_profile_columns_ = seqs.n_profile_columns_;
+    profile_ = vector<uint32_t>(seqs.profile_.begin() + pos * n_profile_columns_, seqs.profile_.begin() + (pos + len) * n_profile_columns_);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Sequences::SetProfile() {
+  assert(n_seqs() > 0);
+  Track *track(seqs_[0].track());
+  n_profile_columns_ = track->n_columns();
+  profile_.assign(sequence_length_ * n_profile_columns_, 0);
+  for(auto &seq : seqs_)
+    for(size_t ipos = 0; ipos < sequence_length_; ++ipos)
+      ++profile_[ipos * n_profile_columns_ + track->column(seq.value(ipos))];
 }
 
 // // ----------------------------------------------------------------------------------------
@@ -131,7 +146,7 @@ void Sequences::Print() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Sequences::AddSeq(Sequence sq) {
+void Sequences::AddSeq(const Sequence &sq) {
   if(n_seqs() == 0) {  // if this is the first sequence, set <sequence_length_>
     sequence_length_ = sq.size();
   } else {
@@ -139,6 +154,19 @@ void Sequences::AddSeq(Sequence sq) {
       throw runtime_error("Sequences::AddSeq() sequences must all have the same length, but got " + to_string(sq.size()) + " and " + to_string(sequence_length_));
   }
   seqs_.push_back(sq);  // NOTE we now own this sequence, i.e. we will delete it when we die
+  profile_.clear();  // out of date
+}
+
+// ----------------------------------------------------------------------------------------
+SequencesView::SequencesView(Sequences &seqs, size_t pos, size_t len) : seqs_(&seqs), pos_(pos), len_(len) {
+  if(pos + len > seqs.GetSequenceLength())
+    throw runtime_error("ERROR view from " + to_string(pos) + " of length " + to_string(len) + " too long for sequences of length " + to_string(seqs.GetSequenceLength()) + " (" + seqs.name_str() + ")");
+}
+
+// ----------------------------------------------------------------------------------------
+SequencesView::SequencesView(const SequencesView &view, size_t pos, size_t len) : seqs_(view.seqs_), pos_(view.pos_ + pos), len_(len) {
+  if(pos + len > view.len_)
+    throw runtime_error("ERROR view from " + to_string(pos) + " of length " + to_string(len) + " too long for view of length " + to_string(view.len_) + " (" + seqs_->name_str() + ")");
 }
 
 }
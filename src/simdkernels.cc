@@ -0,0 +1,225 @@
+#include "simdkernels.h"
+#include <math.h>
+#include <string.h>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// The kernels are written as plain loops with no branches in them, and then inlined into a wrapper function for each instruction set
+// (with the target attribute), where the compiler vectorizes them for that instruction set's registers.
+#define HAM_SIMD_INLINE static inline __attribute__((always_inline))
+
+// NOTE we build with -Ofast, which lets the compiler assume there aren't any infinities, and it takes full advantage of that in vectorized
+// code. So here we never compare to -INFINITY or subtract two things that might both be -INFINITY -- anything below this counts as -INFINITY.
+static const double kMinLogProb(-1e300);
+
+// ----------------------------------------------------------------------------------------
+HAM_SIMD_INLINE double AsDouble(int64_t bits) { double val; memcpy(&val, &bits, sizeof(val)); return val; }
+HAM_SIMD_INLINE int64_t AsInt(double val) { int64_t bits; memcpy(&bits, &val, sizeof(bits)); return bits; }
+
+// ----------------------------------------------------------------------------------------
+// exp() for x <= 0 (which is all we need), to within a couple of ulps. Returns zero for anything below about -708.
+HAM_SIMD_INLINE double VecExp(double x) {
+  const double kShifter(6755399441055744.0);  // 1.5 * 2^52: adding this to an integer puts the integer in the low bits of the mantissa
+  double xc = x < -708. ? -708. : x;
+  double nd = rint(xc * 1.4426950408889634);  // log2(e) (NOTE don't round with the shifter trick, since -Ofast reassociates (x + kShifter) - kShifter to x)
+  int64_t n = AsInt(nd + kShifter) - AsInt(kShifter);
+  double r = xc - nd * 6.93147180369123816490e-01 - nd * 1.90821492927058770002e-10;  // ln(2), split in two, so |r| < ln(2)/2 with hardly any rounding error
+  double p = 1. / 6227020800.;  // taylor series out to r^13 / 13!, which is good to better than one ulp for |r| < ln(2)/2
+  p = p * r + 1. / 479001600.;
+  p = p * r + 1. / 39916800.;
+  p = p * r + 1. / 3628800.;
+  p = p * r + 1. / 362880.;
+  p = p * r + 1. / 40320.;
+  p = p * r + 1. / 5040.;
+  p = p * r + 1. / 720.;
+  p = p * r + 1. / 120.;
+  p = p * r + 1. / 24.;
+  p = p * r + 1. / 6.;
+  p = p * r + 0.5;
+  p = p * r + 1.;
+  p = p * r + 1.;
+  double scale = AsDouble((n + 1023) << 52);  // 2^n
+  return x < -708. ? 0. : p * scale;
+}
+
+// ----------------------------------------------------------------------------------------
+// log() for x >= 1, which is all we need (the arguments are always one plus something, or a sum of terms the largest of which is one)
+HAM_SIMD_INLINE double VecLog(double x) {
+  const double kShifter(4503599627370496.0);  // 2^52: for turning the (small, non-negative) exponent into a double without an int-to-double conversion
+  int64_t bits = AsInt(x);
+  int64_t exponent = (bits >> 52) - 1023;
+  double mantissa = AsDouble((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);  // in [1, 2)
+  int64_t big = mantissa > 1.4142135623730951 ? 1 : 0;  // move the mantissa into [sqrt(2)/2, sqrt(2)), so the series below converges quickly
+  mantissa = big ? mantissa * 0.5 : mantissa;
+  exponent += big;
+  double e = AsDouble(AsInt(kShifter) + exponent) - kShifter;
+  double f = (mantissa - 1.) / (mantissa + 1.);  // log(m) = 2 atanh(f) = 2 (f + f^3/3 + f^5/5 + ...), with |f| < 0.172
+  double f2 = f * f;
+  double p = 1. / 23.;
+  p = p * f2 + 1. / 21.;
+  p = p * f2 + 1. / 19.;
+  p = p * f2 + 1. / 17.;
+  p = p * f2 + 1. / 15.;
+  p = p * f2 + 1. / 13.;
+  p = p * f2 + 1. / 11.;
+  p = p * f2 + 1. / 9.;
+  p = p * f2 + 1. / 7.;
+  p = p * f2 + 1. / 5.;
+  p = p * f2 + 1. / 3.;
+  double logm = 2. * f + 2. * f * f2 * p;
+  return e * 6.93147180369123816490e-01 + (logm + e * 1.90821492927058770002e-10);
+}
+
+// ----------------------------------------------------------------------------------------
+HAM_SIMD_INLINE void ChainValsImpl(const double *__restrict__ emissions, const double *__restrict__ chain_log_probs, const double *__restrict__ previous, double *__restrict__ out, size_t n) {
+  out[0] = -INFINITY;
+  for(size_t ist = 1; ist < n; ++ist)  // NOTE two separate loops, so we add things in the same order as the scalar kernels
+    out[ist] = emissions[ist] + chain_log_probs[ist];
+  for(size_t ist = 1; ist < n; ++ist)
+    out[ist] += previous[ist - 1];
+}
+
+// ----------------------------------------------------------------------------------------
+HAM_SIMD_INLINE void ViterbiMergeImpl(const double *__restrict__ chain_vals, double *__restrict__ current, uint8_t *__restrict__ improved, size_t n) {
+  for(size_t ist = 0; ist < n; ++ist) {
+    bool better(chain_vals[ist] > current[ist]);
+    improved[ist] = better;
+    current[ist] = better ? chain_vals[ist] : current[ist];
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+HAM_SIMD_INLINE size_t ViterbiBestEndingImpl(const double *__restrict__ current, const double *__restrict__ end_log_probs, size_t n, double *best) {
+  double best_val(-INFINITY);
+  for(size_t ist = 0; ist < n; ++ist) {
+    double val(current[ist] + end_log_probs[ist]);
+    best_val = val > best_val ? val : best_val;
+  }
+  *best = best_val;
+  if(best_val < kMinLogProb)
+    return SIZE_MAX;
+  for(size_t ist = 0; ist < n; ++ist) {  // recompute the sums to find the first one that matches (they're exactly the same additions, so they give exactly the same values)
+    if(current[ist] + end_log_probs[ist] == best_val)
+      return ist;
+  }
+  return SIZE_MAX;
+}
+
+// ----------------------------------------------------------------------------------------
+HAM_SIMD_INLINE void ForwardMergeImpl(const double *__restrict__ chain_vals, double *__restrict__ current, size_t n) {
+  for(size_t ist = 0; ist < n; ++ist) {
+    double hi(chain_vals[ist] > current[ist] ? chain_vals[ist] : current[ist]);
+    double lo(chain_vals[ist] > current[ist] ? current[ist] : chain_vals[ist]);
+    double diff(lo < kMinLogProb ? -1000. : lo - hi);  // i.e. exp(diff) is zero
+    current[ist] = hi + VecLog(1. + VecExp(diff));
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+HAM_SIMD_INLINE double ForwardEndingSumImpl(const double *__restrict__ current, const double *__restrict__ end_log_probs, size_t n) {
+  double max_val(-INFINITY);
+  for(size_t ist = 0; ist < n; ++ist) {
+    double val(current[ist] + end_log_probs[ist]);
+    max_val = val > max_val ? val : max_val;
+  }
+  if(max_val < kMinLogProb)
+    return -INFINITY;
+  double total(0.);
+  for(size_t ist = 0; ist < n; ++ist) {
+    double val(current[ist] + end_log_probs[ist]);
+    total += VecExp(val < kMinLogProb ? -1000. : val - max_val);
+  }
+  return max_val + VecLog(total);
+}
+
+// ----------------------------------------------------------------------------------------
+#if defined(__x86_64__) || defined(__i386__)
+#define HAM_SIMD_KERNELS(suffix, isa)	\
+  __attribute__((target(isa))) static void ChainVals##suffix(const double *emissions, const double *chain_log_probs, const double *previous, double *out, size_t n) { ChainValsImpl(emissions, chain_log_probs, previous, out, n); } \
+  __attribute__((target(isa))) static void ViterbiMerge##suffix(const double *chain_vals, double *current, uint8_t *improved, size_t n) { ViterbiMergeImpl(chain_vals, current, improved, n); } \
+  __attribute__((target(isa))) static size_t ViterbiBestEnding##suffix(const double *current, const double *end_log_probs, size_t n, double *best) { return ViterbiBestEndingImpl(current, end_log_probs, n, best); } \
+  __attribute__((target(isa))) static void ForwardMerge##suffix(const double *chain_vals, double *current, size_t n) { ForwardMergeImpl(chain_vals, current, n); } \
+  __attribute__((target(isa))) static double ForwardEndingSum##suffix(const double *current, const double *end_log_probs, size_t n) { return ForwardEndingSumImpl(current, end_log_probs, n); } \
+  static const SimdKernels kernels##suffix = {ChainVals##suffix, ViterbiMerge##suffix, ViterbiBestEnding##suffix, ForwardMerge##suffix, ForwardEndingSum##suffix};
+
+HAM_SIMD_KERNELS(SSE4, "sse4.1")
+HAM_SIMD_KERNELS(AVX2, "avx2")
+HAM_SIMD_KERNELS(AVX512, "avx512f")
+#endif
+
+// ----------------------------------------------------------------------------------------
+static SimdLevel current_level(DetectSimdLevel());
+
+// ----------------------------------------------------------------------------------------
+SimdLevel DetectSimdLevel() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f"))
+    return kAVX512;
+  if(__builtin_cpu_supports("avx2"))
+    return kAVX2;
+  if(__builtin_cpu_supports("sse4.1"))
+    return kSSE4;
+#endif
+  return kScalar;
+}
+
+// ----------------------------------------------------------------------------------------
+SimdLevel simd_level() {
+  return current_level;
+}
+
+// ----------------------------------------------------------------------------------------
+void SetSimdLevel(SimdLevel level) {
+  if(level > DetectSimdLevel())
+    throw runtime_error("ERROR simd level " + SimdLevelName(level) + " not supported on this cpu (best is " + SimdLevelName(DetectSimdLevel()) + ")");
+  current_level = level;
+}
+
+// ----------------------------------------------------------------------------------------
+void SetSimdLevel(string name) {
+  if(name == "auto")
+    SetSimdLevel(DetectSimdLevel());
+  else if(name == "scalar")
+    SetSimdLevel(kScalar);
+  else if(name == "sse4")
+    SetSimdLevel(kSSE4);
+  else if(name == "avx2")
+    SetSimdLevel(kAVX2);
+  else if(name == "avx512")
+    SetSimdLevel(kAVX512);
+  else
+    throw runtime_error("ERROR unknown simd level '" + name + "' (choose from auto, scalar, sse4, avx2, avx512)");
+}
+
+// ----------------------------------------------------------------------------------------
+string SimdLevelName(SimdLevel level) {
+  switch(level) {
+  case kScalar: return "scalar";
+  case kSSE4: return "sse4";
+  case kAVX2: return "avx2";
+  case kAVX512: return "avx512";
+  }
+  return "unknown";
+}
+
+// ----------------------------------------------------------------------------------------
+const SimdKernels *simd_kernels() {
+  return simd_kernels(current_level);
+}
+
+// ----------------------------------------------------------------------------------------
+const SimdKernels *simd_kernels(SimdLevel level) {
+#if defined(__x86_64__) || defined(__i386__)
+  switch(level) {
+  case kScalar: return nullptr;
+  case kSSE4: return &kernelsSSE4;
+  case kAVX2: return &kernelsAVX2;
+  case kAVX512: return &kernelsAVX512;
+  }
+#endif
+  return nullptr;
+}
+
+}
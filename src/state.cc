@@ -25,7 +25,7 @@ State::~State() {
 }
 
 // ----------------------------------------------------------------------------------------
-void State::Parse(YAML::Node node, vector<string> state_names, Track *track) {
+void State::Parse(YAML::Node node, const set<string> &state_names, Track *track) {
   name_ = node["name"].as<string>();
   assert(name_.size() > 0);
   if(node["extras"]["germline"])
@@ -38,7 +38,7 @@ void State::Parse(YAML::Node node, vector<string> state_names, Track *track) {
   double total(0.0); // make sure things add to 1.0
   for(YAML::const_iterator it = node["transitions"].begin(); it != node["transitions"].end(); ++it) {
     string to_state(it->first.as<string>());
-    if(to_state != "end" && find(state_names.begin(), state_names.end(), to_state) == state_names.end()) {   // make sure transition is either to "end", or to a state that we know about
+    if(to_state != "end" && state_names.count(to_state) == 0) {   // make sure transition is either to "end", or to a state that we know about
       cout << "ERROR attempted to add transition to unknown state \"" << to_state << "\"" << endl;
       throw runtime_error("configuration");
     }
@@ -71,16 +71,54 @@ void State::Parse(YAML::Node node, vector<string> state_names, Track *track) {
 }
 
 // ----------------------------------------------------------------------------------------
-void State::RescaleOverallMuteFreq(double factor) {
+void State::Write(BundleWriter &out) {
+  out.String(name_);
+  out.String(germline_nuc_);
+  out.Double(ambiguous_emission_logprob_);
+  out.String(ambiguous_char_);
+  out.U64(transitions_->size());
+  for(auto &trans : *transitions_) {
+    out.String(trans->to_state_name());
+    out.Double(trans->log_prob());
+  }
+  out.U32(trans_to_end_ != nullptr);
+  if(trans_to_end_ != nullptr)
+    out.Double(trans_to_end_->log_prob());
+  if(name_ != "init")
+    out.Doubles(emission_.log_probs());
+}
+
+// ----------------------------------------------------------------------------------------
+void State::Read(BundleReader &in, Track *track) {
+  name_ = in.String();
+  germline_nuc_ = in.String();
+  ambiguous_emission_logprob_ = in.Double();
+  ambiguous_char_ = in.String();
+  uint64_t n_transitions(in.U64());
+  for(uint64_t itr = 0; itr < n_transitions; ++itr) {
+    Transition *trans = new Transition(in.String(), 1.);
+    trans->set_log_prob(in.Double());
+    transitions_->push_back(trans);
+  }
+  if(in.U32()) {
+    trans_to_end_ = new Transition("end", 1.);
+    trans_to_end_->set_log_prob(in.Double());
+  }
+  if(name_ != "init")
+    emission_.Init(track, in.Doubles());
+}
+
+// ----------------------------------------------------------------------------------------
+vector<double> State::RescaledEmissionLogProbs(double factor) {
+  vector<double> new_log_probs(emission_.log_probs());
   if(germline_nuc_ == ambiguous_char_ || germline_nuc_ == "")  // if the germline state is N, or if this state has no germline (most likely fv or jf insertion)
-    return;
+    return new_log_probs;
 
   if(factor <= 0.0 || factor > 15.)  // 15 is pretty much arbitrary, but back when I understood this code I thought it was important that the factor not be too big (which would, I think, indicate that the sequence at hand had a very, very different mutation rate to that used to build the hmm)
-    cout << "very large factor in State::RescaleOverallMuteFreq: " << to_string(factor) << endl;
+    cout << "very large factor in State::RescaledEmissionLogProbs: " << to_string(factor) << endl;
 
   assert(emission_.track()->symbol_index(germline_nuc_) < emission_.track()->alphabet_size());  // this'll throw an exception on the symbol_index call if the germline nuc is bad
 
-  vector<double> new_log_probs(emission_.log_probs());
   assert(new_log_probs.size() == emission_.track()->alphabet_size());
   for(size_t ip=0; ip<new_log_probs.size(); ++ip) {
     // NOTE this is wasteful to go out of and back into log space (but doesn't matter at all in actual practice)
@@ -93,7 +131,7 @@ void State::RescaleOverallMuteFreq(double factor) {
       old_mute_freq = 3. * old_emit_prob;
     double new_mute_freq = min(0.95, factor*old_mute_freq);  // .95 is kind of arbitrary, but from looking at lots of plots, the only cases where the extrapolation flies above 1.0 is where we have little information, so .95 is probably a good compromise
     if(new_mute_freq <= 0.0 || new_mute_freq >= 1.0)
-      throw runtime_error("ERROR new_mute_freq not in (0,1) (" + to_string(new_mute_freq) + ") in State::RescaleOverallMuteFreq old: "
+      throw runtime_error("ERROR new_mute_freq not in (0,1) (" + to_string(new_mute_freq) + ") in State::RescaledEmissionLogProbs old: "
 			  + to_string(old_mute_freq) + " factor: " + to_string(factor) + " is_germline: " + to_string(is_germline));
     if(is_germline)
       new_log_probs[ip] = log(1.0 - new_mute_freq);
@@ -101,14 +139,13 @@ void State::RescaleOverallMuteFreq(double factor) {
       new_log_probs[ip] = log(new_mute_freq / 3.);
   }
 
-  emission_.ReplaceLogProbs(new_log_probs);
-}
+  double total(0.0); // make sure things add to 1.0
+  for(size_t ip=0; ip<new_log_probs.size(); ++ip)
+    total += exp(new_log_probs[ip]);
+  if(fabs(total - 1.0) >= EPS)
+    throw runtime_error("ERROR bad normalization after rescaling " + to_string(total) + " in State::RescaledEmissionLogProbs()\n");
 
-// ----------------------------------------------------------------------------------------
-void State::UnRescaleOverallMuteFreq() {
-  if(germline_nuc_ == ambiguous_char_ || germline_nuc_ == "")  // if the germline state is N, or if this state has no germline (most likely fv or jf insertion)
-    return;
-  emission_.UnReplaceLogProbs();
+  return new_log_probs;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -120,10 +157,10 @@ double State::EmissionLogprob(uint8_t ch) {
 }
 
 // ----------------------------------------------------------------------------------------
-double State::EmissionLogprob(Sequences *seqs, size_t pos) {
+double State::EmissionLogprob(SequencesView &seqs, size_t pos) {
   double logprob(0.);  // multiplying probabilities, so initial prob value should be 1.
-  for(size_t iseq=0; iseq<seqs->n_seqs(); ++iseq)
-    logprob = AddWithMinusInfinities(logprob, EmissionLogprob((*seqs->get_ptr(iseq))[pos]));
+  for(size_t iseq=0; iseq<seqs.n_seqs(); ++iseq)
+    logprob = AddWithMinusInfinities(logprob, EmissionLogprob(seqs.value(iseq, pos)));
 
 // // ----------------------------------------------------------------------------------------
 //   // potential way of accounting for shared mutations (i.e. moving off the star-tree assumption). The main practical problem it attempts to fix is over-long insertions/deletions. Unfortunately in this form it fixes this problem but, in aggregate, casues other inaccuracies that overshadow it.
@@ -152,12 +189,8 @@ void State::Print() {
   cout << endl;
 
   cout << "  transitions:" << endl;;
-  for(size_t i = 0; i < transitions_->size(); ++i) {
-    if((*transitions_)[i] == nullptr)  // reminder: this is a bitset over all states, with the bit set (well, with a non-null-pointer set) if we can transition to the corresponding state; *not* a vector of allowed transitions
-      continue;
-    else
-      (*transitions_)[i]->Print();
-  }
+  for(auto &trans : *transitions_)
+    trans->Print();
 
   if(trans_to_end_)
     trans_to_end_->Print();
@@ -177,26 +210,23 @@ double State::end_transition_logprob() {
   return trans_to_end_->log_prob();
 }
 
+// ----------------------------------------------------------------------------------------
+double State::transition_logprob(size_t to_state) {
+  auto it(lower_bound(transitions_->begin(), transitions_->end(), to_state, [](Transition *trans, size_t ist) { return trans->to_state()->index() < ist; }));
+  assert(it != transitions_->end() && (*it)->to_state()->index() == to_state);
+  return (*it)->log_prob();
+}
+
 // ----------------------------------------------------------------------------------------
 // On initial import of the states the allowed transitions are pushed onto <transitions_> in
-// the order written in the model file. But later on we need them to be in the order specified by <index_>, in a vector of length <n_states>.
-// So here we make a new vector <fixed_transitions> with the proper ordering and length <n_states> (each set to nullptr by default), and replace <transitions_> with this
-// new vector.
+// the order written in the model file. But later on we need them to be in the order specified by <index_>, so here we sort them by the
+// index of their to-state (we used to spread them out into a vector of length <n_states>, mostly null, but that's quadratic in the number of states).
 void State::ReorderTransitions(map<string, State*> &state_indices) {
-  size_t n_states(state_indices.size());
-  vector<Transition*> *fixed_transitions = new vector<Transition*>(n_states - 1, nullptr);  // subtract 1 because initial state is kept separate
-
-  // find the proper place for the transition and put it in the correct position
-  for(size_t i = 0; i < transitions_->size(); ++i) {  // reminder: transitions_ and fixed_transitions are not the same length
-    Transition* tmp_trans = (*transitions_)[i];
-    string to_state_name(tmp_trans->to_state_name());
-    assert(state_indices.count(to_state_name));
-    State *to_state(state_indices[to_state_name]);
-    (*fixed_transitions)[to_state->index()] = tmp_trans;
+  for(auto &trans : *transitions_) {
+    assert(state_indices.count(trans->to_state_name()));
+    assert(trans->to_state() == state_indices[trans->to_state_name()]);
   }
-
-  delete transitions_;
-  transitions_ = fixed_transitions;
+  sort(transitions_->begin(), transitions_->end(), [](Transition *lhs, Transition *rhs) { return lhs->to_state()->index() < rhs->to_state()->index(); });
 }
 
 // ----------------------------------------------------------------------------------------
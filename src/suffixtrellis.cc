@@ -0,0 +1,144 @@
+#include "suffixtrellis.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+SuffixTrellis::SuffixTrellis(Model *hmm, SequencesView seqs) :
+  hmm_(hmm),
+  compiled_(hmm->compiled()),
+  seqs_(seqs),
+  n_positions_(seqs.GetSequenceLength()),
+  n_states_(hmm->n_states())
+{
+  to_log_probs_.resize(compiled_->to_end(n_states_ - 1));
+  for(size_t ist = 0; ist < n_states_; ++ist) {
+    for(size_t ito = compiled_->to_begin(ist); ito < compiled_->to_end(ist); ++ito)
+      to_log_probs_[ito] = hmm_->state(ist)->transition_logprob(compiled_->to_indices()[ito]);
+  }
+  if(seqs_.n_seqs() == 1) {
+    columns_.resize(n_positions_);
+    for(size_t position = 0; position < n_positions_; ++position)
+      columns_[position] = hmm_->track()->column(seqs_.value(0, position));
+  } else {
+    seqs_.profile();
+    emission_column_.resize(n_states_);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+const double *SuffixTrellis::EmissionColumn(size_t position) {
+  if(seqs_.n_seqs() == 1)
+    return compiled_->emission_column(columns_[position]);
+  const uint32_t *counts(&seqs_.profile()[position * seqs_.n_profile_columns()]);  // see Trellis::EmissionLogprob()
+  for(size_t ist = 0; ist < n_states_; ++ist)
+    emission_column_[ist] = compiled_->emission_log_prob(ist, counts);
+  return emission_column_.data();
+}
+
+// ----------------------------------------------------------------------------------------
+void SuffixTrellis::Viterbi() {
+  viterbi_vals_.assign(n_positions_ * n_states_, -INFINITY);
+  next_states_.assign(n_positions_ * n_states_, -1);
+  if(n_positions_ == 0)
+    return;
+  for(size_t ist = 0; ist < n_states_; ++ist)  // at the last position, the only thing left to do is end
+    viterbi_vals_[(n_positions_ - 1) * n_states_ + ist] = compiled_->end_log_prob(ist);
+
+  const uint16_t *to_indices(compiled_->to_indices());
+  for(size_t position = n_positions_ - 1; position > 0; --position) {
+    const double *emissions(EmissionColumn(position));
+    const double *next_vals(&viterbi_vals_[position * n_states_]);
+    double *vals(&viterbi_vals_[(position - 1) * n_states_]);
+    int32_t *next_states(&next_states_[(position - 1) * n_states_]);
+    for(size_t ist = 0; ist < n_states_; ++ist) {
+      for(size_t ito = compiled_->to_begin(ist); ito < compiled_->to_end(ist); ++ito) {
+	size_t i_st_next(to_indices[ito]);
+	if(emissions[i_st_next] == -INFINITY || next_vals[i_st_next] == -INFINITY)
+	  continue;
+	double dpval = next_vals[i_st_next] + emissions[i_st_next] + to_log_probs_[ito];
+	if(dpval > vals[ist]) {
+	  vals[ist] = dpval;
+	  next_states[ist] = i_st_next;
+	}
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void SuffixTrellis::Forward() {
+  forward_vals_.assign(n_positions_ * n_states_, -INFINITY);
+  if(n_positions_ == 0)
+    return;
+  for(size_t ist = 0; ist < n_states_; ++ist)
+    forward_vals_[(n_positions_ - 1) * n_states_ + ist] = compiled_->end_log_prob(ist);
+
+  const uint16_t *to_indices(compiled_->to_indices());
+  for(size_t position = n_positions_ - 1; position > 0; --position) {
+    const double *emissions(EmissionColumn(position));
+    const double *next_vals(&forward_vals_[position * n_states_]);
+    double *vals(&forward_vals_[(position - 1) * n_states_]);
+    for(size_t ist = 0; ist < n_states_; ++ist) {
+      for(size_t ito = compiled_->to_begin(ist); ito < compiled_->to_end(ist); ++ito) {
+	size_t i_st_next(to_indices[ito]);
+	if(emissions[i_st_next] == -INFINITY || next_vals[i_st_next] == -INFINITY)
+	  continue;
+	vals[ist] = AddInLogSpace(next_vals[i_st_next] + emissions[i_st_next] + to_log_probs_[ito], vals[ist]);
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+double SuffixTrellis::StartVal(size_t start, bool viterbi, int32_t *start_state) {
+  assert(start < n_positions_);
+  const double *emissions(EmissionColumn(start));
+  const double *vals(viterbi ? &viterbi_vals_[start * n_states_] : &forward_vals_[start * n_states_]);
+  double total(-INFINITY);
+  for(size_t iinit = 0; iinit < compiled_->init_indices().size(); ++iinit) {
+    size_t ist(compiled_->init_indices()[iinit]);
+    if(emissions[ist] == -INFINITY || vals[ist] == -INFINITY)
+      continue;
+    double dpval = compiled_->init_log_probs()[iinit] + emissions[ist] + vals[ist];
+    if(!viterbi) {
+      total = AddInLogSpace(dpval, total);
+    } else if(dpval > total) {
+      total = dpval;
+      *start_state = ist;
+    }
+  }
+  return total;
+}
+
+// ----------------------------------------------------------------------------------------
+double SuffixTrellis::viterbi_log_prob(size_t start) {
+  int32_t start_state(-1);
+  return StartVal(start, true, &start_state);
+}
+
+// ----------------------------------------------------------------------------------------
+double SuffixTrellis::forward_log_prob(size_t start) {
+  return StartVal(start, false, nullptr);
+}
+
+// ----------------------------------------------------------------------------------------
+void SuffixTrellis::Traceback(size_t start, TracebackPath &path) {
+  assert(path.model());
+  path.set_model(hmm_);
+  int32_t state(-1);
+  double score(StartVal(start, true, &state));
+  if(score == -INFINITY)  // no valid path through this hmm
+    return;
+  path.set_score(score);
+
+  vector<int> states;  // forwards from <start>, whereas TracebackPath wants them backwards from the end
+  for(size_t position = start; position < n_positions_; ++position) {
+    states.push_back(state);
+    state = next_states_[position * n_states_ + state];
+  }
+  for(size_t istate = states.size() - 1; istate != SIZE_MAX; --istate)
+    path.push_back(states[istate]);
+  assert(path.size() > 0);
+}
+
+}
@@ -0,0 +1,102 @@
+#include "threadpool.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+ThreadPool::ThreadPool(size_t n_threads) :
+  body_(nullptr),
+  n_iterations_(0),
+  next_iteration_(0),
+  n_done_(0),
+  generation_(0),
+  stopping_(false)
+{
+  for(size_t ithread = 1; ithread < n_threads; ++ithread)
+    workers_.push_back(thread(&ThreadPool::WorkerLoop, this));
+}
+
+// ----------------------------------------------------------------------------------------
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  start_cv_.notify_all();
+  for(auto &worker : workers_)
+    worker.join();
+}
+
+// ----------------------------------------------------------------------------------------
+ThreadPool *ThreadPool::shared(size_t n_threads) {
+  static ThreadPool pool(n_threads);
+  return &pool;
+}
+
+// ----------------------------------------------------------------------------------------
+void ThreadPool::ParallelFor(size_t n_iterations, const function<void(size_t)> &body) {
+  unique_lock<mutex> loop_lock(loop_mutex_, try_to_lock);
+  if(workers_.size() == 0 || n_iterations < 2 || !loop_lock.owns_lock()) {
+    for(size_t iteration = 0; iteration < n_iterations; ++iteration)
+      body(iteration);
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    body_ = &body;
+    n_iterations_ = n_iterations;
+    next_iteration_ = 0;
+    n_done_ = 0;
+    exception_ = nullptr;
+    ++generation_;
+  }
+  start_cv_.notify_all();
+  Work();
+
+  unique_lock<mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return n_done_ == n_iterations_; });
+  body_ = nullptr;
+  exception_ptr exception(exception_);
+  exception_ = nullptr;
+  lock.unlock();
+  if(exception)
+    rethrow_exception(exception);
+}
+
+// ----------------------------------------------------------------------------------------
+void ThreadPool::Work() {
+  unique_lock<mutex> lock(mutex_);
+  while(next_iteration_ < n_iterations_) {
+    size_t iteration(next_iteration_++);
+    const function<void(size_t)> *body(body_);
+    lock.unlock();
+    exception_ptr exception;
+    try {
+      (*body)(iteration);
+    } catch(...) {
+      exception = current_exception();
+    }
+    lock.lock();
+    if(exception && !exception_)
+      exception_ = exception;
+    if(++n_done_ == n_iterations_)
+      done_cv_.notify_all();
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void ThreadPool::WorkerLoop() {
+  size_t generation(0);
+  while(true) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      start_cv_.wait(lock, [&] { return stopping_ || generation_ != generation; });
+      if(stopping_)
+        return;
+      generation = generation_;
+    }
+    Work();
+  }
+}
+
+}
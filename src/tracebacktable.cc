@@ -0,0 +1,34 @@
+#include "tracebacktable.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+TracebackTable::TracebackTable() :
+  compiled_(nullptr),
+  n_positions_(0),
+  n_states_(0),
+  bits_per_cell_(0),
+  cells_per_word_(0),
+  words_per_row_(0),
+  cell_mask_(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------
+void TracebackTable::Init(size_t n_positions, CompiledModel *compiled) {
+  compiled_ = compiled;
+  n_positions_ = n_positions;
+  n_states_ = compiled_->n_states();
+
+  bits_per_cell_ = 1;
+  while(((size_t)1 << bits_per_cell_) <= compiled_->max_n_from())  // need room for max_n_from() offsets plus the "no pointer" value
+    bits_per_cell_ *= 2;
+  assert(bits_per_cell_ <= 16);  // CompiledModel doesn't allow more than UINT16_MAX states
+  cells_per_word_ = 64 / bits_per_cell_;
+  words_per_row_ = (n_states_ + cells_per_word_ - 1) / cells_per_word_;
+  cell_mask_ = ((uint64_t)1 << bits_per_cell_) - 1;
+
+  words_.assign(n_positions_ * words_per_row_, 0);
+}
+
+}
@@ -1,19 +1,35 @@
 #include "trellis.h"
+#include <type_traits>
 
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
-double Trellis::ApproxBytesUsed() {
+// the simd kernels only exist for doubles (and Init() doesn't set <simd_kernels_> for anything else)
+template <> void BasicTrellis<float>::SimdChainViterbiVals(ArenaVector<float>*, ArenaVector<float>*, size_t, TracebackTable*, size_t) {
+  throw runtime_error("ERROR simd kernels called for float trellis");
+}
+
+// ----------------------------------------------------------------------------------------
+template <> void BasicTrellis<float>::SimdChainForwardVals(ArenaVector<float>*, ArenaVector<float>*, size_t) {
+  throw runtime_error("ERROR simd kernels called for float trellis");
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> double BasicTrellis<T>::ApproxBytesUsed() {
   double bytes(0.);
-  // NOTE doesn't include traceback table!
-  bytes += sizeof(double) * viterbi_log_probs_pointer_->size();
-  bytes += sizeof(double) * forward_log_probs_pointer_->size();
+  bytes += sizeof(T) * viterbi_log_probs_pointer_->size();
+  for(auto &column : checkpoint_columns_)
+    bytes += sizeof(T) * column.size();
+  bytes += sizeof(T) * forward_log_probs_pointer_->size();
   bytes += sizeof(int) * viterbi_indices_.size();
+  bytes += traceback_table_.bytes();
+  bytes += sizeof(T) * (scoring_current_.size() + scoring_previous_.size() + chain_vals_.size() + emission_column_.size() + forward_ending_vals_.size() + emission_prob_column_.size());
+  bytes += sizeof(uint8_t) * (columns_.size() + chain_improved_.size());
   return bytes;
 }
 
 // ----------------------------------------------------------------------------------------
-string Trellis::SizeString() {
+template <class T> string BasicTrellis<T>::SizeString() {
   char buffer[2000];
   sprintf(buffer, "%8zu  %8zu  %8zu  %8zu",
 	  viterbi_log_probs_pointer_->size(),
@@ -24,21 +40,12 @@ string Trellis::SizeString() {
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::Trellis(Model* hmm, Sequence seq, Trellis *cached_trellis) :
-  hmm_(hmm),
-  cached_trellis_(cached_trellis),
-  scoring_current_(hmm_->n_states(), -INFINITY),
-  scoring_previous_(hmm_->n_states(), -INFINITY)
-{
-  seqs_.AddSeq(seq);
-  Init();
-}
-
-// ----------------------------------------------------------------------------------------
-Trellis::Trellis(Model* hmm, Sequences seqs, Trellis *cached_trellis) :
+template <class T> BasicTrellis<T>::BasicTrellis(Model* hmm, SequencesView seqs, BasicTrellis *cached_trellis) :
   hmm_(hmm),
   seqs_(seqs),
   cached_trellis_(cached_trellis),
+  checkpoint_interval_(0),
+  scaled_forward_(false),
   scoring_current_(hmm_->n_states(), -INFINITY),
   scoring_previous_(hmm_->n_states(), -INFINITY)
 {
@@ -46,13 +53,13 @@ Trellis::Trellis(Model* hmm, Sequences seqs, Trellis *cached_trellis) :
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::Trellis() : hmm_(nullptr), cached_trellis_(nullptr)
+template <class T> BasicTrellis<T>::BasicTrellis() : hmm_(nullptr), compiled_(nullptr), cached_trellis_(nullptr), checkpoint_interval_(0), scaled_forward_(false)
 {
   Init();
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::Init() {
+template <class T> void BasicTrellis<T>::Init() {
   if(cached_trellis_) {
     if(seqs_.GetSequenceLength() > cached_trellis_->seqs().GetSequenceLength())
       throw runtime_error("ERROR cached trellis sequence length " + to_string(cached_trellis_->seqs().GetSequenceLength()) + " smaller than mine " + to_string(seqs_.GetSequenceLength()));
@@ -60,6 +67,27 @@ void Trellis::Init() {
       throw runtime_error("ERROR model in cached trellis " + cached_trellis_->model()->name() + " not the same as mine " + hmm_->name());
   }
 
+  compiled_ = hmm_ ? hmm_->compiled() : nullptr;
+  transition_scores_ = compiled_ ? &compiled_->transition_scores<T>() : nullptr;
+  emission_scores_ = compiled_ ? &compiled_->emission_scores<T>() : nullptr;
+  chain_kernels_ = compiled_ && compiled_->is_chain();
+  simd_kernels_ = chain_kernels_ && is_same<T, double>::value ? simd_kernels() : nullptr;
+  if(compiled_ && seqs_.n_seqs() == 1) {  // look up the emission table column once, rather than in every column for every state
+    columns_.resize(seqs_.GetSequenceLength());
+    for(size_t position = 0; position < seqs_.GetSequenceLength(); ++position)
+      columns_[position] = hmm_->track()->column(seqs_.value(0, position));
+  } else if(compiled_ && seqs_.n_seqs() > 1) {
+    seqs_.profile();  // make sure it's calculated before we start
+    assert(seqs_.n_profile_columns() == compiled_->n_columns());
+  }
+  if(chain_kernels_) {
+    chain_vals_.resize(compiled_->n_states());
+    if(simd_kernels_)
+      chain_improved_.resize(compiled_->n_states());
+    if(seqs_.n_seqs() > 1)
+      emission_column_.resize(compiled_->n_states());
+  }
+
   traceback_table_pointer_ = nullptr;
   viterbi_log_probs_pointer_ = nullptr;
   forward_log_probs_pointer_ = nullptr;
@@ -72,11 +100,11 @@ void Trellis::Init() {
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::~Trellis() {
+template <class T> BasicTrellis<T>::~BasicTrellis() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::Dump() {
+template <class T> void BasicTrellis<T>::Dump() {
   for(size_t ipos = 0; ipos < seqs_.GetSequenceLength(); ++ipos) {
     cout
         << setw(12) << hmm_->state(viterbi_indices_[ipos])->name()[0]
@@ -86,69 +114,269 @@ void Trellis::Dump() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position) {
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!current_states[i_st_current])  // check if transition to this state is allowed from any state through which we passed at the previous position
-      continue;
-
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
+template <class T> void BasicTrellis<T>::MiddleViterbiVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, Frontier &current_states, Frontier &next_states, size_t position, TracebackTable *traceback_table, size_t traceback_row) {
+  if(chain_kernels_) {
+    ChainViterbiVals(scoring_previous, scoring_current, position, traceback_table, traceback_row);
+    return;
+  }
+  const uint16_t *from_indices(compiled_->from_indices());
+  const T *from_log_probs(transition_scores_->from_log_probs.data());
+  for(auto &i_st_current : current_states) {  // only the states to which we can transition from any state through which we passed at the previous position
+    bool reached(false);
+    T emission_val = EmissionLogprob(i_st_current, position);
     if(emission_val == -INFINITY)
       continue;
 
-    for(auto &i_st_previous : *hmm_->state(i_st_current)->from_state_indices()) {  // list of states from which we could've arrived at <i_st_current>
+    for(size_t ifrom = compiled_->from_begin(i_st_current); ifrom < compiled_->from_end(i_st_current); ++ifrom) {  // list of states from which we could've arrived at <i_st_current>
+      size_t i_st_previous(from_indices[ifrom]);
       if((*scoring_previous)[i_st_previous] == -INFINITY)  // skip if <i_st_previous> was a dead end, i.e. that row in the previous column had zero probability
 	continue;
-      double dpval = (*scoring_previous)[i_st_previous] + emission_val + hmm_->state(i_st_previous)->transition_logprob(i_st_current);
+      T dpval = (emission_val + from_log_probs[ifrom]) + (*scoring_previous)[i_st_previous];
       if(dpval > (*scoring_current)[i_st_current]) {
 	(*scoring_current)[i_st_current] = dpval;  // save this value as the best value we've so far come across
-	(*traceback_table_pointer_)[position][i_st_current] = i_st_previous;  // and mark which state it came from for later traceback NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
+	if(traceback_table)
+	  traceback_table->set(traceback_row, i_st_current, ifrom - compiled_->from_begin(i_st_current));  // and mark which state it came from for later traceback
       }
       CacheViterbiVals(position, dpval, i_st_current);
-      next_states |= (*hmm_->state(i_st_current)->to_states());  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
+      reached = true;
     }
+    if(reached)  // NOTE only add <i_st_current>'s to-states if we actually got here from a live previous state
+      next_states.Add(compiled_->to_indices() + compiled_->to_begin(i_st_current), compiled_->to_indices() + compiled_->to_end(i_st_current));
   }
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position) {
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!current_states[i_st_current])  // check if transition to this state is allowed from any state through which we passed at the previous position
-      continue;
-
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
+template <class T> void BasicTrellis<T>::MiddleForwardVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, Frontier &current_states, Frontier &next_states, size_t position) {
+  if(chain_kernels_) {
+    ChainForwardVals(scoring_previous, scoring_current, position);
+    return;
+  }
+  const uint16_t *from_indices(compiled_->from_indices());
+  const T *from_log_probs(transition_scores_->from_log_probs.data());
+  for(auto &i_st_current : current_states) {  // only the states to which we can transition from any state through which we passed at the previous position
+    bool reached(false);
+    T emission_val = EmissionLogprob(i_st_current, position);
     if(emission_val == -INFINITY)
       continue;
 
-    for(auto &i_st_previous : *hmm_->state(i_st_current)->from_state_indices()) {  // list of states from which we could've arrived at <i_st_current>
+    for(size_t ifrom = compiled_->from_begin(i_st_current); ifrom < compiled_->from_end(i_st_current); ++ifrom) {  // list of states from which we could've arrived at <i_st_current>
+      size_t i_st_previous(from_indices[ifrom]);
       if((*scoring_previous)[i_st_previous] == -INFINITY)  // skip if <i_st_previous> was a dead end, i.e. that row in the previous column had zero probability
 	continue;
-      double dpval = (*scoring_previous)[i_st_previous] + emission_val + hmm_->state(i_st_previous)->transition_logprob(i_st_current);
+      T dpval = (emission_val + from_log_probs[ifrom]) + (*scoring_previous)[i_st_previous];
       (*scoring_current)[i_st_current] = AddInLogSpace(dpval, (*scoring_current)[i_st_current]);
       CacheForwardVals(position, dpval, i_st_current);
-      next_states |= (*hmm_->state(i_st_current)->to_states());  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
+      reached = true;
     }
+    if(reached)  // NOTE only add <i_st_current>'s to-states if we actually got here from a live previous state
+      next_states.Add(compiled_->to_indices() + compiled_->to_begin(i_st_current), compiled_->to_indices() + compiled_->to_end(i_st_current));
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> const T *BasicTrellis<T>::EmissionColumn(size_t position) {
+  if(seqs_.n_seqs() == 1)
+    return &emission_scores_->emissions_by_column[columns_[position] * compiled_->n_states()];
+  for(size_t ist = 0; ist < compiled_->n_states(); ++ist)
+    emission_column_[ist] = EmissionLogprob(ist, position);
+  return emission_column_.data();
+}
+
+// ----------------------------------------------------------------------------------------
+// dp values for all the chain edges at once, i.e. coming into each state from the one before it (these loops are just streaming over contiguous arrays)
+// NOTE we add things up in the same order as the generic kernels, i.e. the emission and transition first and then the previous value, so we get exactly the same values
+template <class T> void BasicTrellis<T>::FillChainVals(ArenaVector<T> *scoring_previous, const T *emissions) {
+  const T *previous(scoring_previous->data());
+  const T *chain_log_probs(transition_scores_->chain_log_probs.data());
+  T *chain_vals(chain_vals_.data());
+  chain_vals[0] = -INFINITY;
+  for(size_t ist = 1; ist < compiled_->n_states(); ++ist)  // NOTE separate loop, so the compiler can't reassociate it
+    chain_vals[ist] = emissions[ist] + chain_log_probs[ist];
+  for(size_t ist = 1; ist < compiled_->n_states(); ++ist)
+    chain_vals[ist] += previous[ist - 1];
+}
+
+// ----------------------------------------------------------------------------------------
+// Same as MiddleViterbiVals(), except we take the chain edges from <chain_vals_> after going through each state's residual edges (which
+// is where they'd be in the from-list). Since we fill in every state, we don't need to reset <scoring_current> first.
+template <class T> void BasicTrellis<T>::ChainViterbiVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position, TracebackTable *traceback_table, size_t traceback_row) {
+  if(simd_kernels_) {
+    SimdChainViterbiVals(scoring_previous, scoring_current, position, traceback_table, traceback_row);
+    return;
   }
+  const uint16_t *from_indices(compiled_->from_indices());
+  const T *from_log_probs(transition_scores_->from_log_probs.data());
+  const T *emissions(EmissionColumn(position));
+  FillChainVals(scoring_previous, emissions);
+  for(size_t i_st_current = 0; i_st_current < compiled_->n_states(); ++i_st_current) {
+    T &current((*scoring_current)[i_st_current]);
+    current = -INFINITY;
+    T emission_val = emissions[i_st_current];
+    if(emission_val == -INFINITY)
+      continue;
+
+    size_t residual_end(compiled_->residual_end(i_st_current));
+    for(size_t ifrom = compiled_->from_begin(i_st_current); ifrom < residual_end; ++ifrom) {
+      size_t i_st_previous(from_indices[ifrom]);
+      if((*scoring_previous)[i_st_previous] == -INFINITY)
+	continue;
+      T dpval = (emission_val + from_log_probs[ifrom]) + (*scoring_previous)[i_st_previous];
+      if(dpval > current) {
+	current = dpval;
+	if(traceback_table)
+	  traceback_table->set(traceback_row, i_st_current, ifrom - compiled_->from_begin(i_st_current));
+      }
+    }
+    if(chain_vals_[i_st_current] > current) {
+      current = chain_vals_[i_st_current];
+      if(traceback_table)
+	traceback_table->set(traceback_row, i_st_current, residual_end - compiled_->from_begin(i_st_current));  // i.e. the last entry in the from-list
+    }
+    if(current != -INFINITY)  // NOTE only caching the best value for each state gives the same result as caching every dpval, since adding the end transition doesn't change the ordering
+      CacheViterbiVals(position, current, i_st_current);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> void BasicTrellis<T>::ChainForwardVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position) {
+  if(simd_kernels_) {
+    SimdChainForwardVals(scoring_previous, scoring_current, position);
+    return;
+  }
+  const uint16_t *from_indices(compiled_->from_indices());
+  const T *from_log_probs(transition_scores_->from_log_probs.data());
+  const T *emissions(EmissionColumn(position));
+  FillChainVals(scoring_previous, emissions);
+  for(size_t i_st_current = 0; i_st_current < compiled_->n_states(); ++i_st_current) {
+    T &current((*scoring_current)[i_st_current]);
+    current = -INFINITY;
+    T emission_val = emissions[i_st_current];
+    if(emission_val == -INFINITY)
+      continue;
+
+    for(size_t ifrom = compiled_->from_begin(i_st_current); ifrom < compiled_->residual_end(i_st_current); ++ifrom) {
+      size_t i_st_previous(from_indices[ifrom]);
+      if((*scoring_previous)[i_st_previous] == -INFINITY)
+	continue;
+      T dpval = (emission_val + from_log_probs[ifrom]) + (*scoring_previous)[i_st_previous];
+      current = AddInLogSpace(dpval, current);
+      CacheForwardVals(position, dpval, i_st_current);
+    }
+    if(chain_vals_[i_st_current] != -INFINITY) {
+      current = AddInLogSpace(chain_vals_[i_st_current], current);
+      CacheForwardVals(position, chain_vals_[i_st_current], i_st_current);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Same result as ChainViterbiVals(), but we go through the residual edges first for all the states (there's only a few states with residual
+// edges), and then merge in the chain edges and find the best ending value with the vectorized kernels.
+template <class T> void BasicTrellis<T>::SimdChainViterbiVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position, TracebackTable *traceback_table, size_t traceback_row) {
+  size_t n_states(compiled_->n_states());
+  const uint16_t *from_indices(compiled_->from_indices());
+  const T *from_log_probs(transition_scores_->from_log_probs.data());
+  const T *emissions(EmissionColumn(position));
+  simd_kernels_->chain_vals(emissions, transition_scores_->chain_log_probs.data(), scoring_previous->data(), chain_vals_.data(), n_states);
+
+  scoring_current->assign(n_states, -INFINITY);
+  for(auto &i_st_current : compiled_->residual_states()) {
+    T emission_val = emissions[i_st_current];
+    if(emission_val == -INFINITY)
+      continue;
+    T &current((*scoring_current)[i_st_current]);
+    for(size_t ifrom = compiled_->from_begin(i_st_current); ifrom < compiled_->residual_end(i_st_current); ++ifrom) {
+      size_t i_st_previous(from_indices[ifrom]);
+      if((*scoring_previous)[i_st_previous] == -INFINITY)
+	continue;
+      T dpval = (emission_val + from_log_probs[ifrom]) + (*scoring_previous)[i_st_previous];
+      if(dpval > current) {
+	current = dpval;
+	if(traceback_table)
+	  traceback_table->set(traceback_row, i_st_current, ifrom - compiled_->from_begin(i_st_current));
+      }
+    }
+  }
+
+  simd_kernels_->viterbi_merge(chain_vals_.data(), scoring_current->data(), chain_improved_.data(), n_states);
+  if(traceback_table) {
+    for(size_t i_st_current = 0; i_st_current < n_states; ++i_st_current) {
+      if(chain_improved_[i_st_current])
+	traceback_table->set(traceback_row, i_st_current, compiled_->residual_end(i_st_current) - compiled_->from_begin(i_st_current));
+    }
+  }
+
+  double best_ending_val(-INFINITY);
+  size_t i_st_best(simd_kernels_->viterbi_best_ending(scoring_current->data(), transition_scores_->end_log_probs.data(), n_states, &best_ending_val));
+  if(i_st_best != SIZE_MAX && best_ending_val > viterbi_log_probs_[position]) {  // same as calling CacheViterbiVals() for each state
+    viterbi_log_probs_[position] = best_ending_val;
+    viterbi_indices_[position] = i_st_best;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE unlike SimdChainViterbiVals(), this differs from the scalar version by a few ulps, since it uses its own exp() and log(), and since we add up
+// the ending values all at once (which is the same thing as calling CacheForwardVals() for each incoming edge, but in a different order).
+template <class T> void BasicTrellis<T>::SimdChainForwardVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position) {
+  size_t n_states(compiled_->n_states());
+  const uint16_t *from_indices(compiled_->from_indices());
+  const T *from_log_probs(transition_scores_->from_log_probs.data());
+  const T *emissions(EmissionColumn(position));
+  simd_kernels_->chain_vals(emissions, transition_scores_->chain_log_probs.data(), scoring_previous->data(), chain_vals_.data(), n_states);
+
+  scoring_current->assign(n_states, -INFINITY);
+  for(auto &i_st_current : compiled_->residual_states()) {
+    T emission_val = emissions[i_st_current];
+    if(emission_val == -INFINITY)
+      continue;
+    T &current((*scoring_current)[i_st_current]);
+    for(size_t ifrom = compiled_->from_begin(i_st_current); ifrom < compiled_->residual_end(i_st_current); ++ifrom) {
+      size_t i_st_previous(from_indices[ifrom]);
+      if((*scoring_previous)[i_st_previous] == -INFINITY)
+	continue;
+      T dpval = (emission_val + from_log_probs[ifrom]) + (*scoring_previous)[i_st_previous];
+      current = AddInLogSpace(dpval, current);
+    }
+  }
+
+  simd_kernels_->forward_merge(chain_vals_.data(), scoring_current->data(), n_states);
+  double ending_val(simd_kernels_->forward_ending_sum(scoring_current->data(), transition_scores_->end_log_probs.data(), n_states));
+  forward_log_probs_[position] = AddInLogSpace(ending_val, forward_log_probs_[position]);
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states) {
-  // swap <scoring_current> and <scoring_previous>, and set <scoring_current> values to -INFINITY
+// for chain models, every state is always live (the chain kernels fill in every state in every column)
+template <class T> void BasicTrellis<T>::InitFrontiers(Frontier &previous_states, Frontier &current_states, Frontier &next_states) {
+  if(!chain_kernels_)
+    return;
+  previous_states.Fill();
+  current_states.Fill();
+  next_states.Fill();
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> void BasicTrellis<T>::SwapColumns(ArenaVector<T> *&scoring_previous, ArenaVector<T> *&scoring_current, Frontier &previous_states, Frontier &current_states, Frontier &next_states) {
+  // swap <scoring_current> and <scoring_previous>, and set <scoring_current> values to -INFINITY (it only has values for the states that were live two columns ago)
   swap_ptr_ = scoring_previous;
   scoring_previous = scoring_current;
   scoring_current = swap_ptr_;
-  scoring_current->assign(hmm_->n_states(), -INFINITY);
   swap_ptr_ = nullptr;
-
-  // swap the <current_states> and <next_states> bitsets (ie set current_states to the states to which we can transition from *any* of the previous states)
-  current_states.reset();
-  current_states |= next_states;
-  next_states.reset();
+  if(chain_kernels_)  // the chain kernels overwrite the whole column, and the frontiers always have every state
+    return;
+  for(auto &ist : previous_states)
+    (*scoring_current)[ist] = -INFINITY;
+
+  // rotate the frontiers (ie set current_states to the states to which we can transition from *any* of the previous states)
+  previous_states.swap(current_states);
+  current_states.swap(next_states);
+  current_states.Sort();
+  next_states.Clear();
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::CacheViterbiVals(size_t position, double dpval, size_t i_st_current) {
-  double end_trans_val = hmm_->state(i_st_current)->end_transition_logprob();
-  double logprob = dpval + end_trans_val;
+template <class T> void BasicTrellis<T>::CacheViterbiVals(size_t position, T dpval, size_t i_st_current) {
+  T end_trans_val = transition_scores_->end_log_probs[i_st_current];
+  T logprob = dpval + end_trans_val;
   if(logprob > viterbi_log_probs_[position]) {
     viterbi_log_probs_[position] = logprob;  // since this is the log prob of *ending* at this point, we have to add on the prob of going to the end state from this state
     viterbi_indices_[position] = i_st_current;
@@ -156,14 +384,34 @@ void Trellis::CacheViterbiVals(size_t position, double dpval, size_t i_st_curren
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::CacheForwardVals(size_t position, double dpval, size_t i_st_current) {
-  double end_trans_val = hmm_->state(i_st_current)->end_transition_logprob();
-  double logprob = dpval + end_trans_val;
+template <class T> void BasicTrellis<T>::CacheForwardVals(size_t position, T dpval, size_t i_st_current) {
+  T end_trans_val = transition_scores_->end_log_probs[i_st_current];
+  T logprob = dpval + end_trans_val;
+  if(log_sum_exp_mode() == kFastLogSumExp) {  // NOTE adding them up all at once gives a slightly different answer (adds in a different order), which is why we don't do it in exact mode
+    forward_ending_vals_.push_back(logprob);
+    return;
+  }
   forward_log_probs_[position] = AddInLogSpace(logprob, forward_log_probs_[position]);
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::Viterbi() {
+template <class T> void BasicTrellis<T>::FlushForwardVals(size_t position) {
+  if(forward_ending_vals_.size() == 0)
+    return;
+  forward_log_probs_[position] = AddInLogSpace(LogSumExp(forward_ending_vals_.data(), forward_ending_vals_.size()), forward_log_probs_[position]);
+  forward_ending_vals_.clear();
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> void BasicTrellis<T>::SetCheckpointInterval(int interval) {
+  if(interval < 0)  // roughly minimizes the total of checkpoint columns plus the segment table we need during traceback
+    checkpoint_interval_ = max(1, (int)round(sqrt(seqs_.GetSequenceLength())));
+  else
+    checkpoint_interval_ = interval;
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> void BasicTrellis<T>::Viterbi() {
   if(cached_trellis_) {   // ok, rad, we have another trellis with the dp table already filled in, so we can just poach the values we need from there
     traceback_table_pointer_ = cached_trellis_->traceback_table_pointer();  // note that the table from the cached trellis is larger than we need right now (that's the whole point, after all)
     ending_viterbi_pointer_ = cached_trellis_->viterbi_pointer(seqs_.GetSequenceLength());
@@ -179,46 +427,54 @@ void Trellis::Viterbi() {
   viterbi_log_probs_pointer_ = &viterbi_log_probs_;
   viterbi_indices_pointer_ = &viterbi_indices_;
 
-  traceback_table_ = int_2D(seqs_.GetSequenceLength(), vector<int16_t>(hmm_->n_states(), -1));
-  traceback_table_pointer_ = &traceback_table_;
+  if(checkpoint_interval_ == 0) {
+    traceback_table_.Init(seqs_.GetSequenceLength(), compiled_);
+    traceback_table_pointer_ = &traceback_table_;
+  } else {
+    checkpoint_columns_.clear();
+  }
 
-  vector<double> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
-  vector<double> *scoring_previous = &scoring_previous_;  // same, but for the previous position
+  ArenaVector<T> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
+  ArenaVector<T> *scoring_previous = &scoring_previous_;  // same, but for the previous position
   scoring_current->assign(scoring_current->size(), -INFINITY);
   scoring_previous->assign(scoring_previous->size(), -INFINITY);
-  bitset<STATE_MAX> next_states, current_states;  // bitset of states which we need to check at the next/current position
+  Frontier previous_states(compiled_->n_states()), current_states(compiled_->n_states()), next_states(compiled_->n_states());  // states which are live at the previous/current position, and which we need to check at the next one
+  InitFrontiers(previous_states, current_states, next_states);
 
   // first calculate log probs for first position in sequence
   size_t position(0);
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!(*hmm_->initial_to_states())[i_st_current])  // skip <i_st_current> if there's no transition to it from <init>
-      continue;
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
-    double dpval = emission_val + hmm_->init_state()->transition_logprob(i_st_current);
+  for(size_t iinit = 0; iinit < compiled_->init_indices().size(); ++iinit) {  // only look at states to which there's a transition from <init>
+    size_t i_st_current(compiled_->init_indices()[iinit]);
+    T emission_val = EmissionLogprob(i_st_current, position);
+    T dpval = emission_val + transition_scores_->init_log_probs[iinit];
     if(dpval == -INFINITY)
       continue;
     (*scoring_current)[i_st_current] = dpval;
+    current_states.Add(i_st_current);
     CacheViterbiVals(position, dpval, i_st_current);
-    next_states |= (*hmm_->state(i_st_current)->to_states());  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next position (column)
+    next_states.Add(compiled_->to_indices() + compiled_->to_begin(i_st_current), compiled_->to_indices() + compiled_->to_end(i_st_current));  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next position (column)
   }
-
+  if(checkpoint_interval_ > 0)
+    checkpoint_columns_.push_back(*scoring_current);
 
   // then loop over the rest of the sequence
   for(size_t position = 1; position < seqs_.GetSequenceLength(); ++position) {
-    SwapColumns(scoring_previous, scoring_current, current_states, next_states);
-    MiddleViterbiVals(scoring_previous, scoring_current, current_states, next_states, position);
+    SwapColumns(scoring_previous, scoring_current, previous_states, current_states, next_states);
+    MiddleViterbiVals(scoring_previous, scoring_current, current_states, next_states, position, checkpoint_interval_ == 0 ? &traceback_table_ : nullptr, position);
+    if(checkpoint_interval_ > 0 && position % checkpoint_interval_ == 0)
+      checkpoint_columns_.push_back(*scoring_current);
   }
 
-  SwapColumns(scoring_previous, scoring_current, current_states, next_states);
+  SwapColumns(scoring_previous, scoring_current, previous_states, current_states, next_states);
 
   // NOTE now that I've got the chunk caching info, it may be possible to remove this
   // calculate ending probability and get final traceback pointer
   ending_viterbi_pointer_ = -1;
   ending_viterbi_log_prob_ = -INFINITY;
-  for(size_t st_previous = 0; st_previous < hmm_->n_states(); ++st_previous) {
+  for(auto &st_previous : previous_states) {  // i.e. the states that were live in the last column
     if((*scoring_previous)[st_previous] == -INFINITY)
       continue;
-    double dpval = (*scoring_previous)[st_previous] + hmm_->state(st_previous)->end_transition_logprob();
+    T dpval = (*scoring_previous)[st_previous] + transition_scores_->end_log_probs[st_previous];
     if(dpval > ending_viterbi_log_prob_) {
       ending_viterbi_log_prob_ = dpval;  // NOTE should *not* be replaced by last entry in viterbi_log_probs_, since that does not include the ending transition
       ending_viterbi_pointer_ = st_previous;
@@ -227,7 +483,76 @@ void Trellis::Viterbi() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::Forward() {
+// copy the viterbi results for lane (or gene) <ilane> out of a BatchTrellis or TrieTrellis
+template <class T> template <class BatchT> void BasicTrellis<T>::AdoptBatchViterbi(BatchT &batch, size_t ilane) {
+  if(cached_trellis_ || checkpoint_interval_ > 0)
+    throw runtime_error("ERROR can only adopt batch viterbi results into an uncached, uncheckpointed trellis");
+  if(batch.n_positions() != seqs_.GetSequenceLength())
+    throw runtime_error("ERROR batch trellis length " + to_string(batch.n_positions()) + " not the same as mine " + to_string(seqs_.GetSequenceLength()));
+
+  viterbi_log_probs_.resize(seqs_.GetSequenceLength());
+  viterbi_indices_.resize(seqs_.GetSequenceLength());
+  for(size_t position = 0; position < seqs_.GetSequenceLength(); ++position) {
+    viterbi_log_probs_[position] = batch.viterbi_log_prob(ilane, position);
+    viterbi_indices_[position] = batch.viterbi_index(ilane, position);
+  }
+  viterbi_log_probs_pointer_ = &viterbi_log_probs_;
+  viterbi_indices_pointer_ = &viterbi_indices_;
+  traceback_table_ = batch.traceback_table(ilane);
+  traceback_table_pointer_ = &traceback_table_;
+  ending_viterbi_log_prob_ = batch.ending_viterbi_log_prob(ilane);
+  ending_viterbi_pointer_ = batch.ending_viterbi_pointer(ilane);
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> void BasicTrellis<T>::AdoptViterbi(BatchTrellis &batch, size_t ilane) {
+  AdoptBatchViterbi(batch, ilane);
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> void BasicTrellis<T>::AdoptViterbi(TrieTrellis &trie_trell, size_t igene) {
+  AdoptBatchViterbi(trie_trell, igene);
+}
+
+// ----------------------------------------------------------------------------------------
+// In Viterbi(), the states that are live in a column are the ones with a value other than -INFINITY (plus, possibly, a few that we reached
+// only with -INFINITY), and the next ones to check are their to-states. So we can get the frontiers back from the checkpoint column alone: any
+// states we leave out could only come from -INFINITY values, so they'd be skipped anyway, and we get the same values and pointers.
+// For chain models the frontiers always have every state.
+template <class T> void BasicTrellis<T>::RebuildFrontiers(ArenaVector<T> &scoring_column, Frontier &previous_states, Frontier &current_states, Frontier &next_states) {
+  InitFrontiers(previous_states, current_states, next_states);
+  if(chain_kernels_)
+    return;
+  for(size_t ist = 0; ist < compiled_->n_states(); ++ist) {
+    if(scoring_column[ist] == -INFINITY)
+      continue;
+    current_states.Add(ist);
+    next_states.Add(compiled_->to_indices() + compiled_->to_begin(ist), compiled_->to_indices() + compiled_->to_end(ist));
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Rerun the viterbi recursion from the checkpoint column at <start> through <end> (inclusive), filling in the traceback pointers for
+// positions <start> + 1 through <end> in <segment_table> (whose zeroth row corresponds to position <start> + 1).
+// Since we do exactly the same operations in the same order as in Viterbi(), we get exactly the same pointers as the full table would have.
+template <class T> void BasicTrellis<T>::RecomputeTracebackSegment(size_t start, size_t end, TracebackTable &segment_table) {
+  assert(checkpoint_interval_ > 0 && start % checkpoint_interval_ == 0);
+  size_t icheckpoint(start / checkpoint_interval_);
+  assert(icheckpoint < checkpoint_columns_.size());
+
+  ArenaVector<T> scoring_a(checkpoint_columns_[icheckpoint]), scoring_b(compiled_->n_states(), -INFINITY);
+  ArenaVector<T> *scoring_current(&scoring_a), *scoring_previous(&scoring_b);
+  Frontier previous_states(compiled_->n_states()), current_states(compiled_->n_states()), next_states(compiled_->n_states());
+  RebuildFrontiers(scoring_a, previous_states, current_states, next_states);
+  for(size_t position = start + 1; position <= end; ++position) {
+    SwapColumns(scoring_previous, scoring_current, previous_states, current_states, next_states);
+    segment_table.clear_row(position - start - 1);
+    MiddleViterbiVals(scoring_previous, scoring_current, current_states, next_states, position, &segment_table, position - start - 1);  // NOTE this also redoes CacheViterbiVals(), which is harmless since it gets the same values
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> void BasicTrellis<T>::Forward() {
   if(cached_trellis_) {
     ending_forward_log_prob_ = cached_trellis_->ending_forward_log_prob(seqs_.GetSequenceLength());
     forward_log_probs_pointer_ = cached_trellis_->forward_log_probs_pointer();
@@ -237,48 +562,155 @@ void Trellis::Forward() {
   // initialize stored values for chunk caching
   forward_log_probs_.resize(seqs_.GetSequenceLength(), -INFINITY);
   forward_log_probs_pointer_ = &forward_log_probs_;
+  if(scaled_forward_) {
+    ScaledForward();
+    return;
+  }
 
-  vector<double> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
-  vector<double> *scoring_previous = &scoring_previous_;  // same, but for the previous position
+  ArenaVector<T> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
+  ArenaVector<T> *scoring_previous = &scoring_previous_;  // same, but for the previous position
   scoring_current->assign(scoring_current->size(), -INFINITY);
   scoring_previous->assign(scoring_previous->size(), -INFINITY);
-  bitset<STATE_MAX> next_states, current_states;  // bitset of states which we need to check at the next/current position
+  Frontier previous_states(compiled_->n_states()), current_states(compiled_->n_states()), next_states(compiled_->n_states());  // states which are live at the previous/current position, and which we need to check at the next one
+  InitFrontiers(previous_states, current_states, next_states);
 
   // first calculate log probs for first position in sequence
   size_t position(0);
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!(*hmm_->initial_to_states())[i_st_current])  // skip <i_st_current> if there's no transition to it from <init>
-      continue;
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
-    double dpval = emission_val + hmm_->init_state()->transition_logprob(i_st_current);
+  for(size_t iinit = 0; iinit < compiled_->init_indices().size(); ++iinit) {  // only look at states to which there's a transition from <init>
+    size_t i_st_current(compiled_->init_indices()[iinit]);
+    T emission_val = EmissionLogprob(i_st_current, position);
+    T dpval = emission_val + transition_scores_->init_log_probs[iinit];
     if(dpval == -INFINITY)
       continue;
     (*scoring_current)[i_st_current] = dpval;
-    next_states |= (*hmm_->state(i_st_current)->to_states());  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next column. This leaves <next_states> set to the OR of all states to which we can transition from if start from a state to which we can transition from <init>
+    current_states.Add(i_st_current);
+    next_states.Add(compiled_->to_indices() + compiled_->to_begin(i_st_current), compiled_->to_indices() + compiled_->to_end(i_st_current));  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next column. This leaves <next_states> set to the OR of all states to which we can transition from if start from a state to which we can transition from <init>
     CacheForwardVals(position, dpval, i_st_current);
   }
+  FlushForwardVals(position);
 
   // then loop over the rest of the sequence
   for(position = 1; position < seqs_.GetSequenceLength(); ++position) {
-    SwapColumns(scoring_previous, scoring_current, current_states, next_states);
+    SwapColumns(scoring_previous, scoring_current, previous_states, current_states, next_states);
     MiddleForwardVals(scoring_previous, scoring_current, current_states, next_states, position);
+    FlushForwardVals(position);
   }
 
-  SwapColumns(scoring_previous, scoring_current, current_states, next_states);
+  SwapColumns(scoring_previous, scoring_current, previous_states, current_states, next_states);
 
   ending_forward_log_prob_ = -INFINITY;
-  for(size_t st_previous = 0; st_previous < hmm_->n_states(); ++st_previous) {
+  for(auto &st_previous : previous_states) {  // i.e. the states that were live in the last column
     if((*scoring_previous)[st_previous] == -INFINITY)
       continue;
-    double dpval = (*scoring_previous)[st_previous] + hmm_->state(st_previous)->end_transition_logprob();
+    T dpval = (*scoring_previous)[st_previous] + transition_scores_->end_log_probs[st_previous];
     if(dpval == -INFINITY)
       continue;
-    ending_forward_log_prob_ = AddInLogSpace(ending_forward_log_prob_, dpval);
+    ending_forward_log_prob_ = AddInLogSpace<double>(ending_forward_log_prob_, dpval);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Forward() in linear space: <scoring_current> holds the probability of each state divided by the product of all the scale factors so far
+// (whose log is <log_scale>). We fill in every state in every column, so we don't need the frontiers.
+template <class T> void BasicTrellis<T>::ScaledForward() {
+  compiled_->transition_scores<T>(true);  // make sure the plain probs are there (they're in the same tables we're already pointing at)
+  compiled_->emission_scores<T>(true);
+  ArenaVector<T> *scoring_current = &scoring_current_;  // NOTE these hold rescaled probabilities, not log probs
+  ArenaVector<T> *scoring_previous = &scoring_previous_;
+  scoring_current->assign(compiled_->n_states(), 0.);
+  scoring_previous->assign(compiled_->n_states(), 0.);
+  double log_scale(0.);
+
+  size_t position(0);
+  const T *emissions(EmissionProbColumn(position, &log_scale));
+  for(size_t iinit = 0; iinit < compiled_->init_indices().size(); ++iinit) {
+    size_t i_st_current(compiled_->init_indices()[iinit]);
+    (*scoring_current)[i_st_current] = transition_scores_->init_probs[iinit] * emissions[i_st_current];
+  }
+  if(!RescaleColumn(scoring_current, position, &log_scale))
+    return;  // no valid path, so all the forward log probs stay at -INFINITY
+
+  for(position = 1; position < seqs_.GetSequenceLength(); ++position) {
+    swap_ptr_ = scoring_previous;
+    scoring_previous = scoring_current;
+    scoring_current = swap_ptr_;
+    ScaledForwardVals(scoring_previous, scoring_current, position, &log_scale);
+    if(!RescaleColumn(scoring_current, position, &log_scale))
+      return;
+  }
+
+  ending_forward_log_prob_ = forward_log_probs_[seqs_.GetSequenceLength() - 1];
+}
+
+// ----------------------------------------------------------------------------------------
+// The chain edges (which are all zero for models that aren't chains) and the emissions are just multiplies over contiguous arrays, so those loops
+// vectorize. The residual edges are a sum over each state's from-list.
+template <class T> void BasicTrellis<T>::ScaledForwardVals(ArenaVector<T> *scoring_previous, ArenaVector<T> *scoring_current, size_t position, double *log_scale) {
+  size_t n_states(compiled_->n_states());
+  const T *previous(scoring_previous->data());
+  T *current(scoring_current->data());
+  const T *chain_probs(transition_scores_->chain_probs.data());
+  const uint16_t *from_indices(compiled_->from_indices());
+  const T *from_probs(transition_scores_->from_probs.data());
+  const T *emissions(EmissionProbColumn(position, log_scale));
+
+  current[0] = 0.;
+  for(size_t ist = 1; ist < n_states; ++ist)
+    current[ist] = chain_probs[ist] * previous[ist - 1];
+  for(auto &i_st_current : compiled_->residual_states()) {
+    T total(current[i_st_current]);
+    for(size_t ifrom = compiled_->from_begin(i_st_current); ifrom < compiled_->residual_end(i_st_current); ++ifrom)
+      total += previous[from_indices[ifrom]] * from_probs[ifrom];
+    current[i_st_current] = total;
   }
+  for(size_t ist = 0; ist < n_states; ++ist)
+    current[ist] *= emissions[ist];
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::Traceback(TracebackPath& path) {
+// divide <scoring_current> by its sum, and set the forward log prob for <position> (NOTE this is the only place we call log())
+template <class T> bool BasicTrellis<T>::RescaleColumn(ArenaVector<T> *scoring_current, size_t position, double *log_scale) {
+  size_t n_states(compiled_->n_states());
+  T *current(scoring_current->data());
+  const T *end_probs(transition_scores_->end_probs.data());
+  T total(0.);
+  for(size_t ist = 0; ist < n_states; ++ist)
+    total += current[ist];
+  if(total == 0.)
+    return false;
+
+  T inverse(1. / total);
+  T ending_total(0.);
+  for(size_t ist = 0; ist < n_states; ++ist) {
+    current[ist] *= inverse;
+    ending_total += current[ist] * end_probs[ist];
+  }
+  *log_scale += log((double)total);
+  forward_log_probs_[position] = ending_total > 0. ? *log_scale + log((double)ending_total) : -INFINITY;
+  return true;
+}
+
+// ----------------------------------------------------------------------------------------
+// With lots of sequences, the emission probs for a column can be too small for a double, so we divide them by the largest one.
+template <class T> const T *BasicTrellis<T>::EmissionProbColumn(size_t position, double *log_scale) {
+  if(seqs_.n_seqs() == 1)
+    return &emission_scores_->emission_probs_by_column[columns_[position] * compiled_->n_states()];
+  emission_prob_column_.resize(compiled_->n_states());
+  double max_log_prob(-INFINITY);
+  for(size_t ist = 0; ist < compiled_->n_states(); ++ist) {
+    emission_prob_column_[ist] = EmissionLogprob(ist, position);
+    max_log_prob = max(max_log_prob, (double)emission_prob_column_[ist]);
+  }
+  if(max_log_prob == -INFINITY)  // nothing can emit this column, so they're all zero no matter what
+    max_log_prob = 0.;
+  for(size_t ist = 0; ist < compiled_->n_states(); ++ist)
+    emission_prob_column_[ist] = exp(emission_prob_column_[ist] - max_log_prob);
+  *log_scale += max_log_prob;
+  return emission_prob_column_.data();
+}
+
+// ----------------------------------------------------------------------------------------
+template <class T> void BasicTrellis<T>::Traceback(TracebackPath& path) {
   assert(seqs_.GetSequenceLength() != 0);
   assert(path.model());
   path.set_model(hmm_);
@@ -286,9 +718,15 @@ void Trellis::Traceback(TracebackPath& path) {
   path.set_score(ending_viterbi_log_prob_);
   path.push_back(ending_viterbi_pointer_);  // push back the state that led to END state
 
-  int16_t pointer(ending_viterbi_pointer_);
+  int32_t pointer(ending_viterbi_pointer_);
+  BasicTrellis *table_owner(cached_trellis_ ? cached_trellis_ : this);  // if we have a cached trellis, it's got the traceback info
+  if(table_owner->checkpoint_interval() > 0) {
+    table_owner->CheckpointedTraceback(seqs_.GetSequenceLength(), pointer, path);
+    return;
+  }
+
   for(size_t position = seqs_.GetSequenceLength() - 1; position > 0; position--) {
-    pointer = (*traceback_table_pointer_)[position][pointer];  // NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
+    pointer = traceback_table_pointer_->get(position, pointer);  // NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
     if(pointer == -1) {
       cerr << "No valid path at Position: " << position << endl;
       return;
@@ -297,4 +735,31 @@ void Trellis::Traceback(TracebackPath& path) {
   }
   assert(path.size() > 0);  // NOTE don't remove this! dphandler assumes paths are invalid/not set if path size is zero
 }
+
+// ----------------------------------------------------------------------------------------
+// Trace back from state <pointer> at position <length> - 1 (where <length> can be shorter than our sequences if we're being used as a chunk cache),
+// recomputing the traceback table one checkpoint segment at a time, starting from the last one.
+template <class T> void BasicTrellis<T>::CheckpointedTraceback(size_t length, int32_t pointer, TracebackPath &path) {
+  assert(length <= seqs_.GetSequenceLength());
+  TracebackTable segment_table;
+  segment_table.Init(checkpoint_interval_, compiled_);
+  size_t position(length - 1);
+  while(position > 0) {
+    size_t start = ((position - 1) / checkpoint_interval_) * checkpoint_interval_;  // checkpoint column from which we can recompute the pointers at <position>
+    RecomputeTracebackSegment(start, position, segment_table);
+    for( ; position > start; --position) {
+      pointer = segment_table.get(position - start - 1, pointer);
+      if(pointer == -1) {
+        cerr << "No valid path at Position: " << position << endl;
+        return;
+      }
+      path.push_back(pointer);
+    }
+  }
+  assert(path.size() > 0);  // NOTE don't remove this! dphandler assumes paths are invalid/not set if path size is zero
+}
+// ----------------------------------------------------------------------------------------
+template class BasicTrellis<double>;
+template class BasicTrellis<float>;
+
 }
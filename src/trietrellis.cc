@@ -0,0 +1,258 @@
+#include "trietrellis.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+TrieTrellis::TrieTrellis(AlleleTrie *trie, SequencesView seqs, vector<size_t> igenes) :
+  trie_(trie),
+  seqs_(seqs),
+  igenes_(igenes),
+  n_positions_(seqs.GetSequenceLength()),
+  simd_kernels_(simd_kernels()),
+  live_nodes_(trie->n_nodes(), 0)
+{
+  for(auto &igene : igenes_) {
+    if(!trie_->hmm(igene)->compiled()->is_chain())
+      throw runtime_error("ERROR trie trellis only works for chain models, but " + trie_->hmm(igene)->name() + " isn't one");
+    for(auto &inode : trie_->path(igene))
+      live_nodes_[inode] = 1;
+  }
+  if(igenes_.size() > 0 && seqs_.n_seqs() == 1) {
+    columns_.resize(n_positions_);
+    for(size_t position = 0; position < n_positions_; ++position)
+      columns_[position] = trie_->hmm(igenes_[0])->track()->column(seqs_.value(0, position));
+  } else if(seqs_.n_seqs() > 1) {
+    seqs_.profile();
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void TrieTrellis::Viterbi() {
+  size_t n_nodes(trie_->n_nodes()), max_width(0);
+  scoring_previous_.resize(n_nodes);
+  scoring_current_.resize(n_nodes);
+  cells_.resize(n_nodes);
+  best_log_probs_.resize(n_nodes);
+  best_indices_.resize(n_nodes);
+  for(size_t inode = 0; inode < n_nodes; ++inode) {
+    if(!live_nodes_[inode])
+      continue;
+    size_t width(trie_->node(inode).state_end - trie_->node(inode).state_begin);
+    max_width = max(max_width, width);
+    scoring_previous_[inode].assign(width, -INFINITY);
+    scoring_current_[inode].assign(width, -INFINITY);
+    cells_[inode].assign(n_positions_ * width, 0);
+    best_log_probs_[inode].assign(n_positions_, -INFINITY);
+    best_indices_[inode].assign(n_positions_, -1);
+  }
+  emission_column_.resize(max_width);
+  chain_vals_.resize(max_width);
+  chain_improved_.resize(max_width);
+
+  if(n_positions_ > 0) {
+    for(size_t inode = 0; inode < n_nodes; ++inode) {
+      if(!live_nodes_[inode])
+	continue;
+      InitVals(inode);
+      CacheViterbiVals(inode, 0);
+    }
+  }
+  for(size_t position = 1; position < n_positions_; ++position) {
+    for(size_t inode = 0; inode < n_nodes; ++inode)  // all of them first, since the children need their ancestors' previous columns
+      scoring_previous_[inode].swap(scoring_current_[inode]);
+    for(size_t inode = 0; inode < n_nodes; ++inode) {  // parents come before their children, although it doesn't actually matter
+      if(!live_nodes_[inode])
+	continue;
+      MiddleVals(inode, position);
+      CacheViterbiVals(inode, position);
+    }
+  }
+
+  viterbi_log_probs_.resize(trie_->n_genes());
+  viterbi_indices_.resize(trie_->n_genes());
+  traceback_tables_.resize(trie_->n_genes());
+  for(auto &igene : igenes_)
+    FillGene(igene);
+}
+
+// ----------------------------------------------------------------------------------------
+const double *TrieTrellis::EmissionColumn(size_t inode, size_t position) {
+  AlleleTrie::Node &node(trie_->node(inode));
+  CompiledModel *compiled(node.hmm->compiled());
+  if(seqs_.n_seqs() == 1)
+    return compiled->emission_column(columns_[position]) + node.state_begin;
+  const uint32_t *counts(&seqs_.profile()[position * seqs_.n_profile_columns()]);  // see Trellis::EmissionLogprob()
+  for(size_t ist = node.state_begin; ist < node.state_end; ++ist)
+    emission_column_[ist - node.state_begin] = compiled->emission_log_prob(ist, counts);
+  return emission_column_.data();
+}
+
+// ----------------------------------------------------------------------------------------
+double TrieTrellis::PreviousVal(size_t inode, size_t ist) {
+  while(ist < trie_->node(inode).state_begin)
+    inode = trie_->node(inode).parent;
+  return scoring_previous_[inode][ist - trie_->node(inode).state_begin];
+}
+
+// ----------------------------------------------------------------------------------------
+// first position (see Trellis::Viterbi())
+void TrieTrellis::InitVals(size_t inode) {
+  AlleleTrie::Node &node(trie_->node(inode));
+  CompiledModel *compiled(node.hmm->compiled());
+  const double *emissions(EmissionColumn(inode, 0));
+  ArenaVector<double> &current(scoring_current_[inode]);
+  current.assign(current.size(), -INFINITY);
+  const vector<uint16_t> &init_indices(compiled->init_indices());
+  for(size_t iinit = 0; iinit < init_indices.size(); ++iinit) {
+    size_t i_st_current(init_indices[iinit]);
+    if(i_st_current < node.state_begin || i_st_current >= node.state_end)
+      continue;
+    double dpval = emissions[i_st_current - node.state_begin] + compiled->init_log_probs()[iinit];
+    if(dpval == -INFINITY)
+      continue;
+    current[i_st_current - node.state_begin] = dpval;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Same as Trellis::SimdChainViterbiVals() for the node's states, except that the chain edge into the node's first state comes from its parent.
+void TrieTrellis::MiddleVals(size_t inode, size_t position) {
+  AlleleTrie::Node &node(trie_->node(inode));
+  CompiledModel *compiled(node.hmm->compiled());
+  size_t begin(node.state_begin), width(node.state_end - node.state_begin);
+  if(width == 0)
+    return;
+  const uint16_t *from_indices(compiled->from_indices());
+  const double *from_log_probs(compiled->from_log_probs());
+  const double *chain_log_probs(compiled->chain_log_probs() + begin);
+  const double *emissions(EmissionColumn(inode, position));
+  const double *previous(scoring_previous_[inode].data());
+  double *current(scoring_current_[inode].data());
+  uint16_t *cells(&cells_[inode][position * width]);
+  double *chain_vals(chain_vals_.data());
+
+  if(simd_kernels_) {
+    simd_kernels_->chain_vals(emissions, chain_log_probs, previous, chain_vals, width);
+  } else {  // see Trellis::FillChainVals()
+    chain_vals[0] = -INFINITY;
+    for(size_t ist = 1; ist < width; ++ist)
+      chain_vals[ist] = emissions[ist] + chain_log_probs[ist];
+    for(size_t ist = 1; ist < width; ++ist)
+      chain_vals[ist] += previous[ist - 1];
+  }
+  if(begin > 0) {
+    chain_vals[0] = emissions[0] + chain_log_probs[0];
+    chain_vals[0] += PreviousVal(inode, begin - 1);
+  }
+
+  for(size_t ist = 0; ist < width; ++ist)
+    current[ist] = -INFINITY;
+  const vector<uint16_t> &residual_states(compiled->residual_states());
+  for(auto it = lower_bound(residual_states.begin(), residual_states.end(), begin); it != residual_states.end() && *it < node.state_end; ++it) {
+    size_t i_st_current(*it);
+    double emission_val = emissions[i_st_current - begin];
+    if(emission_val == -INFINITY)
+      continue;
+    double &cur(current[i_st_current - begin]);
+    for(size_t ifrom = compiled->from_begin(i_st_current); ifrom < compiled->residual_end(i_st_current); ++ifrom) {
+      double previous_val(PreviousVal(inode, from_indices[ifrom]));
+      if(previous_val == -INFINITY)
+	continue;
+      double dpval = (emission_val + from_log_probs[ifrom]) + previous_val;
+      if(dpval > cur) {
+	cur = dpval;
+	cells[i_st_current - begin] = ifrom - compiled->from_begin(i_st_current) + 1;
+      }
+    }
+  }
+
+  uint8_t *improved(chain_improved_.data());
+  if(simd_kernels_) {
+    simd_kernels_->viterbi_merge(chain_vals, current, improved, width);
+  } else {
+    for(size_t ist = 0; ist < width; ++ist) {
+      improved[ist] = chain_vals[ist] > current[ist];
+      current[ist] = improved[ist] ? chain_vals[ist] : current[ist];
+    }
+  }
+  for(size_t ist = 0; ist < width; ++ist) {
+    if(improved[ist])
+      cells[ist] = compiled->residual_end(begin + ist) - compiled->from_begin(begin + ist) + 1;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// best log prob (including the end transition) of the node's states at <position>, and the first state that has it
+void TrieTrellis::CacheViterbiVals(size_t inode, size_t position) {
+  AlleleTrie::Node &node(trie_->node(inode));
+  size_t width(node.state_end - node.state_begin);
+  const double *current(scoring_current_[inode].data());
+  const double *end_log_probs(node.hmm->compiled()->end_log_probs() + node.state_begin);
+  double best(-INFINITY);
+  size_t i_best(SIZE_MAX);
+  if(simd_kernels_ && width > 0) {
+    i_best = simd_kernels_->viterbi_best_ending(current, end_log_probs, width, &best);
+  } else {
+    for(size_t ist = 0; ist < width; ++ist) {
+      if(current[ist] + end_log_probs[ist] > best) {
+	best = current[ist] + end_log_probs[ist];
+	i_best = ist;
+      }
+    }
+  }
+  if(i_best != SIZE_MAX) {
+    best_log_probs_[inode][position] = best;
+    best_indices_[inode][position] = node.state_begin + i_best;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// stitch together <igene>'s log probs and traceback table from the nodes on its path
+void TrieTrellis::FillGene(size_t igene) {
+  vector<size_t> &path(trie_->path(igene));
+  viterbi_log_probs_[igene].assign(n_positions_, -INFINITY);
+  viterbi_indices_[igene].assign(n_positions_, -1);
+  for(size_t position = 0; position < n_positions_; ++position) {
+    for(auto &inode : path) {  // nodes are in order of their states, so the first state with the best value wins, as in Trellis
+      if(best_log_probs_[inode][position] > viterbi_log_probs_[igene][position]) {
+	viterbi_log_probs_[igene][position] = best_log_probs_[inode][position];
+	viterbi_indices_[igene][position] = best_indices_[inode][position];
+      }
+    }
+  }
+
+  Model *hmm(trie_->hmm(igene));
+  traceback_tables_[igene].Init(n_positions_, hmm->compiled());
+  vector<uint16_t> row(hmm->n_states(), 0);
+  for(size_t position = 1; position < n_positions_; ++position) {
+    for(auto &inode : path) {
+      AlleleTrie::Node &node(trie_->node(inode));
+      size_t width(node.state_end - node.state_begin);
+      copy(&cells_[inode][position * width], &cells_[inode][position * width] + width, row.begin() + node.state_begin);
+    }
+    traceback_tables_[igene].set_row(position, row.data(), 1);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void TrieTrellis::Traceback(size_t igene, TracebackPath &path) {
+  assert(path.model());
+  path.set_model(trie_->hmm(igene));
+  if(ending_viterbi_log_prob(igene) == -INFINITY)  // no valid path through this hmm
+    return;
+  path.set_score(ending_viterbi_log_prob(igene));
+  path.push_back(ending_viterbi_pointer(igene));
+
+  int32_t pointer(ending_viterbi_pointer(igene));
+  for(size_t position = n_positions_ - 1; position > 0; position--) {
+    pointer = traceback_tables_[igene].get(position, pointer);
+    if(pointer == -1) {
+      cerr << "No valid path at Position: " << position << endl;
+      return;
+    }
+    path.push_back(pointer);
+  }
+  assert(path.size() > 0);
+}
+
+}
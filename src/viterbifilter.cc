@@ -0,0 +1,116 @@
+#include "viterbifilter.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+ViterbiFilter::ViterbiFilter(Model *hmm, SequencesView seqs) :
+  hmm_(hmm),
+  compiled_(hmm->compiled()),
+  transition_scores_(&compiled_->transition_scores<int16_t>()),
+  emission_scores_(&compiled_->emission_scores<int16_t>()),
+  seqs_(seqs),
+  scoring_previous_(compiled_->n_states(), kQuantizedMinusInfinity),
+  scoring_current_(compiled_->n_states(), kQuantizedMinusInfinity),
+  first_saturated_position_(SIZE_MAX)
+{
+  if(seqs_.n_seqs() == 1) {
+    columns_.resize(seqs_.GetSequenceLength());
+    for(size_t position = 0; position < seqs_.GetSequenceLength(); ++position)
+      columns_[position] = hmm_->track()->column(seqs_.value(0, position));
+  } else {
+    seqs_.profile();
+    emission_column_.resize(compiled_->n_states());
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void ViterbiFilter::Run() {
+  size_t n_states(compiled_->n_states());
+  ending_scores_.assign(seqs_.GetSequenceLength(), kQuantizedMinusInfinity);
+  first_saturated_position_ = SIZE_MAX;
+  if(seqs_.GetSequenceLength() == 0)
+    return;
+
+  // first column
+  int saturated(0);  // nonzero once anything has saturated
+  const int16_t *emissions(EmissionColumn(0, saturated));
+  int16_t *current(scoring_current_.data());
+  for(size_t ist = 0; ist < n_states; ++ist)
+    current[ist] = kQuantizedMinusInfinity;
+  const vector<uint16_t> &init_indices(compiled_->init_indices());
+  for(size_t iinit = 0; iinit < init_indices.size(); ++iinit)
+    current[init_indices[iinit]] = SaturatingAdd(transition_scores_->init_log_probs[iinit], emissions[init_indices[iinit]], saturated);
+  ending_scores_[0] = EndingScore(saturated);
+  if(saturated)
+    first_saturated_position_ = 0;
+
+  for(size_t position = 1; position < seqs_.GetSequenceLength(); ++position) {
+    scoring_previous_.swap(scoring_current_);
+    MiddleVals(position, saturated);
+    ending_scores_[position] = EndingScore(saturated);
+    if(saturated && first_saturated_position_ == SIZE_MAX)
+      first_saturated_position_ = position;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+double ViterbiFilter::ending_log_prob(size_t length) {
+  assert(length > 0 && length <= ending_scores_.size());
+  int16_t score(ending_scores_[length - 1]);
+  return score == kQuantizedMinusInfinity ? -INFINITY : score / kQuantizedScale;
+}
+
+// ----------------------------------------------------------------------------------------
+const int16_t *ViterbiFilter::EmissionColumn(size_t position, int &saturated) {
+  if(seqs_.n_seqs() == 1)  // a single emission can't be small enough to saturate
+    return &emission_scores_->emissions_by_column[columns_[position] * compiled_->n_states()];
+  const uint32_t *counts(&seqs_.profile()[position * seqs_.n_profile_columns()]);
+  for(size_t ist = 0; ist < compiled_->n_states(); ++ist) {
+    double log_prob(compiled_->emission_log_prob(ist, counts));
+    emission_column_[ist] = QuantizeLogProb(log_prob);
+    saturated |= emission_column_[ist] == kQuantizedMinusInfinity && log_prob != -INFINITY;
+  }
+  return emission_column_.data();
+}
+
+// ----------------------------------------------------------------------------------------
+void ViterbiFilter::MiddleVals(size_t position, int &saturated) {
+  size_t n_states(compiled_->n_states());
+  const int16_t *previous(scoring_previous_.data());
+  int16_t *current(scoring_current_.data());
+  const uint16_t *from_indices(compiled_->from_indices());
+  const int16_t *from_log_probs(transition_scores_->from_log_probs.data());
+  if(compiled_->is_chain()) {  // shifted chain edges for all the states at once, then the few residual ones
+    const int16_t *chain_log_probs(transition_scores_->chain_log_probs.data());
+    current[0] = kQuantizedMinusInfinity;
+    for(size_t ist = 1; ist < n_states; ++ist)
+      current[ist] = SaturatingAdd(previous[ist - 1], chain_log_probs[ist], saturated);
+    for(auto &ist : compiled_->residual_states()) {
+      for(size_t ifrom = compiled_->from_begin(ist); ifrom < compiled_->residual_end(ist); ++ifrom)
+        current[ist] = max(current[ist], SaturatingAdd(previous[from_indices[ifrom]], from_log_probs[ifrom], saturated));
+    }
+  } else {
+    for(size_t ist = 0; ist < n_states; ++ist) {
+      int16_t best(kQuantizedMinusInfinity);
+      for(size_t ifrom = compiled_->from_begin(ist); ifrom < compiled_->from_end(ist); ++ifrom)
+        best = max(best, SaturatingAdd(previous[from_indices[ifrom]], from_log_probs[ifrom], saturated));
+      current[ist] = best;
+    }
+  }
+
+  const int16_t *emissions(EmissionColumn(position, saturated));
+  for(size_t ist = 0; ist < n_states; ++ist)
+    current[ist] = SaturatingAdd(current[ist], emissions[ist], saturated);
+}
+
+// ----------------------------------------------------------------------------------------
+int16_t ViterbiFilter::EndingScore(int &saturated) {
+  const int16_t *current(scoring_current_.data());
+  const int16_t *end_log_probs(transition_scores_->end_log_probs.data());
+  int16_t best(kQuantizedMinusInfinity);
+  for(size_t ist = 0; ist < compiled_->n_states(); ++ist)
+    best = max(best, SaturatingAdd(current[ist], end_log_probs[ist], saturated));
+  return best;
+}
+
+}
@@ -0,0 +1,40 @@
+#!/bin/bash
+# Time bcrham on the regression test data (run from the top-level directory, after `scons bcrham`). Any arguments are passed on to
+# bcrham, so comparing e.g. `test/benchmark.sh` to `test/benchmark.sh --j-suffix-trellis` shows what an option buys. The partition
+# and viterbi timings quoted in the commit log are for these same runs on this same data. We print the median of --n-runs runs.
+#   partition: forward --partition on single-input.csv (24 single-sequence queries)
+#   viterbi:   viterbi on single-input.csv
+#   viterbi-x20: viterbi on single-input.csv repeated 20 times (480 queries), so per-query costs dominate startup
+set -e -o pipefail
+n_runs=5
+if [ "$1" == "--n-runs" ]; then
+    n_runs=$2
+    shift 2
+fi
+
+bcrham=./bcrham
+testdir=test/data/regression/bcrham
+args="--locus igh --hmmdir $testdir --datadir $testdir/germlines --ambig-base N --random-seed 1 $@"
+workdir=$(mktemp -d)
+trap "rm -rf $workdir" EXIT
+
+head -n1 $testdir/single-input.csv > $workdir/x20-input.csv
+for irep in $(seq 20); do
+    tail -n+2 $testdir/single-input.csv | awk -v irep=$irep '{$1 = "r" irep $1; print}' >> $workdir/x20-input.csv
+done
+
+# print the median wall time of <n_runs> runs of bcrham with the given arguments
+time_bcrham() {
+    name=$1
+    shift
+    for irun in $(seq $n_runs); do
+        start=$(date +%s.%N)
+        $bcrham "$@" $args --outfile $workdir/$name.out > $workdir/$name.log 2>&1 || { cat $workdir/$name.log; exit 1; }
+        end=$(date +%s.%N)
+        echo "$start $end" | awk '{print $2 - $1}'
+    done | sort -n | awk -v name=$name '{times[NR] = $1} END {printf "%12s %6.2f s\n", name, times[int((NR + 1) / 2)]}'
+}
+
+time_bcrham partition --algorithm forward --partition --logprob-ratio-threshold 18 --infile $testdir/single-input.csv
+time_bcrham viterbi --algorithm viterbi --infile $testdir/single-input.csv
+time_bcrham viterbi-x20 --algorithm viterbi --infile $workdir/x20-input.csv